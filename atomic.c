@@ -55,7 +55,7 @@ static int bcf_atom_gen_at(const bcf_hdr_t *h, bcf1_t *b, int n, bcf_atom_t *a)
 		for (i = 0, m = 0; i < b->n_sample; ++i, m += gt->n) {
 			for (j = 0; j < gt->n; ++j) {
 				int c = (int)(gt->p[m+j] >> 1) - 1;
-				c = c < 0? 2 : tr[c];
+				c = c < 0 || c >= b->n_allele? 2 : tr[c]; // end-of-vector (haploid) is taken as missing
 				ak->gt[ak->n_gt++] = c;
 				if (c == 3) ak->has_multi = 1;
 			}
@@ -178,17 +178,245 @@ void bcf_atomize(const bcf_hdr_t *h, bcf1_t *b, bcf_atom_v *a)
 	a->n = bcf_atom_gen_at(h, b, a->n, a->a);
 }
 
-static inline int flt_read1(htsFile *in, const bcf_hdr_t *h, bcf1_t *b, int keep_flt)
+/*********************************
+ * Multi-threaded GT-only reader *
+ *********************************/
+
+#include <pthread.h>
+#include "kseq.h"
+
+#define VB_MAX_LINES 1024
+#define VB_MAX_BYTES (1<<26)
+
+/* With more than one thread, a reader thread fills two batches of lines in
+ * turn and a pool of parser threads, started once, parses each batch with
+ * lines interleaved across threads. The next batch is thus read while the
+ * current one is parsed and consumed. Batches are numbered; batch k lives in
+ * slot k&1. With one thread, batches are read and parsed in the caller. */
+
+#define VB_EMPTY  0 // free for the reader
+#define VB_READ   1 // lines read, to be parsed
+#define VB_PARSED 2 // parsed, to be consumed
+
+typedef struct {
+	int n, state, n_left, eof; // n_left: #parser threads still working on the batch
+	int64_t seq;
+	kstring_t *s;
+	bcf1_t **b;
+	int *ret;
+} vb_slot_t;
+
+struct vcf_batch_s {
+	int i, n_threads, quit, ready;
+	int64_t seq; // the batch being consumed
+	htsFile *in;
+	const bcf_hdr_t *h;
+	vb_slot_t slot[2];
+	pthread_t reader, *tid;
+	struct vb_worker_s *w;
+	pthread_mutex_t lock;
+	pthread_cond_t cv;
+};
+
+typedef struct vb_worker_s {
+	vcf_batch_t *vb;
+	int tid;
+} vb_worker_t;
+
+// read a batch of lines; return the number of lines
+static int vb_fill(htsFile *in, vb_slot_t *p)
+{
+	int64_t l = 0;
+	p->n = 0;
+	while (!p->eof && p->n < VB_MAX_LINES && l < VB_MAX_BYTES) {
+		kstring_t *s = &p->s[p->n];
+		if (hts_getline(in, KS_SEP_LINE, s) < 0) p->eof = 1;
+		else if (s->l > 0) l += s->l, ++p->n;
+	}
+	return p->n;
+}
+
+static void *vb_reader(void *data)
+{
+	vcf_batch_t *vb = (vcf_batch_t*)data;
+	int64_t seq;
+	for (seq = 0;; ++seq) {
+		vb_slot_t *p = &vb->slot[seq&1];
+		int eof, quit;
+		pthread_mutex_lock(&vb->lock);
+		while (p->state != VB_EMPTY && !vb->quit)
+			pthread_cond_wait(&vb->cv, &vb->lock);
+		quit = vb->quit;
+		pthread_mutex_unlock(&vb->lock);
+		if (quit) break;
+		vb_fill(vb->in, p); // the slot is owned by this thread while empty
+		eof = p->eof;
+		pthread_mutex_lock(&vb->lock);
+		p->seq = seq, p->n_left = vb->n_threads;
+		p->state = p->n > 0? VB_READ : VB_PARSED;
+		pthread_cond_broadcast(&vb->cv);
+		pthread_mutex_unlock(&vb->lock);
+		if (eof) break;
+	}
+	return 0;
+}
+
+static void *vb_worker(void *data)
+{
+	vb_worker_t *w = (vb_worker_t*)data;
+	vcf_batch_t *vb = w->vb;
+	int64_t seq;
+	for (seq = 0;; ++seq) {
+		vb_slot_t *p = &vb->slot[seq&1];
+		int i, quit;
+		pthread_mutex_lock(&vb->lock);
+		while (!(p->state == VB_READ && p->seq == seq) && !vb->quit)
+			pthread_cond_wait(&vb->cv, &vb->lock);
+		quit = vb->quit;
+		pthread_mutex_unlock(&vb->lock);
+		if (quit) break;
+		for (i = w->tid; i < p->n; i += vb->n_threads)
+			p->ret[i] = vcf_parse1_gt(&p->s[i], vb->h, p->b[i]);
+		pthread_mutex_lock(&vb->lock);
+		if (--p->n_left == 0) {
+			p->state = VB_PARSED;
+			pthread_cond_broadcast(&vb->cv);
+		}
+		pthread_mutex_unlock(&vb->lock);
+	}
+	return 0;
+}
+
+static vcf_batch_t *vb_init(htsFile *in, const bcf_hdr_t *h, int n_threads)
+{
+	vcf_batch_t *vb;
+	int i, j;
+	vb = (vcf_batch_t*)calloc(1, sizeof(vcf_batch_t));
+	vb->n_threads = n_threads > 0? n_threads : 1;
+	vb->in = in, vb->h = h;
+	for (j = 0; j < 2; ++j) {
+		vb_slot_t *p = &vb->slot[j];
+		p->s = (kstring_t*)calloc(VB_MAX_LINES, sizeof(kstring_t));
+		p->b = (bcf1_t**)calloc(VB_MAX_LINES, sizeof(bcf1_t*));
+		p->ret = (int*)calloc(VB_MAX_LINES, sizeof(int));
+		for (i = 0; i < VB_MAX_LINES; ++i) p->b[i] = bcf_init1();
+		if (vb->n_threads == 1) break; // only one slot is used
+	}
+	if (vb->n_threads > 1) {
+		pthread_mutex_init(&vb->lock, 0);
+		pthread_cond_init(&vb->cv, 0);
+		vb->tid = (pthread_t*)calloc(vb->n_threads, sizeof(pthread_t));
+		vb->w = (vb_worker_t*)calloc(vb->n_threads, sizeof(vb_worker_t));
+		for (i = 0; i < vb->n_threads; ++i) {
+			vb->w[i].vb = vb, vb->w[i].tid = i;
+			pthread_create(&vb->tid[i], 0, vb_worker, &vb->w[i]);
+		}
+		pthread_create(&vb->reader, 0, vb_reader, vb);
+	}
+	return vb;
+}
+
+static void vb_destroy(vcf_batch_t *vb)
+{
+	int i, j;
+	if (vb == 0) return;
+	if (vb->n_threads > 1) {
+		pthread_mutex_lock(&vb->lock);
+		vb->quit = 1;
+		pthread_cond_broadcast(&vb->cv);
+		pthread_mutex_unlock(&vb->lock);
+		pthread_join(vb->reader, 0);
+		for (i = 0; i < vb->n_threads; ++i) pthread_join(vb->tid[i], 0);
+		pthread_mutex_destroy(&vb->lock);
+		pthread_cond_destroy(&vb->cv);
+		free(vb->tid); free(vb->w);
+	}
+	for (j = 0; j < 2; ++j) {
+		vb_slot_t *p = &vb->slot[j];
+		if (p->s == 0) continue;
+		for (i = 0; i < VB_MAX_LINES; ++i) {
+			free(p->s[i].s);
+			bcf_destroy1(p->b[i]);
+		}
+		free(p->s); free(p->b); free(p->ret);
+	}
+	free(vb);
+}
+
+// wait for the next batch to be parsed; return its slot
+static vb_slot_t *vb_next(vcf_batch_t *vb)
+{
+	vb_slot_t *p = &vb->slot[vb->seq&1];
+	if (vb->n_threads == 1) { // read and parse in the calling thread
+		int i;
+		if (p->eof) p->n = 0;
+		else vb_fill(vb->in, p);
+		for (i = 0; i < p->n; ++i)
+			p->ret[i] = vcf_parse1_gt(&p->s[i], vb->h, p->b[i]);
+		return p;
+	}
+	pthread_mutex_lock(&vb->lock);
+	while (!(p->state == VB_PARSED && p->seq == vb->seq))
+		pthread_cond_wait(&vb->cv, &vb->lock);
+	pthread_mutex_unlock(&vb->lock);
+	return p;
+}
+
+// hand the consumed batch back to the reader
+static void vb_release(vcf_batch_t *vb)
+{
+	if (vb->n_threads > 1) {
+		vb_slot_t *p = &vb->slot[vb->seq&1];
+		pthread_mutex_lock(&vb->lock);
+		p->state = VB_EMPTY;
+		pthread_cond_broadcast(&vb->cv);
+		pthread_mutex_unlock(&vb->lock);
+		++vb->seq;
+	}
+	vb->ready = 0;
+}
+
+// the next parsed record is swapped into *b
+static int vb_read1(vcf_batch_t *vb, bcf1_t **b)
+{
+	for (;;) {
+		vb_slot_t *p;
+		if (!vb->ready) {
+			p = vb_next(vb);
+			vb->ready = 1, vb->i = 0;
+		} else p = &vb->slot[vb->seq&1];
+		if (vb->i == p->n) {
+			if (p->eof) return -1;
+			vb_release(vb);
+			continue;
+		}
+		if (p->ret[vb->i] >= 0) {
+			bcf1_t *tmp = *b;
+			*b = p->b[vb->i];
+			p->b[vb->i++] = tmp;
+			return 0;
+		}
+		++vb->i;
+	}
+}
+
+/********************
+ * Atomized reading *
+ ********************/
+
+static inline int flt_read1(bcf_atombuf_t *buf)
 {
 	int ret;
 	for (;;) {
-		if ((ret = vcf_read1(in, h, b)) < 0) break;
-		if (keep_flt || !bcf_is_filtered(b)) break;
+		if (buf->vb) ret = vb_read1(buf->vb, &buf->b);
+		else ret = vcf_read1(buf->in, buf->h, buf->b);
+		if (ret < 0) break;
+		if (buf->keep_flt || !bcf_is_filtered(buf->b)) break;
 	}
 	return ret;
 }
 
-bcf_atombuf_t *bcf_atombuf_init(htsFile *in, int keep_flt)
+bcf_atombuf_t *bcf_atombuf_init2(htsFile *in, int keep_flt, int n_threads)
 {
 	bcf_atombuf_t *buf;
 	buf = (bcf_atombuf_t*)calloc(1, sizeof(bcf_atombuf_t));
@@ -196,14 +424,21 @@ bcf_atombuf_t *bcf_atombuf_init(htsFile *in, int keep_flt)
 	buf->in = in;
 	buf->h = vcf_hdr_read(buf->in);
 	buf->b = bcf_init1();
-	if (flt_read1(buf->in, buf->h, buf->b, buf->keep_flt) >= 0) {
+	if (n_threads > 0 && in->is_bin == 0) // text VCF only
+		buf->vb = vb_init(buf->in, buf->h, n_threads);
+	if (flt_read1(buf) >= 0) {
 		bcf_atomize(buf->h, buf->b, &buf->a);
-		if (flt_read1(buf->in, buf->h, buf->b, buf->keep_flt) < 0)
+		if (flt_read1(buf) < 0)
 			buf->no_vcf = 1;
 	} else buf->no_vcf = 1;
 	return buf;
 }
 
+bcf_atombuf_t *bcf_atombuf_init(htsFile *in, int keep_flt)
+{
+	return bcf_atombuf_init2(in, keep_flt, 0);
+}
+
 void bcf_atombuf_destroy(bcf_atombuf_t *buf)
 {
 	int i;
@@ -213,6 +448,7 @@ void bcf_atombuf_destroy(bcf_atombuf_t *buf)
 	}
 	free(buf->a.a);
 	bcf_destroy1(buf->b);
+	vb_destroy(buf->vb);
 	bcf_hdr_destroy(buf->h);
 	free(buf);
 }
@@ -223,7 +459,7 @@ const bcf_atom_t *bcf_atom_read(bcf_atombuf_t *buf)
 		if (buf->no_vcf) return 0;
 		buf->a.n = buf->start = 0;
 		bcf_atomize(buf->h, buf->b, &buf->a);
-		if (flt_read1(buf->in, buf->h, buf->b, buf->keep_flt) < 0)
+		if (flt_read1(buf) < 0)
 			buf->no_vcf = 1;
 	}
 	assert(buf->start < buf->a.n);
@@ -241,7 +477,7 @@ const bcf_atom_t *bcf_atom_read(bcf_atombuf_t *buf)
 			free(tmp);
 		}
 		bcf_atomize(buf->h, buf->b, &buf->a);
-		if (flt_read1(buf->in, buf->h, buf->b, buf->keep_flt) < 0)
+		if (flt_read1(buf) < 0)
 			buf->no_vcf = 1;
 	}
 }
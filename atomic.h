@@ -16,6 +16,9 @@ typedef struct {
 	bcf_atom_t *a;
 } bcf_atom_v;
 
+struct vcf_batch_s;
+typedef struct vcf_batch_s vcf_batch_t;
+
 typedef struct {
 	htsFile *in;
 	bcf_atom_v a;
@@ -23,10 +26,12 @@ typedef struct {
 	int start;
 	uint32_t no_vcf:16, keep_flt:16;
 	bcf_hdr_t *h;
+	vcf_batch_t *vb; // non-NULL if VCF lines are parsed with vcf_parse1_gt() in batches
 } bcf_atombuf_t;
 
 void bcf_atomize(const bcf_hdr_t *h, bcf1_t *b, bcf_atom_v *a);
 bcf_atombuf_t *bcf_atombuf_init(htsFile *in, int keep_flt);
+bcf_atombuf_t *bcf_atombuf_init2(htsFile *in, int keep_flt, int n_threads);
 void bcf_atombuf_destroy(bcf_atombuf_t *buf);
 const bcf_atom_t *bcf_atom_read(bcf_atombuf_t *buf);
 void bcf_atom2bcf2(const bcf_atom_t *a, bcf1_t *b, int write_M, int id_GT, int use_missing);
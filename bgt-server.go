@@ -199,6 +199,8 @@ func bgs_help(w http.ResponseWriter, r *http.Request) {
 	fmt.Fprintln(w, "          a variant annotation database.\n");
 	fmt.Fprintln(w, "  f EXPR  Filters on per sample group allele counts. EXPR could include AC (primary allele count),");
 	fmt.Fprintln(w, "          AN (total called alleles), AC# (primary allele count of the #-th sample group) and AN#.\n");
+	fmt.Fprintln(w, "  A NUM   Estimate AC and AN from a random subset of samples in each group, such that 95% confidence");
+	fmt.Fprintln(w, "          intervals of allele frequencies are within +/-NUM. Genotypes are not reported.\n");
 	fmt.Fprintln(w, "VCF output parameters:\n");
 	fmt.Fprintln(w, "  g       Output sample genotypes\n");
 	fmt.Fprintln(w, "  C       Output AC and AN VCF INFO fields. This parameter is automatically set if 's' is applied.\n");
@@ -206,7 +208,8 @@ func bgs_help(w http.ResponseWriter, r *http.Request) {
 	fmt.Fprintln(w, "  S       Output samples having requested alleles (requiring parameter 'a')\n");
 	fmt.Fprintln(w, "  H       Output counts of haplotypes across requested alleles (requiring parameter 'a')\n");
 	fmt.Fprintln(w, "  t STR   Comma-separated list of fields in tabular output. Accepted variables:");
-	fmt.Fprintln(w, "          CHROM, POS, END, REF, ALT, AC, AN, AC#, AN# (# for a group number)\n");
+	fmt.Fprintln(w, "          CHROM, POS, END, REF, ALT, AC, AN, AC#, AN# (# for a group number), and AFlo,");
+	fmt.Fprintln(w, "          AFhi, AFlo# and AFhi# for 95% confidence intervals of allele frequencies\n");
 }
 
 func bgs_replace_op(t string) string {
@@ -252,6 +255,14 @@ func bgs_query(w http.ResponseWriter, r *http.Request) {
 			vcf_out = false;
 		}
 	}
+	if len(r.Form["A"]) > 0 { // approximate counts
+		eps, err := strconv.ParseFloat(r.Form["A"][0], 64);
+		if err != nil || eps <= 0 || (flag & 12) != 0 {
+			http.Error(w, "400 Bad Request: failed to set approximation with parameter 'A'", 400);
+			return;
+		}
+		C.bgtm_set_approx(bm, C.double(eps));
+	}
 	if len(r.Form["f"]) > 0 { // set site filter
 		cstr := C.CString(bgs_replace_op(r.Form["f"][0]));
 		ret := int(C.bgtm_set_flt_site(bm, cstr));
@@ -3,8 +3,12 @@
 #include <assert.h>
 #include <limits.h>
 #include <ctype.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include "bgt.h"
 #include "kstring.h"
+#include "kseq.h"
 #include "fmf.h"
 
 #include "khash.h"
@@ -12,6 +16,8 @@ KHASH_DECLARE(s2i, kh_cstr_t, int64_t)
 KHASH_SET_INIT_STR(str)
 
 int bgt_no_file = 0;
+int bgt_readahead = 16;
+int bgt_dec_threads = 1;
 
 void *bed_read(const char *fn);
 int bed_overlap(const void *_h, const char *chr, int beg, int end);
@@ -37,6 +43,184 @@ static void bgt_set_mgs(bgt_file_t *bf)
 	}
 }
 
+/* List materialized views registered in prefix.views, one prefix per line.
+ * Relative paths are resolved against the directory of prefix. The views are
+ * not opened here; bgtm_route() opens them when planning a query. */
+static void bgt_list_views(bgt_file_t *bf)
+{
+	FILE *fp;
+	char *fn, *p, **list;
+	int i, n, l_dir;
+	fn = (char*)malloc(strlen(bf->prefix) + 7);
+	sprintf(fn, "%s.views", bf->prefix);
+	if ((fp = fopen(fn, "r")) == 0) {
+		free(fn);
+		return;
+	}
+	fclose(fp);
+	l_dir = (p = strrchr(bf->prefix, '/')) != 0? p - bf->prefix + 1 : 0;
+	list = hts_readlines(fn, &n);
+	bf->view_fn = (char**)calloc(n, sizeof(char*));
+	for (i = 0; i < n; ++i) {
+		kstring_t path = {0,0,0};
+		if (list[i][0] != '/') kputsn(bf->prefix, l_dir, &path);
+		kputs(list[i], &path);
+		bf->view_fn[bf->n_views++] = path.s;
+		free(list[i]);
+	}
+	free(list); free(fn);
+}
+
+// read the settings recorded by 'bgt materialize' in the header of a view
+static char *bgt_hdr_value(const char *text, const char *key)
+{
+	const char *p, *q;
+	char *s;
+	if ((p = strstr(text, key)) == 0) return 0;
+	p += strlen(key);
+	for (q = p; *q && *q != '\n'; ++q);
+	s = (char*)calloc(q - p + 1, 1);
+	strncpy(s, p, q - p);
+	return s;
+}
+
+static void bgt_read_view_hdr(bgt_file_t *bf)
+{
+	bf->drop_mono = (strstr(bf->h0->text, "\n##bgtViewDropMono=1") != 0);
+	bf->view_reg = bgt_hdr_value(bf->h0->text, "\n##bgtViewRegion=");
+	bf->view_src = bgt_hdr_value(bf->h0->text, "\n##bgtViewSourceId=");
+}
+
+static int bgt_hdr_compatible(const bcf_hdr_t *h1, const bcf_hdr_t *h2)
+{
+	int d, i, dict[2] = { BCF_DT_ID, BCF_DT_CTG };
+	for (d = 0; d < 2; ++d) {
+		if (h1->n[dict[d]] != h2->n[dict[d]]) return 0;
+		for (i = 0; i < h1->n[dict[d]]; ++i)
+			if (strcmp(h1->id[dict[d]][i].key, h2->id[dict[d]][i].key) != 0) return 0;
+	}
+	return 1;
+}
+
+static int bgt_fmf_compatible(const fmf_t *f1, const fmf_t *f2)
+{
+	int i;
+	if (f1->n_rows != f2->n_rows) return 0;
+	for (i = 0; i < f1->n_rows; ++i)
+		if (strcmp(f1->rows[i].name, f2->rows[i].name) != 0) return 0;
+	return 1;
+}
+
+/* Open a virtual BGT split by sites. prefix.shards lists one shard per line,
+ * as "shard-prefix [region]"; relative paths are resolved against the
+ * directory of the manifest. All shards must have the same samples and header
+ * dictionaries. The sample metadata is read from prefix.spl if present, or
+ * from the first shard otherwise. */
+static bgt_file_t *bgt_open_shards(const char *prefix)
+{
+	htsFile *fp;
+	FILE *test;
+	char *fn, *p;
+	int l_dir, m = 0;
+	bgt_file_t *bf;
+	kstring_t str = {0,0,0}, path = {0,0,0};
+
+	fn = (char*)malloc(strlen(prefix) + 8);
+	sprintf(fn, "%s.shards", prefix);
+	if ((test = fopen(fn, "r")) == 0) {
+		free(fn);
+		return 0;
+	}
+	fclose(test);
+	if ((fp = hts_open(fn, "r", 0)) == 0) {
+		free(fn);
+		return 0;
+	}
+	l_dir = (p = strrchr(fn, '/')) != 0? p - fn + 1 : 0;
+	bf = (bgt_file_t*)calloc(1, sizeof(bgt_file_t));
+	bf->shard_off = (int64_t*)calloc(1, 8);
+	while (hts_getline(fp, KS_SEP_LINE, &str) >= 0) {
+		char *q, *reg = 0;
+		bgt_file_t *sf;
+		pbf_t *pb;
+		for (p = str.s; *p && isspace(*p); ++p);
+		if (*p == 0 || *p == '#') continue;
+		for (q = p; *q && !isspace(*q); ++q);
+		if (*q) {
+			for (*q++ = 0; *q && isspace(*q); ++q);
+			if (*q) {
+				for (reg = q; *q && !isspace(*q); ++q);
+				*q = 0;
+			}
+		}
+		path.l = 0;
+		if (*p != '/') kputsn(fn, l_dir, &path);
+		kputs(p, &path);
+		if ((sf = bgt_open(path.s)) == 0 || sf->n_shards > 0) {
+			if (hts_verbose >= 1) fprintf(stderr, "[E::%s] failed to open shard '%s'\n", __func__, path.s);
+			bgt_close(sf);
+			goto shards_err;
+		}
+		if (bf->n_shards > 0 && !bgt_hdr_compatible(bf->shards[0]->h0, sf->h0)) {
+			if (hts_verbose >= 1) fprintf(stderr, "[E::%s] the header of shard '%s' differs from the first shard\n", __func__, path.s);
+			bgt_close(sf);
+			goto shards_err;
+		}
+		if (bf->n_shards == m) {
+			m = m? m<<1 : 16;
+			bf->shards = (bgt_file_t**)realloc(bf->shards, m * sizeof(bgt_file_t*));
+			bf->shard_reg = (char**)realloc(bf->shard_reg, m * sizeof(char*));
+			bf->shard_off = (int64_t*)realloc(bf->shard_off, (m + 1) * 8);
+		}
+		bf->shard_reg[bf->n_shards] = reg? strdup(reg) : 0;
+		bf->shards[bf->n_shards++] = sf;
+		kputs(".pbf", &path);
+		if ((pb = pbf_open_r(path.s)) == 0) goto shards_err;
+		bf->shard_off[bf->n_shards] = bf->shard_off[bf->n_shards-1] + pbf_get_n(pb);
+		pbf_close(pb);
+	}
+	if (bf->n_shards == 0) goto shards_err;
+
+	// the header and the sample metadata, shared by all shards
+	path.l = 0;
+	ksprintf(&path, "%s.bcf", bf->shards[0]->prefix);
+	{
+		BGZF *bcf;
+		if ((bcf = bgzf_open(path.s, "rb")) == 0) goto shards_err;
+		bf->h0 = bcf_hdr_read(bcf);
+		bgzf_close(bcf);
+	}
+	path.l = 0;
+	ksprintf(&path, "%s.spl", prefix);
+	bf->f = fmf_read(path.s);
+	if (bf->f == 0) {
+		path.l = 0;
+		ksprintf(&path, "%s.spl", bf->shards[0]->prefix);
+		bf->f = fmf_read(path.s);
+	}
+	if (bf->h0 == 0 || bf->f == 0) goto shards_err;
+	for (m = 0; m < bf->n_shards; ++m) {
+		if (!bgt_fmf_compatible(bf->f, bf->shards[m]->f)) {
+			if (hts_verbose >= 1) fprintf(stderr, "[E::%s] samples in shard '%s' differ from '%s.spl'\n", __func__, bf->shards[m]->prefix, prefix);
+			goto shards_err;
+		}
+	}
+	bf->prefix = strdup(prefix);
+	bf->mgs = (int32_t*)calloc(bf->f->n_rows, 4);
+	bgt_set_mgs(bf);
+	bgt_read_view_hdr(bf);
+	bgt_list_views(bf);
+	hts_close(fp);
+	free(str.s); free(path.s); free(fn);
+	return bf;
+
+shards_err:
+	hts_close(fp);
+	free(str.s); free(path.s); free(fn);
+	bgt_close(bf);
+	return 0;
+}
+
 bgt_file_t *bgt_open(const char *prefix)
 {
 	char *fn = 0;
@@ -46,7 +230,10 @@ bgt_file_t *bgt_open(const char *prefix)
 	fn = (char*)malloc(strlen(prefix) + 9);
 	sprintf(fn, "%s.bcf", prefix);
 	fp = bgzf_open(fn, "rb");
-	if (fp == 0) goto bgt_open_err;
+	if (fp == 0) {
+		free(fn);
+		return bgt_open_shards(prefix);
+	}
 	bf = (bgt_file_t*)calloc(1, sizeof(bgt_file_t));
 	bf->h0 = bcf_hdr_read(fp);
 	if (bf->h0 == 0) goto bgt_open_err;
@@ -60,6 +247,8 @@ bgt_file_t *bgt_open(const char *prefix)
 	free(fn);
 	bf->mgs = (int32_t*)calloc(bf->f->n_rows, 4);
 	bgt_set_mgs(bf);
+	bgt_read_view_hdr(bf);
+	bgt_list_views(bf);
 	return bf;
 
 bgt_open_err:
@@ -71,7 +260,15 @@ bgt_open_err:
 
 void bgt_close(bgt_file_t *bf)
 {
+	int i;
 	if (bf == 0) return;
+	for (i = 0; i < bf->n_views; ++i) free(bf->view_fn[i]);
+	free(bf->view_fn); free(bf->view_reg); free(bf->view_src);
+	for (i = 0; i < bf->n_shards; ++i) {
+		bgt_close(bf->shards[i]);
+		free(bf->shard_reg[i]);
+	}
+	free(bf->shards); free(bf->shard_reg); free(bf->shard_off);
 	free(bf->mgs);
 	if (bf->idx) hts_idx_destroy(bf->idx);
 	if (bf->h0) bcf_hdr_destroy(bf->h0);
@@ -86,29 +283,91 @@ void bgt_close(bgt_file_t *bf)
 
 /*** reader allocation/deallocation ***/
 
-bgt_t *bgt_reader_init(const bgt_file_t *bf)
+static void bgt_subset_pbf(bgt_t *bgt);
+
+// prefetch the first chunks of a region; bgzf reads ahead within each chunk
+static void bgt_prefetch_itr(bgt_t *bgt)
+{
+	int i;
+	int64_t rest = (int64_t)bgt_readahead * BGZF_MAX_BLOCK_SIZE;
+	if (bgt->itr == 0) return;
+	for (i = 0; i < bgt->itr->n_off && rest > 0; ++i) {
+		int64_t beg = bgt->itr->off[i].u >> 16, len = (bgt->itr->off[i].v >> 16) - beg + BGZF_MAX_BLOCK_SIZE;
+		len = len < rest? len : rest;
+		bgzf_willneed(bgt->bcf, beg, len);
+		rest -= len;
+	}
+}
+
+// open the .pbf and the .bcf of <src>, which is ->f or one of its shards
+static void bgt_open_src(bgt_t *bgt, const bgt_file_t *src)
 {
 	char *fn;
+	if (bgt->pb) pbf_close(bgt->pb);
+	if (bgt->bcf) bgzf_close(bgt->bcf);
+	if (bgt->itr) hts_itr_destroy(bgt->itr);
+	bgt->itr = 0;
+	fn = (char*)malloc(strlen(src->prefix) + 9);
+	sprintf(fn, "%s.pbf", src->prefix);
+	bgt->pb = pbf_open_r(fn); // FIXME: check if .pbf is present
+	pbf_set_n_threads(bgt->pb, bgt_dec_threads);
+	sprintf(fn, "%s.bcf", src->prefix);
+	bgt->bcf = bgzf_open(fn, "rb");
+	bcf_seekn(bgt->bcf, src->idx, 0);
+	free(fn);
+	bgt->cur = src;
+	if (bgt->h_out) bgt_subset_pbf(bgt);
+	if (bgt->reg) bgt->itr = bcf_itr_querys(src->idx, src->h0, bgt->reg);
+	if (bgt_readahead > 0) {
+		bgzf_set_readahead(bgt->bcf, bgt_readahead);
+		pbf_set_readahead(bgt->pb, 1);
+		bgt_prefetch_itr(bgt);
+	}
+	bgt->b0->shared.l = 0; // mark b0 unread
+}
+
+static int bgt_reg_overlap(const char *r1, const char *r2)
+{
+	int b1, e1, b2, e2;
+	const char *q1, *q2;
+	q1 = hts_parse_reg(r1, &b1, &e1);
+	q2 = hts_parse_reg(r2, &b2, &e2);
+	if (q1 == 0 || q2 == 0) return 1;
+	if (q1 - r1 != q2 - r2 || strncmp(r1, r2, q1 - r1) != 0) return 0;
+	return b1 < e2 && b2 < e1;
+}
+
+// move to the first shard at or after <i> that may overlap the region
+static int bgt_seek_shard(bgt_t *bgt, int i)
+{
+	const bgt_file_t *f = bgt->f;
+	for (; i < f->n_shards; ++i) {
+		if (bgt->reg && f->shard_reg[i] && !bgt_reg_overlap(bgt->reg, f->shard_reg[i])) continue;
+		bgt_open_src(bgt, f->shards[i]);
+		bgt->i_shard = i, bgt->row_off = f->shard_off[i];
+		if (bgt->reg == 0 || bgt->itr) return 0;
+	}
+	bgt->i_shard = f->n_shards;
+	return -1;
+}
+
+bgt_t *bgt_reader_init(const bgt_file_t *bf)
+{
 	bgt_t *bgt;
 	assert(BGT_MAX_GROUPS <= 32);
 	bgt = (bgt_t*)calloc(1, sizeof(bgt_t));
 	bgt->f = bf;
-	fn = (char*)malloc(strlen(bf->prefix) + 9);
-	sprintf(fn, "%s.pbf", bf->prefix);
-	bgt->pb = pbf_open_r(fn); // FIXME: check if .pbf is present
-	sprintf(fn, "%s.bcf", bf->prefix);
-	bgt->bcf = bgzf_open(fn, "rb");
 	bgt->b0 = bcf_init1();
-	bcf_seekn(bgt->bcf, bgt->f->idx, 0);
+	if (bf->n_shards) bgt_seek_shard(bgt, 0);
+	else bgt_open_src(bgt, bf);
 	bgt->gtag = (uint32_t*)calloc(bgt->f->f->n_rows, 4);
-	free(fn);
 	return bgt;
 }
 
 void bgt_reader_destroy(bgt_t *bgt)
 {
 	bcf_destroy1(bgt->b0);
-	free(bgt->gtag); free(bgt->group); free(bgt->out);
+	free(bgt->gtag); free(bgt->group); free(bgt->out); free(bgt->reg); free(bgt->aix_off);
 	if (bgt->h_out) bcf_hdr_destroy(bgt->h_out);
 	hts_itr_destroy(bgt->itr);
 	pbf_close(bgt->pb);
@@ -172,6 +431,18 @@ static int bgt_is_file(const char *fn)
 	return is_file;
 }
 
+static int64_t bgt_file_size(const char *prefix, const char *suffix)
+{
+	char *fn;
+	struct stat st;
+	int ret;
+	fn = (char*)malloc(strlen(prefix) + strlen(suffix) + 1);
+	sprintf(fn, "%s%s", prefix, suffix);
+	ret = stat(fn, &st);
+	free(fn);
+	return ret == 0? (int64_t)st.st_size : -1;
+}
+
 int bgt_add_group(bgt_t *bgt, const char *expr)
 {
 	int is_file, ret = 0;
@@ -190,23 +461,146 @@ int bgt_add_group(bgt_t *bgt, const char *expr)
 int bgt_set_region(bgt_t *bgt, const char *reg)
 {
 	if (bgt->itr) bcf_itr_destroy(bgt->itr);
-	bgt->itr = bcf_itr_querys(bgt->f->idx, bgt->f->h0, reg);
+	bgt->itr = 0;
+	free(bgt->reg);
+	bgt->reg = strdup(reg);
 	bgt->b0->shared.l = 0; // mark b0 unread
+	if (bgt->f->n_shards) { // only test the contig name against the shared header
+		int beg, end, ret = -1;
+		const char *q;
+		if ((q = hts_parse_reg(reg, &beg, &end)) != 0) {
+			char *chr;
+			chr = (char*)alloca(q - reg + 1);
+			strncpy(chr, reg, q - reg);
+			chr[q - reg] = 0;
+			ret = strcmp(chr, ".") == 0 || bcf_name2id(bgt->f->h0, chr) >= 0? 0 : -1;
+		}
+		bgt_seek_shard(bgt, 0);
+		return ret;
+	}
+	bgt->itr = bcf_itr_querys(bgt->f->idx, bgt->f->h0, reg);
+	if (bgt_readahead > 0) bgt_prefetch_itr(bgt);
 	return bgt->itr? 0 : -1;
 }
 
 int bgt_set_start(bgt_t *bgt, int64_t i)
 {
+	bgt->seeked = 1;
+	if (bgt->f->n_shards) {
+		int k;
+		const bgt_file_t *f = bgt->f;
+		for (k = 0; k < f->n_shards && f->shard_off[k+1] <= i; ++k);
+		if (k == f->n_shards) {
+			bgt->i_shard = k;
+			return -1;
+		}
+		bgt_open_src(bgt, f->shards[k]);
+		bgt->i_shard = k, bgt->row_off = f->shard_off[k];
+		return bcf_seekn(bgt->bcf, bgt->cur->idx, i - bgt->row_off);
+	}
 	return bcf_seekn(bgt->bcf, bgt->f->idx, i);
 }
 
+void bgt_set_end(bgt_t *bgt, int64_t n) { bgt->row_end = n; }
+
+int64_t bgt_get_n(const bgt_t *bgt) { return bgt->f->n_shards? bgt->f->shard_off[bgt->f->n_shards] : pbf_get_n(bgt->pb); }
+
+/* Identify the data a materialized view is built from: size and mtime of the
+ * site-only BCF (or of the shard manifest) and the number of records. Changed
+ * by import and concat but not by reindex, which keeps sites and genotypes. */
+void bgt_fingerprint(const bgt_t *bgt, kstring_t *s)
+{
+	struct stat st;
+	char *fn;
+	fn = (char*)malloc(strlen(bgt->f->prefix) + 8);
+	sprintf(fn, "%s.%s", bgt->f->prefix, bgt->f->n_shards? "shards" : "bcf");
+	if (stat(fn, &st) != 0) memset(&st, 0, sizeof(struct stat));
+	ksprintf(s, "%lld:%lld:%lld", (long long)st.st_size, (long long)st.st_mtime, (long long)bgt_get_n(bgt));
+	free(fn);
+}
+
 void bgt_set_bed(bgt_t *bgt, const void *bed, int excl) { bgt->bed = bed, bgt->bed_excl = excl; }
 
+/*** parallel reading over checkpoint chunks ***/
+
+int64_t bgt_chunk_size(int64_t n, int shift, int n_threads)
+{
+	int64_t step;
+	if (n_threads < 1) n_threads = 1;
+	step = (n + n_threads * 8 - 1) / (n_threads * 8); // roughly 8 chunks per thread for load balancing
+	return ((step + (1<<shift) - 1) >> shift << shift) + !step; // aligned to PBF checkpoints
+}
+
+typedef struct {
+	int n_chunks, next;
+	int64_t n, step;
+	pthread_mutex_t lock;
+	bgt_chunk_f func;
+	void *data;
+} bgt_chunks_t;
+
+typedef struct {
+	bgt_chunks_t *sh;
+	int tid;
+} bgt_chunk_worker_t;
+
+static void *bgt_chunk_worker(void *data)
+{
+	bgt_chunk_worker_t *w = (bgt_chunk_worker_t*)data;
+	bgt_chunks_t *sh = w->sh;
+	for (;;) {
+		int c;
+		int64_t end;
+		pthread_mutex_lock(&sh->lock);
+		c = sh->next++;
+		pthread_mutex_unlock(&sh->lock);
+		if (c >= sh->n_chunks) break;
+		end = (int64_t)(c + 1) * sh->step;
+		sh->func(sh->data, w->tid, c, (int64_t)c * sh->step, end < sh->n? end : sh->n);
+	}
+	return 0;
+}
+
+int bgt_chunks(int64_t n, int shift, int n_threads, bgt_chunk_f func, void *data)
+{
+	int i;
+	bgt_chunks_t sh;
+	pthread_t *tid;
+	bgt_chunk_worker_t *w;
+	if (n_threads < 1) n_threads = 1;
+	memset(&sh, 0, sizeof(bgt_chunks_t));
+	sh.n = n, sh.func = func, sh.data = data;
+	sh.step = bgt_chunk_size(n, shift, n_threads);
+	sh.n_chunks = (n + sh.step - 1) / sh.step;
+	pthread_mutex_init(&sh.lock, 0);
+	tid = (pthread_t*)alloca(n_threads * sizeof(pthread_t));
+	w = (bgt_chunk_worker_t*)alloca(n_threads * sizeof(bgt_chunk_worker_t));
+	for (i = 0; i < n_threads; ++i) {
+		w[i].sh = &sh, w[i].tid = i;
+		if (n_threads > 1) pthread_create(&tid[i], 0, bgt_chunk_worker, &w[i]);
+	}
+	if (n_threads > 1)
+		for (i = 0; i < n_threads; ++i) pthread_join(tid[i], 0);
+	else bgt_chunk_worker(&w[0]);
+	pthread_mutex_destroy(&sh.lock);
+	return sh.n_chunks;
+}
+
 /*** prepare for the output ***/
 
-void bgt_prepare(bgt_t *bgt)
+static void bgt_subset_pbf(bgt_t *bgt)
 {
 	int i, *t;
+	t = (int*)malloc(bgt->n_out * 2 * sizeof(int));
+	for (i = 0; i < bgt->n_out; ++i)
+		t[i<<1|0] = bgt->out[i]<<1|0, t[i<<1|1] = bgt->out[i]<<1|1;
+	pbf_subset(bgt->pb, bgt->n_out<<1, t);
+	free(t);
+}
+
+void bgt_prepare(bgt_t *bgt)
+{
+	int i;
 	const fmf_t *f = bgt->f->f;
 	kstring_t str = {0,0,0};
 
@@ -235,13 +629,7 @@ void bgt_prepare(bgt_t *bgt)
 	bgt->h_out->l_text = str.l + 1; // including the last NULL
 	bcf_hdr_parse(bgt->h_out);
 
-	// subsetting pbf
-	t = (int*)malloc(bgt->n_out * 2 * sizeof(int));
-	for (i = 0; i < bgt->n_out; ++i)
-		t[i<<1|0] = bgt->out[i]<<1|0, t[i<<1|1] = bgt->out[i]<<1|1;
-	pbf_subset(bgt->pb, bgt->n_out<<1, t);
-	free(t);
-
+	bgt_subset_pbf(bgt);
 	bgt->b0->shared.l = 0; // mark b0 unread
 }
 
@@ -272,11 +660,19 @@ static int al_present(khash_t(str) *h, const bcf_hdr_t *hdr, const bcf1_t *b)
 int bgt_read_core0(bgt_t *bgt)
 {
 	int i, id, row;
-	row = bgt->itr? bcf_itr_next(bgt->bcf, bgt->itr, bgt->b0) : bcf_read1(bgt->bcf, bgt->b0);
-	if (row < 0) return row;
+	if (bgt->f->n_shards && bgt->i_shard >= bgt->f->n_shards) return -1;
+	if (bgt->aix_off) { // jump to the next record found in the allele index
+		int64_t j = bgt->i_aix_off + bgt_readahead;
+		if (bgt->i_aix_off == bgt->n_aix_off) return -1;
+		if (bgt_readahead > 0 && j < bgt->n_aix_off)
+			bgzf_willneed(bgt->bcf, bgt->aix_off[j] >> 16, BGZF_MAX_BLOCK_SIZE);
+		bgzf_seek(bgt->bcf, bgt->aix_off[bgt->i_aix_off++], SEEK_SET);
+		if ((row = bcf_read1(bgt->bcf, bgt->b0)) < 0) return row;
+	} else while ((row = bgt->itr? bcf_itr_next(bgt->bcf, bgt->itr, bgt->b0) : bcf_read1(bgt->bcf, bgt->b0)) < 0)
+		if (bgt->f->n_shards == 0 || bgt_seek_shard(bgt, bgt->i_shard + 1) < 0) return row;
 	assert(bgt->b0->n_sample == 0); // there shouldn't be any sample fields
 	row = -1;
-	id = bcf_id2int(bgt->f->h0, BCF_DT_ID, "_row");
+	id = bcf_id2int(bgt->cur->h0, BCF_DT_ID, "_row");
 	assert(id > 0);
 	bcf_unpack(bgt->b0, BCF_UN_INFO);
 	for (i = 0; i < bgt->b0->n_info; ++i) {
@@ -284,6 +680,8 @@ int bgt_read_core0(bgt_t *bgt)
 		if (p->key == id) row = p->v1.i;
 	}
 	assert(row >= 0);
+	row += bgt->row_off;
+	if (bgt->row_end > 0 && row >= bgt->row_end) return -1;
 	return row;
 }
 
@@ -338,7 +736,7 @@ int bgt_read_rec(bgt_t *bgt, bgt_rec_t *r)
 	if (bgt->n_out == 0) return -1;
 	if ((row = bgt_read_core(bgt)) < 0) return row;
 	r->b0 = bgt->b0;
-	pbf_seek(bgt->pb, row);
+	pbf_seek(bgt->pb, row - bgt->row_off);
 	a = pbf_read(bgt->pb);
 	r->a[0] = (uint8_t*)a[0], r->a[1] = (uint8_t*)a[1];
 	return row;
@@ -361,6 +759,8 @@ int bgt_read(bgt_t *bgt, bcf1_t *b)
 
 /*** reader allocation/deallocation ***/
 
+static void bgt_annot_destroy(void *_an);
+
 bgtm_t *bgtm_reader_init(int n_files, bgt_file_t *const* bf)
 {
 	bgtm_t *bm;
@@ -379,6 +779,8 @@ void bgtm_reader_destroy(bgtm_t *bm)
 	int i;
 	free(bm->hap);
 	free(bm->alcnt);
+	free(bm->gtcnt);
+	if (bm->spl_flt) ke_destroy(bm->spl_flt);
 	if (bm->site_flt) ke_destroy(bm->site_flt);
 	free(bm->mgs);
 	free(bm->group);
@@ -390,9 +792,14 @@ void bgtm_reader_destroy(bgtm_t *bm)
 	for (i = 0; i < bm->n_fields; ++i)
 		ke_destroy(bm->fields[i]);
 	free(bm->fields);
-	free(bm->tbl_line.s);
+	free(bm->tbl_line.s); free(bm->carriers.s);
+	bgt_annot_destroy(bm->annot);
 	for (i = 0; i < bm->n_bgt; ++i)
 		bgt_reader_destroy(bm->bgt[i]);
+	if (bm->routed)
+		for (i = 0; i < bm->n_bgt; ++i)
+			bgt_close(bm->routed[i]);
+	free(bm->routed);
 	if (bm->h_al) {
 		khint_t k;
 		khash_t(str) *h = (khash_t(str)*)bm->h_al;
@@ -432,6 +839,13 @@ int bgtm_set_start(bgtm_t *bm, int64_t n)
 	return 0;
 }
 
+void bgtm_set_end(bgtm_t *bm, int64_t n)
+{
+	int i;
+	for (i = 0; i < bm->n_bgt; ++i)
+		bgt_set_end(bm->bgt[i], n);
+}
+
 void bgtm_set_bed(bgtm_t *bm, const void *bed, int excl)
 {
 	int i;
@@ -441,6 +855,76 @@ void bgtm_set_bed(bgtm_t *bm, const void *bed, int excl)
 
 void bgtm_set_flag(bgtm_t *bm, int flag) { bm->flag = flag; }
 
+// aggregates computed only if referenced; each may be suffixed by a group number
+static const char *bgt_gt_vars[] = { "nHomRef", "nHet", "nHomAlt", "nMissing", "het", "callRate", 0 };
+
+static int bgtm_scan_vars(const kexpr_t *ke)
+{
+	int i, g, vars = 0;
+	char key[32];
+	for (g = 0; g <= BGT_MAX_GROUPS; ++g) {
+		for (i = 0; bgt_gt_vars[i]; ++i) {
+			if (g) sprintf(key, "%s%d", bgt_gt_vars[i], g);
+			if (ke_has_var(ke, g? key : bgt_gt_vars[i])) vars |= BGT_V_GT;
+		}
+		if (g) sprintf(key, "HWE%d", g);
+		if (ke_has_var(ke, g? key : "HWE")) vars |= BGT_V_GT | BGT_V_HWE;
+		if (g) sprintf(key, "AFlo%d", g);
+		if (ke_has_var(ke, g? key : "AFlo")) vars |= BGT_V_CI;
+		if (g) sprintf(key, "AFhi%d", g);
+		if (ke_has_var(ke, g? key : "AFhi")) vars |= BGT_V_CI;
+	}
+	if (ke_has_var(ke, "carriers")) vars |= BGT_V_CAR;
+	return vars;
+}
+
+/* Test if expression s[0..l-1] is a conjunction with an AC>0 or AC>=1 term,
+ * which rejects every site without the ALT allele in the selected samples.
+ * The test is syntactic: && and || have the lowest precedence in kexpr. */
+static int bgt_flt_requires_alt(const char *s, int l)
+{
+	int i, beg, depth = 0, quote = 0, n_and = 0;
+	kstring_t t = {0,0,0};
+	for (i = 0; i < l; ++i) { // a top-level || makes the expression a disjunction
+		if (quote) {
+			if (s[i] == quote) quote = 0;
+		} else if (s[i] == '"' || s[i] == '\'') quote = s[i];
+		else if (s[i] == '(') ++depth;
+		else if (s[i] == ')') --depth;
+		else if (depth == 0 && s[i] == '|' && i + 1 < l && s[i+1] == '|') return 0;
+		else if (depth == 0 && s[i] == '&' && i + 1 < l && s[i+1] == '&') ++n_and, ++i;
+	}
+	if (n_and > 0) { // test each conjunct
+		for (i = beg = 0; i <= l; ++i) {
+			if (quote) {
+				if (s[i] == quote) quote = 0;
+			} else if (i < l && (s[i] == '"' || s[i] == '\'')) quote = s[i];
+			else if (i < l && s[i] == '(') ++depth;
+			else if (i < l && s[i] == ')') --depth;
+			else if (i == l || (depth == 0 && s[i] == '&' && s[i+1] == '&')) {
+				if (bgt_flt_requires_alt(s + beg, i - beg)) return 1;
+				beg = i + 2, ++i;
+			}
+		}
+		return 0;
+	}
+	for (i = 0; i < l; ++i)
+		if (!isspace(s[i])) kputc(s[i], &t);
+	if (t.l >= 2 && t.s[0] == '(' && t.s[t.l-1] == ')') { // strip the parentheses around the whole term
+		for (i = 1, depth = 1; i < t.l - 1 && depth > 0; ++i)
+			if (t.s[i] == '(') ++depth;
+			else if (t.s[i] == ')') --depth;
+		if (depth > 0) {
+			i = bgt_flt_requires_alt(t.s + 1, t.l - 2);
+			free(t.s);
+			return i;
+		}
+	}
+	i = t.l > 0 && (strcmp(t.s, "AC>0") == 0 || strcmp(t.s, "AC>=1") == 0);
+	free(t.s);
+	return i;
+}
+
 int bgtm_set_flt_site(bgtm_t *bm, const char *expr)
 {
 	int err;
@@ -451,6 +935,37 @@ int bgtm_set_flt_site(bgtm_t *bm, const char *expr)
 		bm->site_flt = 0;
 		return err;
 	}
+	bm->site_vars |= bgtm_scan_vars(bm->site_flt);
+	bm->flt_alt = bgt_flt_requires_alt(expr, strlen(expr));
+	return 0;
+}
+
+int bgtm_set_flt_sample(bgtm_t *bm, const char *expr)
+{
+	int err;
+	if (bm->spl_flt) ke_destroy(bm->spl_flt);
+	bm->spl_flt = ke_parse(expr, &err);
+	if (err == 0) { // reject variables other than the per-sample counts
+		ke_set_int(bm->spl_flt, "n_het", 0);
+		ke_set_int(bm->spl_flt, "n_homalt", 0);
+		ke_set_int(bm->spl_flt, "n_missing", 0);
+		ke_set_int(bm->spl_flt, "n_alt", 0);
+		ke_set_int(bm->spl_flt, "n_sites", 0);
+		ke_eval_int(bm->spl_flt, &err);
+	}
+	if (err != 0) {
+		if (bm->spl_flt) ke_destroy(bm->spl_flt);
+		bm->spl_flt = 0;
+		return err;
+	}
+	bm->flag |= BGT_F_CNT_GT;
+	return 0;
+}
+
+int bgtm_set_approx(bgtm_t *bm, double eps)
+{
+	bm->approx = eps > 0.? eps : 0.;
+	if (bm->approx > 0.) bm->flag |= BGT_F_SET_AC | BGT_F_NO_GT; // genotypes would only be of the sampled subset
 	return 0;
 }
 
@@ -474,6 +989,8 @@ static inline bgt_allele_t *add_allele(bgt_allele_t *al, int *n, int *m, const c
 	return al;
 }
 
+static FILE *bgt_aix_open(const bgt_t *bgt, int64_t hdr[3]);
+
 int bgtm_set_alleles(bgtm_t *bm, const char *expr, const fmf_t *f, const char *fn)
 {
 	int i, is_file, n_al = 0;
@@ -528,7 +1045,14 @@ int bgtm_set_alleles(bgtm_t *bm, const char *expr, const fmf_t *f, const char *f
 			}
 		}
 		free(s.s);
-		if (!diff_rid && bm->bgt[0]->itr == 0) {
+		for (i = 0; i < bm->n_bgt; ++i) { // with valid allele indices, bgtm_prepare() looks up the records directly
+			bgt_t *bgt = bm->bgt[i];
+			int64_t hdr[3];
+			FILE *fp;
+			if (bgt->seeked || bgt->row_end > 0 || (fp = bgt_aix_open(bgt, hdr)) == 0) break;
+			fclose(fp);
+		}
+		if (!diff_rid && bm->bgt[0]->reg == 0 && i < bm->n_bgt) {
 			char *reg;
 			reg = (char*)alloca(strlen(al[0].chr.s) + 23);
 			sprintf(reg, "%s:%d-%d", al[0].chr.s, min_pos+1, max_pos+1);
@@ -588,12 +1112,323 @@ kexpr_t **bgt_parse_fields(const char *str, int *_n)
 
 int bgtm_set_table(bgtm_t *bm, const char *fmt)
 {
+	int i;
 	bm->fields = bgt_parse_fields(fmt, &bm->n_fields);
+	for (i = 0; i < bm->n_fields; ++i)
+		bm->site_vars |= bgtm_scan_vars(bm->fields[i]);
 	return bm->fields == 0? -1 : 0;
 }
 
+/*** join with site annotations ***/
+
+typedef struct {
+	int rid, pos; // normalized position
+	kstring_t key, line;
+} bgt_annot1_t;
+
+/* Site annotations are streamed from an FMF sorted by position, in the contig
+ * order of the BCF header. Rows are matched to sites by the normalized allele
+ * (see bgt_al_format()). Normalization may move an allele forward but never
+ * backward, so a row can only match a site whose raw position is no greater
+ * than the normalized position of the row. Rows are buffered until the stream
+ * of sites passes them. */
+typedef struct {
+	fms_t *fp;
+	int started, warned, hit; // hit: index of the row matching the current site, or -1
+	int last_rid, last_pos; // raw position of the last row read, to check the order
+	int n, m;
+	bgt_annot1_t *a; // buffered rows
+	kstring_t next; // the next row not buffered yet
+	int next_rid, next_pos; // its raw position; next_rid < 0 at the end of file
+	bgt_allele_t al;
+	kstring_t key, tmp;
+} bgt_annot_t;
+
+// variables set by bgtm for each site; all but CHROM/POS/END/REF/ALT/carriers may be suffixed by a group number
+static const char *bgt_site_vars[] = { "AC", "AN", "AFlo", "AFhi", "HWE", "nHomRef", "nHet", "nHomAlt", "nMissing", "het", "callRate", 0 };
+
+static int bgt_has_annot_var(const kexpr_t *ke)
+{
+	int i, j, l;
+	const char *s;
+	for (i = 0; (s = ke_var_name(ke, i)) != 0; ++i) {
+		if (strcmp(s, "CHROM") == 0 || strcmp(s, "POS") == 0 || strcmp(s, "END") == 0 || strcmp(s, "REF") == 0
+			|| strcmp(s, "ALT") == 0 || strcmp(s, "carriers") == 0)
+			continue;
+		for (l = strlen(s); l > 0 && isdigit(s[l-1]); --l);
+		for (j = 0; bgt_site_vars[j]; ++j)
+			if (strncmp(s, bgt_site_vars[j], l) == 0 && bgt_site_vars[j][l] == 0) break;
+		if (bgt_site_vars[j] == 0) return 1;
+	}
+	return 0;
+}
+
+int bgtm_has_annot_var(const bgtm_t *bm)
+{
+	int i;
+	if (bm->site_flt && bgt_has_annot_var(bm->site_flt)) return 1;
+	for (i = 0; i < bm->n_fields; ++i)
+		if (bgt_has_annot_var(bm->fields[i])) return 1;
+	return 0;
+}
+
+int bgtm_set_annot(bgtm_t *bm, const char *fn)
+{
+	bgt_annot_t *an;
+	fms_t *fp;
+	if ((fp = fms_open(fn)) == 0) return -1;
+	an = (bgt_annot_t*)calloc(1, sizeof(bgt_annot_t));
+	an->fp = fp, an->hit = -1, an->last_rid = -1;
+	bm->annot = an;
+	return 0;
+}
+
+static void bgt_annot_destroy(void *_an)
+{
+	bgt_annot_t *an = (bgt_annot_t*)_an;
+	int i;
+	if (an == 0) return;
+	for (i = 0; i < an->m; ++i) {
+		free(an->a[i].key.s);
+		free(an->a[i].line.s);
+	}
+	free(an->a); free(an->next.s); free(an->key.s); free(an->tmp.s); free(an->al.chr.s);
+	fms_close(an->fp);
+	free(an);
+}
+
+// raw position of an FMF row named like "chr:1basedPos:..."; returns the contig ID, or -1
+static int bgt_annot_pos(bgt_annot_t *an, const bcf_hdr_t *h, const char *s, int *pos)
+{
+	const char *p;
+	for (p = s; *p && *p != ':' && *p != '\t'; ++p);
+	if (*p != ':' || !isdigit(p[1])) return -1;
+	an->tmp.l = 0;
+	kputsn(s, p - s, &an->tmp);
+	*pos = strtol(p + 1, 0, 10) - 1;
+	return bcf_name2id(h, an->tmp.s);
+}
+
+static void bgt_annot_read(bgt_annot_t *an, const bcf_hdr_t *h)
+{
+	const char *s;
+	while ((s = fms_read(an->fp, 0, 0)) != 0) {
+		int pos, rid;
+		if ((rid = bgt_annot_pos(an, h, s, &pos)) < 0) continue;
+		if (rid < an->last_rid || (rid == an->last_rid && pos < an->last_pos)) {
+			if (!an->warned && hts_verbose >= 2)
+				fprintf(stderr, "[W::%s] site annotations are not sorted by position; some will be missed\n", __func__);
+			an->warned = 1;
+		}
+		an->last_rid = rid, an->last_pos = pos;
+		an->next.l = 0;
+		kputs(s, &an->next);
+		an->next_rid = rid, an->next_pos = pos;
+		return;
+	}
+	an->next_rid = -1;
+}
+
+// for an uncompressed FMF, binary search for a row before (rid,pos)
+static void bgt_annot_seek(bgt_annot_t *an, const bcf_hdr_t *h, int rid, int pos)
+{
+	int64_t lo = 0, hi = fms_size(an->fp);
+	if (hi < 0) return;
+	while (hi - lo > 0x10000) {
+		int64_t mid = lo + (hi - lo) / 2;
+		const char *s;
+		int r = -1, p = 0;
+		if (fms_seek(an->fp, mid) == 0 && (s = fms_read(an->fp, 0, 0)) != 0)
+			r = bgt_annot_pos(an, h, s, &p);
+		if (r >= 0 && (r < rid || (r == rid && p < pos))) lo = mid;
+		else hi = mid; // including rows on unknown contigs, which is safe
+	}
+	fms_seek(an->fp, lo);
+}
+
+static void bgt_annot_match(bgt_annot_t *an, const bcf_hdr_t *h, const bcf1_t *b)
+{
+	int i, j, npos;
+	bgt_al_from_bcf(h, b, &an->al, 0);
+	bgt_al_format(&an->al, &an->key);
+	npos = an->al.pos;
+	if (!an->started) {
+		bgt_annot_seek(an, h, b->rid, b->pos);
+		bgt_annot_read(an, h);
+		an->started = 1;
+	}
+	for (i = j = 0; i < an->n; ++i) { // drop rows before the current site; later sites can't match them
+		bgt_annot1_t *p = &an->a[i];
+		if (p->rid > b->rid || (p->rid == b->rid && p->pos >= b->pos)) {
+			if (i != j) {
+				bgt_annot1_t t = an->a[j];
+				an->a[j] = *p, *p = t;
+			}
+			++j;
+		}
+	}
+	an->n = j;
+	while (an->next_rid >= 0 && (an->next_rid < b->rid || (an->next_rid == b->rid && an->next_pos <= npos))) {
+		const char *p;
+		for (p = an->next.s; *p && *p != '\t'; ++p);
+		an->tmp.l = 0;
+		kputsn(an->next.s, p - an->next.s, &an->tmp);
+		if (an->next_rid == b->rid && bgt_al_parse(an->tmp.s, &an->al) == 0 && an->al.pos >= b->pos) {
+			bgt_annot1_t *q;
+			if (an->n == an->m) {
+				an->m = an->m? an->m<<1 : 4;
+				an->a = (bgt_annot1_t*)realloc(an->a, an->m * sizeof(bgt_annot1_t));
+				memset(&an->a[an->n], 0, (an->m - an->n) * sizeof(bgt_annot1_t));
+			}
+			q = &an->a[an->n++];
+			q->rid = an->next_rid, q->pos = an->al.pos;
+			bgt_al_format(&an->al, &q->key);
+			q->line.l = 0;
+			kputs(an->next.s, &q->line);
+		}
+		bgt_annot_read(an, h);
+	}
+	for (i = 0, an->hit = -1; i < an->n; ++i)
+		if (strcmp(an->a[i].key.s, an->key.s) == 0) {
+			an->hit = i;
+			break;
+		}
+}
+
+// unset all variables and set those of the annotation matching the current site
+static void bgt_annot_assign(const bgt_annot_t *an, kexpr_t *ke)
+{
+	ke_unset(ke);
+	if (an->hit >= 0) fmf_assign_line(ke, an->a[an->hit].line.s);
+}
+
 /*** prepare for the output ***/
 
+// test if a view built by 'bgt materialize' has all sites in the query region
+static int bgt_view_covers(const bgt_file_t *v, const char *reg)
+{
+	int vb, ve, qb, qe;
+	const char *vq, *qq;
+	if (v->view_reg == 0) return 1;
+	if (reg == 0) return 0; // the query spans all contigs
+	vq = hts_parse_reg(v->view_reg, &vb, &ve);
+	qq = hts_parse_reg(reg, &qb, &qe);
+	if (vq - v->view_reg != qq - reg || strncmp(v->view_reg, reg, qq - reg) != 0) return 0;
+	return vb <= qb && qe <= ve;
+}
+
+/* Query planner: read from the smallest materialized view that has all the
+ * selected samples and all sites in the query region. A view without sites
+ * monomorphic for REF is only used if the site filter requires AC>0. Views
+ * are opened here, one level deep; the views of a view are not considered. */
+static void bgtm_route(bgtm_t *bm)
+{
+	int i, j, k;
+	for (i = 0; i < bm->n_bgt; ++i) {
+		bgt_t *bgt = bm->bgt[i], *nb;
+		const bgt_file_t *f = bgt->f;
+		bgt_file_t *best = 0;
+		int n_sel = 0;
+		kstring_t fp = {0,0,0};
+		if (f->n_views == 0 || bgt->seeked || bgt->row_end > 0) continue;
+		bgt_fingerprint(bgt, &fp);
+		if (bgt->n_groups == 0) bgt_add_group_core(bgt, BGT_SET_ALL_SAMPLES, 0, 0);
+		for (j = 0; j < f->f->n_rows; ++j)
+			if (bgt->gtag[j] > 0) ++n_sel;
+		for (k = 0; k < f->n_views; ++k) {
+			bgt_file_t *v;
+			khash_t(s2i) *h;
+			int n_found = 0, absent;
+			if ((v = bgt_open(f->view_fn[k])) == 0) {
+				if (hts_verbose >= 2) fprintf(stderr, "[W::%s] failed to open materialized view '%s'\n", __func__, f->view_fn[k]);
+				continue;
+			}
+			if (v->view_src == 0 || strcmp(v->view_src, fp.s) != 0) { // the source has changed since the view was built
+				if (hts_verbose >= 2) fprintf(stderr, "[W::%s] materialized view '%s' is out of date; ignored\n", __func__, f->view_fn[k]);
+				bgt_close(v);
+				continue;
+			}
+			if (v->f->n_rows >= f->f->n_rows || (best && v->f->n_rows >= best->f->n_rows)
+				|| (v->drop_mono && (!bm->flt_alt || bm->annot)) || !bgt_view_covers(v, bgt->reg))
+			{
+				bgt_close(v);
+				continue;
+			}
+			h = kh_init(s2i);
+			for (j = 0; j < v->f->n_rows; ++j)
+				kh_put(s2i, h, v->f->rows[j].name, &absent);
+			for (j = 0; j < f->f->n_rows; ++j)
+				if (bgt->gtag[j] > 0 && kh_get(s2i, h, f->f->rows[j].name) != kh_end(h))
+					++n_found;
+			kh_destroy(s2i, h);
+			if (n_found == n_sel) {
+				bgt_close(best);
+				best = v;
+			} else bgt_close(v);
+		}
+		free(fp.s);
+		if (best == 0) continue;
+		if (bm->routed == 0) bm->routed = (bgt_file_t**)calloc(bm->n_bgt, sizeof(bgt_file_t*));
+		bm->routed[i] = best;
+		// transfer the reader settings, mapping samples by name
+		nb = bgt_reader_init(best);
+		nb->n_groups = bgt->n_groups, nb->mgs_def = bgt->mgs_def;
+		nb->bed = bgt->bed, nb->bed_excl = bgt->bed_excl, nb->h_al = bgt->h_al;
+		if (bgt->reg) bgt_set_region(nb, bgt->reg);
+		{
+			khash_t(s2i) *h;
+			int absent;
+			khint_t itr;
+			h = kh_init(s2i);
+			for (j = 0; j < f->f->n_rows; ++j) {
+				itr = kh_put(s2i, h, f->f->rows[j].name, &absent);
+				kh_val(h, itr) = j;
+			}
+			for (j = 0; j < best->f->n_rows; ++j) {
+				itr = kh_get(s2i, h, best->f->rows[j].name);
+				nb->gtag[j] = itr != kh_end(h)? bgt->gtag[kh_val(h, itr)] : 0;
+			}
+			kh_destroy(s2i, h);
+		}
+		if (hts_verbose >= 3)
+			fprintf(stderr, "[M::%s] reading from materialized view '%s' instead of '%s'\n", __func__, best->prefix, f->prefix);
+		bgt_reader_destroy(bgt);
+		bm->bgt[i] = nb;
+	}
+}
+
+// stratified sampling of samples, such that the 95% CI of an allele frequency is within +/-bm->approx
+static void bgtm_sample(bgtm_t *bm)
+{
+	int i, j, g, n_groups = bm->n_groups > 0? bm->n_groups : 1;
+	int32_t rest[BGT_MAX_GROUPS], need[BGT_MAX_GROUPS];
+	double n0 = 1.96 * 1.96 * .25 / (bm->approx * bm->approx); // #haplotypes for the worst case p=0.5
+	uint64_t x = 11;
+	memset(rest, 0, BGT_MAX_GROUPS * 4);
+	for (i = 0; i < bm->n_bgt; ++i) {
+		bgt_t *bgt = bm->bgt[i];
+		if (bgt->n_groups == 0) bgt_add_group_core(bgt, BGT_SET_ALL_SAMPLES, 0, 0);
+		for (j = 0; j < bgt->f->f->n_rows; ++j)
+			if (bgt->gtag[j] > 0) ++rest[bgt->gtag[j]-1];
+	}
+	for (g = 0; g < n_groups; ++g) {
+		double h = 2. * rest[g];
+		need[g] = (int)ceil(n0 / (1. + (n0 - 1.) / h) / 2.); // with finite population correction
+		if (need[g] > rest[g]) need[g] = rest[g];
+		bm->gn[g] = rest[g] << 1, bm->gs[g] = need[g] << 1;
+	}
+	for (i = 0; i < bm->n_bgt; ++i) { // selection sampling (Knuth's Algorithm S)
+		bgt_t *bgt = bm->bgt[i];
+		for (j = 0; j < bgt->f->f->n_rows; ++j) {
+			if (bgt->gtag[j] == 0) continue;
+			g = bgt->gtag[j] - 1;
+			x ^= x << 13, x ^= x >> 7, x ^= x << 17; // xorshift64
+			if ((double)(x>>11) / (1ULL<<53) * rest[g]-- < need[g]) --need[g];
+			else bgt->gtag[j] = 0;
+		}
+	}
+}
+
 int bgtm_prepare(bgtm_t *bm)
 {
 	int i, j, m;
@@ -603,6 +1438,12 @@ int bgtm_prepare(bgtm_t *bm)
 	if (bm->n_bgt == 0) return 0;
 
 	// prepare group and sample_idx
+	if (bm->h_out == 0) bgtm_route(bm);
+	if (bm->h_al)
+		for (i = 0; i < bm->n_bgt; ++i)
+			bgt_aix_lookup(bm->bgt[i]);
+	if (bm->approx > 0. && bm->gn[0] == 0)
+		bgtm_sample(bm);
 	for (i = bm->n_out = 0; i < bm->n_bgt; ++i) {
 		bgt_prepare(bm->bgt[i]);
 		bm->n_out += bm->bgt[i]->n_out;
@@ -672,6 +1513,8 @@ int bgtm_prepare(bgtm_t *bm)
 			bm->hap = (uint64_t*)calloc(bm->n_out<<1, 8);
 		bm->aal = (bgt_allele_t*)calloc(kh_size((khash_t(str)*)bm->h_al) * 2, sizeof(bgt_allele_t));
 	}
+	if (bm->flag&BGT_F_CNT_GT)
+		bm->gtcnt = (bgt_gtcnt_t*)calloc(bm->n_out, sizeof(bgt_gtcnt_t));
 	return 0;
 }
 
@@ -697,6 +1540,54 @@ static inline char *gen_group_key(char key[5], char nc, int g)
 	return key;
 }
 
+// HWE exact test (Wigginton et al, 2005)
+static double bgt_hwe_exact(int n_het, int n_hom1, int n_hom2)
+{
+	int n_homr, n_homc, n_rare, n, mid, h, r, c, i;
+	double *p, sum, p_hwe = 0.;
+	n_homr = n_hom1 < n_hom2? n_hom1 : n_hom2;
+	n_homc = n_hom1 < n_hom2? n_hom2 : n_hom1;
+	n_rare = 2 * n_homr + n_het;
+	n = n_het + n_homr + n_homc;
+	if (n == 0) return 1.;
+	p = (double*)calloc(n_rare + 1, sizeof(double));
+	mid = (int)((double)n_rare * (2 * n - n_rare) / (2 * n));
+	if ((n_rare & 1) ^ (mid & 1)) ++mid;
+	p[mid] = sum = 1.;
+	for (h = mid, r = (n_rare - mid) / 2, c = n - h - r; h > 1; h -= 2, ++r, ++c) {
+		p[h-2] = p[h] * h * (h - 1.) / (4. * (r + 1.) * (c + 1.));
+		sum += p[h-2];
+	}
+	for (h = mid, r = (n_rare - mid) / 2, c = n - h - r; h <= n_rare - 2; h += 2, --r, --c) {
+		p[h+2] = p[h] * 4. * r * c / ((h + 2.) * (h + 1.));
+		sum += p[h+2];
+	}
+	for (i = 0; i <= n_rare; ++i)
+		if (p[i] <= p[n_het]) p_hwe += p[i];
+	free(p);
+	p_hwe /= sum;
+	return p_hwe > 1.? 1. : p_hwe;
+}
+
+static void bgtm_assign_gt(kexpr_t *e, int vars, const int32_t *gt, int g)
+{
+	static const char *hwe = "HWE";
+	int i, n_called = gt[0] + gt[1] + gt[2];
+	char key[32];
+	for (i = 0; i < 4; ++i) {
+		if (g) sprintf(key, "%s%d", bgt_gt_vars[i], g);
+		ke_set_int(e, g? key : bgt_gt_vars[i], gt[i]);
+	}
+	if (g) sprintf(key, "%s%d", bgt_gt_vars[4], g);
+	ke_set_real(e, g? key : bgt_gt_vars[4], n_called? (double)gt[1] / n_called : 0.);
+	if (g) sprintf(key, "%s%d", bgt_gt_vars[5], g);
+	ke_set_real(e, g? key : bgt_gt_vars[5], n_called + gt[3]? (double)n_called / (n_called + gt[3]) : 0.);
+	if (vars & BGT_V_HWE) {
+		if (g) sprintf(key, "%s%d", hwe, g);
+		ke_set_real(e, g? key : hwe, bgt_hwe_exact(gt[1], gt[0], gt[2]));
+	}
+}
+
 void bgtm_assign_expr(kexpr_t *e, const bgt_info_t *ss)
 {
 	int i;
@@ -707,6 +1598,20 @@ void bgtm_assign_expr(kexpr_t *e, const bgt_info_t *ss)
 		ke_set_int(e, gen_group_key(key, 'N', i), ss->gan[i]);
 		ke_set_int(e, gen_group_key(key, 'C', i), ss->gac[i][0]);
 	}
+	if (ss->vars & BGT_V_CI) {
+		char key2[16];
+		ke_set_real(e, "AFlo", ss->lo);
+		ke_set_real(e, "AFhi", ss->hi);
+		for (i = 0; i < ss->n_groups && ss->n_groups > 1; ++i) {
+			sprintf(key2, "AFlo%d", i + 1); ke_set_real(e, key2, ss->glo[i]);
+			sprintf(key2, "AFhi%d", i + 1); ke_set_real(e, key2, ss->ghi[i]);
+		}
+	}
+	if (ss->vars & BGT_V_GT) {
+		bgtm_assign_gt(e, ss->vars, ss->gt, 0);
+		for (i = 0; i < ss->n_groups; ++i)
+			bgtm_assign_gt(e, ss->vars, ss->ggt[i], i + 1);
+	}
 }
 
 int bgtm_pass_site_flt(const bgt_info_t *ss, kexpr_t *flt)
@@ -732,28 +1637,132 @@ void bgtm_fill_info(const bcf_hdr_t *h, const bgt_info_t *ss, bcf1_t *b)
 	}
 }
 
-void bgtm_cal_info(const bgtm_t *bm, bgt_info_t *ss)
+// count haplotype codes in planes of $n bytes; bytes are summed in 64-bit words
+static void bgtm_cnt_planes(int n, const uint8_t *a0, const uint8_t *a1, int32_t cnt[4])
+{
+	const uint64_t m1 = 0x00ff00ff00ff00ffULL, m2 = 0x0001000100010001ULL;
+	int i = 0, j, s0 = 0, s1 = 0, s3 = 0;
+	while (i + 8 <= n) {
+		uint64_t x0 = 0, x1 = 0, x3 = 0;
+		for (j = 0; j < 255 && i + 8 <= n; ++j, i += 8) { // at most 255 additions per byte lane
+			uint64_t y0, y1;
+			memcpy(&y0, a0 + i, 8);
+			memcpy(&y1, a1 + i, 8);
+			x0 += y0, x1 += y1, x3 += y0 & y1;
+		}
+		s0 += (((x0 & m1) + (x0>>8 & m1)) * m2) >> 48;
+		s1 += (((x1 & m1) + (x1>>8 & m1)) * m2) >> 48;
+		s3 += (((x3 & m1) + (x3>>8 & m1)) * m2) >> 48;
+	}
+	for (; i < n; ++i)
+		s0 += a0[i], s1 += a1[i], s3 += a0[i] & a1[i];
+	cnt[1] += s0 - s3, cnt[2] += s1 - s3, cnt[3] += s3;
+	cnt[0] += n - s0 - s1 + s3;
+}
+
+// genotype category of a pair of haplotype codes: 0 for hom-ref, 1 het, 2 hom-alt and 3 missing; <M> is counted as REF
+static const int8_t bgt_gt_cat[16] = { 0, 1, 3, 0,  1, 2, 3, 1,  3, 3, 3, 3,  0, 1, 3, 0 };
+
+// scale allele and genotype counts of sampled haplotypes to group sizes, and compute 95% CIs with finite population correction
+static void bgtm_approx_info(const bgtm_t *bm, bgt_info_t *ss)
+{
+	int i;
+	double an = 0., ac = 0., var = 0., p;
+	int32_t ac1 = 0;
+	for (i = 0; i < bm->n_groups; ++i) {
+		int32_t *pan = bm->n_groups > 1? &ss->gan[i] : &ss->an, *pac = bm->n_groups > 1? ss->gac[i] : ss->ac;
+		double f = bm->gs[i]? (double)bm->gn[i] / bm->gs[i] : 0., fpc, v;
+		p = *pan? (double)pac[0] / *pan : 0.;
+		fpc = *pan * f > 1.? (*pan * f - *pan) / (*pan * f - 1.) : 0.;
+		v = *pan? p * (1. - p) / *pan * fpc : 0.;
+		if (bm->n_groups > 1 && (ss->vars & BGT_V_CI)) {
+			ss->glo[i] = p - 1.96 * sqrt(v) > 0.? p - 1.96 * sqrt(v) : 0.;
+			ss->ghi[i] = p + 1.96 * sqrt(v) < 1.? p + 1.96 * sqrt(v) : 1.;
+		}
+		*pan = (int32_t)(*pan * f + .499);
+		pac[0] = (int32_t)(pac[0] * f + .499);
+		pac[1] = (int32_t)(pac[1] * f + .499);
+		an += *pan, ac += pac[0], ac1 += pac[1], var += (double)*pan * *pan * v;
+		if (ss->vars & BGT_V_GT) { // genotype counts are per sample; f is also the sample ratio
+			int j;
+			for (j = 0; j < 4; ++j)
+				ss->ggt[i][j] = (int32_t)(ss->ggt[i][j] * f + .499);
+		}
+	}
+	if (bm->n_groups > 1)
+		ss->an = (int32_t)an, ss->ac[0] = (int32_t)ac, ss->ac[1] = ac1;
+	if (ss->vars & BGT_V_GT) {
+		int j;
+		memset(ss->gt, 0, 4 * 4);
+		for (i = 0; i < bm->n_groups; ++i)
+			for (j = 0; j < 4; ++j)
+				ss->gt[j] += ss->ggt[i][j];
+	}
+	if (ss->vars & BGT_V_CI) {
+		p = an > 0.? ac / an : 0.;
+		var = an > 0.? var / (an * an) : 0.;
+		ss->lo = p - 1.96 * sqrt(var) > 0.? p - 1.96 * sqrt(var) : 0.;
+		ss->hi = p + 1.96 * sqrt(var) < 1.? p + 1.96 * sqrt(var) : 1.;
+	}
+}
+
+// compute AC/AN from per-BGT records, before they are copied to bm->a; $hit[i] is false if BGT i lacks the site
+void bgtm_cal_info(const bgtm_t *bm, const uint8_t *hit, bgt_info_t *ss)
 {
-	int32_t cnt[4], i;
+	int32_t cnt[4], i, j, off;
 	memset(cnt, 0, 4 * 4);
 	ss->n_groups = bm->n_groups;
-	if (bm->n_groups > 1) {
-		int32_t j, gcnt[BGT_MAX_GROUPS][4];
+	ss->vars = bm->site_vars;
+	if (bm->n_groups > 1 || (ss->vars & BGT_V_GT)) {
+		int32_t gcnt[BGT_MAX_GROUPS][4];
 		memset(gcnt, 0, 4 * BGT_MAX_GROUPS * 4);
-		for (i = 0; i < bm->n_out<<1; ++i)
-			++gcnt[bm->group[i>>1]-1][bm->a[1][i]<<1 | bm->a[0][i]];
+		if (ss->vars & BGT_V_GT) {
+			memset(ss->gt, 0, 4 * 4);
+			memset(ss->ggt, 0, 4 * 4 * bm->n_groups);
+		}
+		for (i = off = 0; i < bm->n_bgt; off += bm->bgt[i++]->n_out) {
+			const uint8_t **a = bm->r[i].a;
+			const uint32_t *group = bm->group + off;
+			if (!hit[i]) { // all missing; not counted in AC/AN
+				if (ss->vars & BGT_V_GT)
+					for (j = 0; j < bm->bgt[i]->n_out; ++j)
+						++ss->ggt[group[j]-1][3];
+				continue;
+			}
+			if (ss->vars & BGT_V_GT) { // count genotypes in the same pass
+				for (j = 0; j < bm->bgt[i]->n_out; ++j) {
+					int g = group[j] - 1;
+					int c1 = a[1][j<<1|0]<<1 | a[0][j<<1|0], c2 = a[1][j<<1|1]<<1 | a[0][j<<1|1];
+					++gcnt[g][c1], ++gcnt[g][c2];
+					++ss->ggt[g][bgt_gt_cat[c1<<2|c2]];
+				}
+			} else {
+				for (j = 0; j < bm->bgt[i]->n_out<<1; ++j)
+					++gcnt[group[j>>1]-1][a[1][j]<<1 | a[0][j]];
+			}
+		}
 		for (i = 0; i < bm->n_groups; ++i) {
 			ss->gan[i] = gcnt[i][0] + gcnt[i][1] + gcnt[i][3];
 			ss->gac[i][0] = gcnt[i][1];
 			ss->gac[i][1] = gcnt[i][3];
-			for (j = 0; j < 4; ++j) cnt[j] += gcnt[i][j];
+			for (j = 0; j < 4; ++j) {
+				cnt[j] += gcnt[i][j];
+				if (ss->vars & BGT_V_GT) ss->gt[j] += ss->ggt[i][j];
+			}
 		}
 	} else {
-		for (i = 0; i < bm->n_out<<1; ++i)
-			++cnt[bm->a[1][i]<<1 | bm->a[0][i]];
+		for (i = 0; i < bm->n_bgt; ++i)
+			if (hit[i] && bm->bgt[i]->n_out)
+				bgtm_cnt_planes(bm->bgt[i]->n_out<<1, bm->r[i].a[0], bm->r[i].a[1], cnt);
 	}
 	ss->an = cnt[0] + cnt[1] + cnt[3];
 	ss->ac[0] = cnt[1], ss->ac[1] = cnt[3];
+	if (bm->approx > 0.) bgtm_approx_info(bm, ss);
+	else if (ss->vars & BGT_V_CI) {
+		ss->lo = ss->hi = ss->an? (double)ss->ac[0] / ss->an : 0.;
+		for (i = 0; i < bm->n_groups && bm->n_groups > 1; ++i)
+			ss->glo[i] = ss->ghi[i] = ss->gan[i]? (double)ss->gac[i][0] / ss->gan[i] : 0.;
+	}
 }
 
 void bgtm_assign_by_bcf(kexpr_t *e, const bcf_hdr_t *h, const bcf1_t *b)
@@ -772,19 +1781,52 @@ void bgtm_assign_by_bcf(kexpr_t *e, const bcf_hdr_t *h, const bcf1_t *b)
 	ke_set_str(e, "ALT", tmp);
 }
 
+/* List samples carrying a non-reference allele as "name:GT,...", or "." if
+ * there are none. A haplotype is ALT or other-ALT iff its bit in a[0] is set
+ * (see bgt_bits2gt), so only a[0] is scanned, skipping 8 haplotypes at a time. */
+static void bgtm_gen_carriers(bgtm_t *bm)
+{
+	static const char gt_char[4] = { '0', '1', '.', '2' };
+	int i, j, n_hap = bm->n_out<<1;
+	const uint8_t *a0 = bm->a[0], *a1 = bm->a[1];
+	kstring_t *s = &bm->carriers;
+	s->l = 0;
+	for (i = 0; i < n_hap; i += 8) {
+		int end = i + 8 < n_hap? i + 8 : n_hap;
+		if (end - i == 8) {
+			uint64_t x;
+			memcpy(&x, a0 + i, 8);
+			if (x == 0) continue;
+		}
+		for (j = i; j < end; j += 2) { // i is even, so a sample never straddles two words
+			const bgt_t *bgt;
+			if (!a0[j] && !a0[j+1]) continue;
+			bgt = bm->bgt[bm->sample_idx[j>>1]>>32];
+			if (s->l) kputc(',', s);
+			kputs(bgt->f->f->rows[(uint32_t)bm->sample_idx[j>>1]].name, s);
+			kputc(':', s); kputc(gt_char[a1[j]<<1 | a0[j]], s);
+			kputc('/', s); kputc(gt_char[a1[j+1]<<1 | a0[j+1]], s);
+		}
+	}
+	if (s->l == 0) kputc('.', s);
+}
+
 int bgtm_gen_tbl_line(bgtm_t *bm, const bgt_info_t *ss, const bcf1_t *b)
 {
 	int i, type, err;
 	kstring_t *s = &bm->tbl_line;
 	bm->tbl_line.l = 0;
+	if (bm->site_vars & BGT_V_CAR) bgtm_gen_carriers(bm);
 	for (i = 0; i < bm->n_fields; ++i) {
 		int64_t vi;
 		double vr;
 		const char *vs;
 		kexpr_t *e = bm->fields[i];
 		if (i) kputc('\t', s);
+		if (bm->annot) bgt_annot_assign((bgt_annot_t*)bm->annot, e);
 		bgtm_assign_expr(e, ss);
 		bgtm_assign_by_bcf(e, bm->h_out, b);
+		if (bm->site_vars & BGT_V_CAR) ke_set_str(e, "carriers", bm->carriers.s);
 		err = ke_eval(e, &vi, &vr, &vs, &type);
 		if (err) kputc('*', s);
 		else if (type == KEV_INT) kputl(vi, s);
@@ -794,10 +1836,36 @@ int bgtm_gen_tbl_line(bgtm_t *bm, const bgt_info_t *ss, const bcf1_t *b)
 	return 0;
 }
 
+static inline void bgtm_gtcnt_add1(bgt_gtcnt_t *c, int g1, int g2)
+{
+	if (g1 == 2 || g2 == 2) ++c->n_missing;
+	else if (g1 == 1 && g2 == 1) ++c->n_homalt;
+	else if (g1 == 1 || g2 == 1) ++c->n_het;
+	c->n_alt += (g1 == 1) + (g2 == 1);
+}
+
+static void bgtm_cnt_gt(bgtm_t *bm)
+{
+	int i, j;
+	const uint8_t *a0 = bm->a[0], *a1 = bm->a[1];
+	for (i = 0; i + 4 <= bm->n_out; i += 4) { // 8 haplotypes per 64-bit word
+		uint64_t x0, x1;
+		memcpy(&x0, a0 + (i<<1), 8);
+		memcpy(&x1, a1 + (i<<1), 8);
+		if ((x0 | x1) == 0) continue; // all reference; nothing to add
+		for (j = i; j < i + 4; ++j)
+			bgtm_gtcnt_add1(&bm->gtcnt[j], a0[j<<1|0] | a1[j<<1|0]<<1, a0[j<<1|1] | a1[j<<1|1]<<1);
+	}
+	for (; i < bm->n_out; ++i)
+		bgtm_gtcnt_add1(&bm->gtcnt[i], a0[i<<1|0] | a1[i<<1|0]<<1, a0[i<<1|1] | a1[i<<1|1]<<1);
+	++bm->n_gtcnt;
+}
+
 int bgtm_read_core(bgtm_t *bm, bcf1_t *b)
 {
 	int i, j, off = 0, n_rest = 0, max_allele = 0, l_ref, al_ret = 0;
 	const bcf1_t *b0 = 0;
+	uint8_t *hit;
 
 	// fill the buffer
 	for (i = n_rest = 0; i < bm->n_bgt; ++i) {
@@ -825,13 +1893,37 @@ int bgtm_read_core(bgtm_t *bm, bcf1_t *b)
 		int32_t val = b->pos + b->rlen;
 		bcf_append_info_ints(bm->h_out, b, "END", 1, &val);
 	}
+	// consume the records at this site; genotypes stay in bm->r[] until the site passes the filters
+	hit = (uint8_t*)alloca(bm->n_bgt);
+	for (i = 0; i < bm->n_bgt; ++i) {
+		bgt_rec_t *r = &bm->r[i];
+		hit[i] = (r->b0 && bcfcmp(b, r->b0) == 0);
+		if (hit[i]) r->b0 = 0;
+	}
+	// find samples having a set of alleles, or do haplotype counting
+	if (bm->h_al) {
+		// test if the current record matches an allele
+		al_ret = al_present((khash_t(str)*)bm->h_al, bm->h_out, b);
+		if (al_ret == 0) return 1;
+	}
+	// compute AC/AN/etc and test site_flt; INFO and the table line are only generated for passing sites
+	if ((bm->flag & BGT_F_SET_AC) || bm->site_flt || bm->n_fields > 0 || bm->n_groups > 1) {
+		if (bm->annot) {
+			bgt_annot_match((bgt_annot_t*)bm->annot, bm->h_out, b);
+			if (bm->site_flt) bgt_annot_assign((bgt_annot_t*)bm->annot, bm->site_flt);
+		}
+		bgtm_cal_info(bm, hit, &bm->ss);
+		if (!bgtm_pass_site_flt(&bm->ss, bm->site_flt))
+			return 1;
+		if (!(bm->flag & BGT_F_NO_INFO))
+			bgtm_fill_info(bm->h_out, &bm->ss, b);
+	}
 	// generate bm->a
 	for (i = 0; i < bm->n_bgt; ++i) {
 		bgt_rec_t *r = &bm->r[i];
 		bgt_t *bgt = bm->bgt[i];
 		if (bgt->n_out == 0) continue;
-		if (r->b0 && bcfcmp(b, r->b0) == 0) { // copy
-			r->b0 = 0;
+		if (hit[i]) { // copy
 			memcpy(bm->a[0] + off, r->a[0], bgt->n_out<<1);
 			memcpy(bm->a[1] + off, r->a[1], bgt->n_out<<1);
 		} else { // add missing values
@@ -840,22 +1932,10 @@ int bgtm_read_core(bgtm_t *bm, bcf1_t *b)
 		}
 		off += bgt->n_out<<1;
 	}
-	// find samples having a set of alleles, or do haplotype counting
-	if (bm->h_al) {
-		// test if the current record matches an allele
-		al_ret = al_present((khash_t(str)*)bm->h_al, bm->h_out, b);
-		if (al_ret == 0) return 1;
-	}
-	// fill AC/AN/etc and test site_flt
-	if ((bm->flag & BGT_F_SET_AC) || bm->site_flt || bm->n_fields > 0 || bm->n_groups > 1) {
-		bgt_info_t ss;
-		bgtm_cal_info(bm, &ss);
-		bgtm_fill_info(bm->h_out, &ss, b);
-		if (bm->n_fields > 0)
-			bgtm_gen_tbl_line(bm, &ss, b);
-		if (!bgtm_pass_site_flt(&ss, bm->site_flt))
-			return 1;
-	}
+	if (bm->n_fields > 0) // after bm->a is filled, for the carriers field
+		bgtm_gen_tbl_line(bm, &bm->ss, b);
+	if ((bm->flag&BGT_F_CNT_GT) && bm->gtcnt)
+		bgtm_cnt_gt(bm);
 	if (bm->h_al) {
 		// +1 to samples having the allele
 		if ((bm->flag&BGT_F_CNT_AL) && bm->alcnt) {
@@ -887,6 +1967,30 @@ int bgtm_read(bgtm_t *bm, bcf1_t *b)
 	return ret;
 }
 
+int bgtm_carriers(const bgtm_t *bm, int code, int *m_hap, int32_t **hap)
+{
+	int i, j, n = 0, n_hap = bm->n_out<<1;
+	const uint8_t *a0 = bm->a[0], *a1 = bm->a[1];
+	for (i = 0; i < n_hap; i += 8) {
+		int end = i + 8 < n_hap? i + 8 : n_hap;
+		if (end - i == 8) { // skip 8 haplotypes at a time if none of them is non-reference
+			uint64_t x0, x1;
+			memcpy(&x0, a0 + i, 8);
+			memcpy(&x1, a1 + i, 8);
+			if (code != 0 && (x0 | x1) == 0) continue;
+		}
+		for (j = i; j < end; ++j) {
+			if ((a0[j] | a1[j]<<1) != code) continue;
+			if (n == *m_hap) {
+				*m_hap = *m_hap? *m_hap<<1 : 16;
+				*hap = (int32_t*)realloc(*hap, *m_hap * 4);
+			}
+			(*hap)[n++] = j;
+		}
+	}
+	return n;
+}
+
 /**********************
  * Haplotype counting *
  **********************/
@@ -968,6 +2072,28 @@ char *bgtm_alcnt_print(const bgtm_t *bm)
 	return s.s;
 }
 
+char *bgtm_gtcnt_print(const bgtm_t *bm)
+{
+	int i, err;
+	kstring_t s = {0,0,0};
+	for (i = 0; i < bm->n_out; ++i) {
+		bgt_t *bgt = bm->bgt[bm->sample_idx[i]>>32];
+		const bgt_gtcnt_t *c = &bm->gtcnt[i];
+		if (bm->mgs[i] > 1) continue;
+		if (bm->spl_flt) {
+			ke_set_int(bm->spl_flt, "n_het", c->n_het);
+			ke_set_int(bm->spl_flt, "n_homalt", c->n_homalt);
+			ke_set_int(bm->spl_flt, "n_missing", c->n_missing);
+			ke_set_int(bm->spl_flt, "n_alt", c->n_alt);
+			ke_set_int(bm->spl_flt, "n_sites", bm->n_gtcnt);
+			if (!ke_eval_int(bm->spl_flt, &err) || err) continue;
+		}
+		ksprintf(&s, "SP\t%s\t%d\t%d\t%d\t%d\t%d\n", bgt->f->f->rows[(uint32_t)bm->sample_idx[i]].name, (int)(bm->sample_idx[i]>>32) + 1,
+				 c->n_het, c->n_homalt, c->n_missing, c->n_alt);
+	}
+	return s.s;
+}
+
 /******************
  * Allele parsing *
  ******************/
@@ -1053,3 +2179,156 @@ void bgt_al_format(const bgt_allele_t *a, kstring_t *s)
 	kputw(a->rlen, s); kputc(':', s);
 	kputsn(a->al, a->chr.s + a->chr.l - a->al, s);
 }
+
+/****************
+ * Allele index *
+ ****************/
+
+/* prefix.aix maps the hash of each normalized allele (see bgt_al_format()),
+ * both ALT and REF, to the virtual offset of its BCF record. Entries are
+ * sorted by hash, so alleles on any contigs are found with one binary search
+ * each instead of a full scan. A hash collision only adds a candidate record;
+ * al_present() still makes the final call.
+ *
+ * Layout: "AIX\1", size of the .bcf, #records, #entries, then the entries. */
+
+typedef struct { uint64_t h, off; } bgt_aix1_t;
+
+#define aix_lt(a, b) ((a).h < (b).h || ((a).h == (b).h && (a).off < (b).off))
+KSORT_INIT(aix, bgt_aix1_t, aix_lt)
+KSORT_INIT(aoff, uint64_t, ks_lt_generic)
+
+static inline uint64_t bgt_aix_hash(const char *s) // FNV-1a
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (; *s; ++s) h = (h ^ (uint8_t)*s) * 0x100000001b3ULL;
+	return h;
+}
+
+int64_t bgt_aix_build(const char *prefix)
+{
+	char *fn;
+	BGZF *bcf;
+	bcf_hdr_t *h;
+	bcf1_t *b;
+	FILE *fp;
+	bgt_allele_t a, r;
+	kstring_t s = {0,0,0};
+	int64_t n_rec = 0, n = 0, m = 0, size;
+	bgt_aix1_t *e = 0;
+
+	fn = (char*)malloc(strlen(prefix) + 9);
+	sprintf(fn, "%s.bcf", prefix);
+	if ((bcf = bgzf_open(fn, "r")) == 0) {
+		free(fn);
+		return -1;
+	}
+	h = bcf_hdr_read(bcf);
+	b = bcf_init1();
+	memset(&a, 0, sizeof(bgt_allele_t));
+	memset(&r, 0, sizeof(bgt_allele_t));
+	for (;;) {
+		int64_t off = bgzf_tell(bcf);
+		if (bcf_read1(bcf, b) < 0) break;
+		if (n + 2 > m) {
+			m = m? m<<1 : 1024;
+			e = (bgt_aix1_t*)realloc(e, m * sizeof(bgt_aix1_t));
+		}
+		bgt_al_from_bcf(h, b, &a, &r);
+		bgt_al_format(&a, &s);
+		e[n].h = bgt_aix_hash(s.s), e[n++].off = off;
+		bgt_al_format(&r, &s);
+		e[n].h = bgt_aix_hash(s.s), e[n++].off = off;
+		++n_rec;
+	}
+	free(a.chr.s); free(r.chr.s); free(s.s);
+	bcf_destroy1(b);
+	bcf_hdr_destroy(h);
+	bgzf_close(bcf);
+	ks_introsort(aix, n, e);
+
+	size = bgt_file_size(prefix, ".bcf");
+	sprintf(fn, "%s.aix", prefix);
+	if ((fp = fopen(fn, "wb")) == 0) {
+		free(fn); free(e);
+		return -1;
+	}
+	fwrite("AIX\1", 1, 4, fp);
+	fwrite(&size, 8, 1, fp);
+	fwrite(&n_rec, 8, 1, fp);
+	fwrite(&n, 8, 1, fp);
+	fwrite(e, sizeof(bgt_aix1_t), n, fp);
+	if (fclose(fp) != 0) {
+		remove(fn);
+		n_rec = -1;
+	}
+	free(fn); free(e);
+	return n_rec;
+}
+
+// open prefix.aix and read its header if it is up to date with the BCF and the PBF
+static FILE *bgt_aix_open(const bgt_t *bgt, int64_t hdr[3])
+{
+	char *fn, magic[4];
+	FILE *fp;
+	if (bgt->f->n_shards) return 0;
+	fn = (char*)malloc(strlen(bgt->f->prefix) + 9);
+	sprintf(fn, "%s.aix", bgt->f->prefix);
+	fp = fopen(fn, "rb");
+	free(fn);
+	if (fp == 0) return 0;
+	if (fread(magic, 1, 4, fp) != 4 || strncmp(magic, "AIX\1", 4) != 0 || fread(hdr, 8, 3, fp) != 3) {
+		fclose(fp);
+		return 0;
+	}
+	if (hdr[0] != bgt_file_size(bgt->f->prefix, ".bcf") || hdr[1] != pbf_get_n(bgt->pb)) {
+		if (hts_verbose >= 2)
+			fprintf(stderr, "[W::%s] '%s.aix' is out of date; run 'bgt alidx' to rebuild it\n", __func__, bgt->f->prefix);
+		fclose(fp);
+		return 0;
+	}
+	return fp;
+}
+
+int bgt_aix_lookup(bgt_t *bgt)
+{
+	const khash_t(str) *h = (const khash_t(str)*)bgt->h_al;
+	FILE *fp;
+	int64_t hdr[3], n = 0, m = 0, i;
+	uint64_t *off = 0;
+	khint_t k;
+
+	if (h == 0 || bgt->aix_off || bgt->reg || bgt->seeked || bgt->row_end > 0 || bgt->f->n_shards) return -1;
+	if ((fp = bgt_aix_open(bgt, hdr)) == 0) return -1;
+	for (k = 0; k < kh_end(h); ++k) {
+		uint64_t x;
+		int64_t lo, hi;
+		bgt_aix1_t e;
+		if (!kh_exist(h, k)) continue;
+		x = bgt_aix_hash(kh_key(h, k));
+		for (lo = 0, hi = hdr[2]; lo < hi;) { // find the first entry not less than x
+			int64_t mid = (lo + hi) >> 1;
+			fseek(fp, 28 + mid * sizeof(bgt_aix1_t), SEEK_SET);
+			fread(&e, sizeof(bgt_aix1_t), 1, fp);
+			if (e.h < x) lo = mid + 1;
+			else hi = mid;
+		}
+		fseek(fp, 28 + lo * sizeof(bgt_aix1_t), SEEK_SET);
+		for (; lo < hdr[2] && fread(&e, sizeof(bgt_aix1_t), 1, fp) == 1 && e.h == x; ++lo) {
+			if (n == m) {
+				m = m? m<<1 : 16;
+				off = (uint64_t*)realloc(off, m * 8);
+			}
+			off[n++] = e.off;
+		}
+	}
+	fclose(fp);
+	ks_introsort(aoff, n, off);
+	for (i = m = 0; i < n; ++i) // remove duplicates; REF and ALT may both be asked for
+		if (m == 0 || off[i] != off[m-1]) off[m++] = off[i];
+	bgt->aix_off = m? off : (uint64_t*)realloc(off, 8);
+	bgt->n_aix_off = m, bgt->i_aix_off = 0;
+	for (i = 0; i < m && i < bgt_readahead; ++i)
+		bgzf_willneed(bgt->bcf, off[i] >> 16, BGZF_MAX_BLOCK_SIZE);
+	return m;
+}
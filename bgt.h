@@ -9,31 +9,50 @@
 #define BGT_F_NO_GT     0x0002
 #define BGT_F_CNT_AL    0x0004
 #define BGT_F_CNT_HAP   0x0008
+#define BGT_F_CNT_GT    0x0010
+#define BGT_F_NO_INFO   0x0020 // don't write AC/AN/etc to the BCF record; they are still in bgtm_t::ss
 
 #define BGT_MAX_GROUPS  32
 #define BGT_MAX_ALLELES 64
 
 #define BGT_SET_ALL_SAMPLES (-1)
 
-typedef struct {
+typedef struct bgt_file_s {
 	char *prefix;
 	fmf_t *f;
 	bcf_hdr_t *h0; // site-only BCF header
 	hts_idx_t *idx; // BCF index
 	int32_t *mgs;
+	int drop_mono; // a materialized view without sites monomorphic for REF
+	char *view_reg; // region a materialized view was built with; NULL if it covers all sites
+	char *view_src; // fingerprint of the source a materialized view was built from; see bgt_fingerprint()
+	int n_views;
+	char **view_fn; // prefixes of materialized views registered in prefix.views; opened on demand by bgtm
+	int n_shards;
+	struct bgt_file_s **shards; // genomic shards listed in prefix.shards; the ->f and ->h0 above are shared
+	char **shard_reg; // region covered by each shard, or NULL if not given
+	int64_t *shard_off; // shard_off[i]: number of records in shards before i; shard_off[n_shards] is the total
 } bgt_file_t;
 
 typedef struct {
 	const bgt_file_t *f;
+	const bgt_file_t *cur; // file being read; ->f or one of its shards
+	int i_shard; // index of ->cur in ->f->shards
+	int64_t row_off; // #records in shards before ->cur
 	pbf_t *pb;
 	BGZF *bcf;
 	bcf1_t *b0; // site-only BCF record
 	hts_itr_t *itr;
+	int64_t row_end; // stop before this record if positive
+	int seeked; // bgt_set_start() has been called
+	char *reg; // region set by bgt_set_region()
 	const void *bed;
 	int bed_excl, n_out, n_groups, mgs_def, *out;
 	uint32_t *group, *gtag;
 	bcf_hdr_t *h_out;
 	const void *h_al; // hash table for alleles; to be set by bgtm
+	uint64_t *aix_off; // if not NULL, only read records at these BCF offsets, looked up in prefix.aix
+	int64_t n_aix_off, i_aix_off;
 } bgt_t;
 
 typedef struct { // during reading, these are all links
@@ -41,9 +60,16 @@ typedef struct { // during reading, these are all links
 	const uint8_t *a[2];
 } bgt_rec_t;
 
+#define BGT_V_GT        0x1 // genotype counts, het and callRate are referenced
+#define BGT_V_HWE       0x2 // HWE is referenced
+#define BGT_V_CI        0x4 // AFlo or AFhi is referenced
+#define BGT_V_CAR       0x8 // carriers is referenced
+
 typedef struct {
-	int32_t ac[2], an, n_groups;
+	int32_t ac[2], an, n_groups, vars;
 	int32_t gan[BGT_MAX_GROUPS], gac[BGT_MAX_GROUPS][2];
+	int32_t gt[4], ggt[BGT_MAX_GROUPS][4]; // #hom-ref, #het, #hom-alt and #missing; only computed with BGT_V_GT
+	double lo, hi, glo[BGT_MAX_GROUPS], ghi[BGT_MAX_GROUPS]; // 95% CI of the ALT frequency; only computed with BGT_V_CI
 } bgt_info_t;
 
 typedef struct {
@@ -57,6 +83,10 @@ typedef struct {
 	int tot, *cnt;
 } bgt_hapcnt_t;
 
+typedef struct {
+	int32_t n_het, n_homalt, n_missing, n_alt;
+} bgt_gtcnt_t;
+
 typedef struct {
 	int n_bgt, n_out, n_groups, flag;
 	uint64_t n_gt_read;
@@ -64,23 +94,39 @@ typedef struct {
 	uint32_t *group;
 	int32_t *mgs, mgs_def;
 	bgt_t **bgt;
+	bgt_file_t **routed; // materialized views opened by the query planner; owned by bgtm
 	bgt_rec_t *r;
 	kexpr_t *site_flt;
+	int flt_alt; // site_flt has a top-level AC>0 or AC>=1 conjunct
+	int site_vars; // BGT_V_* aggregates referenced by site_flt or fields
+	bgt_info_t ss; // AC/AN/etc of the last site read; only set with BGT_F_SET_AC, site_flt, fields or groups
+	double approx; // target half-width of 95% CIs with haplotype sampling; 0 for exact counts
+	int32_t gn[BGT_MAX_GROUPS], gs[BGT_MAX_GROUPS]; // #haplotypes in each group, and #sampled; only with approx
 	bcf_hdr_t *h_out;
 	uint8_t *a[2];
 
 	int n_fields;
 	kexpr_t **fields;
 	kstring_t tbl_line;
+	kstring_t carriers; // sample:GT of non-reference carriers at the last site; only with BGT_V_CAR
+	void *annot; // site annotations joined by allele; see bgtm_set_annot()
 
 	int n_aal;
 	bgt_allele_t *aal;
 	void *h_al;
 	int *alcnt;
 	uint64_t *hap;
+
+	kexpr_t *spl_flt;
+	int64_t n_gtcnt;
+	bgt_gtcnt_t *gtcnt;
 } bgtm_t;
 
+typedef void (*bgt_chunk_f)(void *data, int tid, int chunk, int64_t beg, int64_t end);
+
 extern int bgt_no_file;
+extern int bgt_readahead; // number of BGZF blocks to prefetch during reading; 0 to disable
+extern int bgt_dec_threads; // number of threads for decoding PBF column blocks
 
 #ifdef __cplusplus
 extern "C" {
@@ -94,34 +140,57 @@ void bgt_reader_destroy(bgt_t *bgt);
 void bgt_set_bed(bgt_t *bgt, const void *bed, int excl);
 int bgt_set_region(bgt_t *bgt, const char *reg);
 int bgt_set_start(bgt_t *bgt, int64_t n);
+int bgt_add_group(bgt_t *bgt, const char *expr);
+int bgt_add_group_core(bgt_t *bgt, int n, char *const* samples, const char *expr);
+void bgt_prepare(bgt_t *bgt);
+int bgt_read_rec(bgt_t *bgt, bgt_rec_t *r);
+int bgt_read_core0(bgt_t *bgt); // read the next site-only record and return its row, ignoring BED and alleles
+void bgt_set_end(bgt_t *bgt, int64_t n);
+int64_t bgt_get_n(const bgt_t *bgt);
+void bgt_fingerprint(const bgt_t *bgt, kstring_t *s);
 
 int bgt_read(bgt_t *bgt, bcf1_t *b);
 
+int64_t bgt_chunk_size(int64_t n, int shift, int n_threads); // #rows per chunk, aligned to PBF checkpoints
+int bgt_chunks(int64_t n, int shift, int n_threads, bgt_chunk_f func, void *data); // call func on row chunks [beg,end) in n_threads threads; return #chunks
+
 bgtm_t *bgtm_reader_init(int n_files, bgt_file_t *const*fns);
 void bgtm_reader_destroy(bgtm_t *bm);
 void bgtm_set_flag(bgtm_t *bm, int flag);
 int bgtm_set_flt_site(bgtm_t *bm, const char *expr);
+int bgtm_set_flt_sample(bgtm_t *bm, const char *expr);
 void bgtm_set_bed(bgtm_t *bm, const void *bed, int excl);
 int bgtm_set_region(bgtm_t *bm, const char *reg);
 int bgtm_set_start(bgtm_t *bm, int64_t n);
+void bgtm_set_end(bgtm_t *bm, int64_t n);
 int bgtm_set_table(bgtm_t *bm, const char *fmt);
+int bgtm_set_annot(bgtm_t *bm, const char *fn); // fn: position-sorted FMF of site annotations
+int bgtm_has_annot_var(const bgtm_t *bm); // whether -f or -t refers to a variable not set by bgtm, i.e. to an annotation
 int bgtm_set_alleles(bgtm_t *bm, const char *expr, const fmf_t *f, const char *fn); // call this AFTER bgtm_set_region()
 int bgtm_set_mgs(bgtm_t *bm, int mgs_def);
+int bgtm_set_approx(bgtm_t *bm, double eps); // call this AFTER bgtm_set_flag()
 int bgtm_add_group(bgtm_t *bm, const char *expr);
 int bgtm_add_allele(bgtm_t *bm, const char *al);
 int bgtm_prepare(bgtm_t *bm);
 int bgtm_test_mgs(const bgtm_t *bm);
 
 int bgtm_read(bgtm_t *bm, bcf1_t *b);
+int bgtm_read_core(bgtm_t *bm, bcf1_t *b); // one step of bgtm_read() without genotypes; 0 for a site, 1 if rejected, -1 at the end
+void bgt_gen_gt(const bcf_hdr_t *h, bcf1_t *b, int m, const uint8_t **a, int32_t *mgs);
+int bgtm_carriers(const bgtm_t *bm, int code, int *m_hap, int32_t **hap);
 
 bgt_hapcnt_t *bgtm_hapcnt(const bgtm_t *bm, int *n_hap);
 char *bgtm_hapcnt_print_destroy(const bgtm_t *bm, int n_hap, bgt_hapcnt_t *hc);
 char *bgtm_alcnt_print(const bgtm_t *bm);
+char *bgtm_gtcnt_print(const bgtm_t *bm);
 
 int bgt_al_parse(const char *al, bgt_allele_t *a);
 void bgt_al_format(const bgt_allele_t *a, kstring_t *s);
 void bgt_al_from_bcf(const bcf_hdr_t *h, const bcf1_t *b, bgt_allele_t *a, bgt_allele_t *r);
 
+int64_t bgt_aix_build(const char *prefix); // write prefix.aix; return #records or -1
+int bgt_aix_lookup(bgt_t *bgt); // restrict bgt to records matching ->h_al; -1 if no usable index
+
 #ifdef __cplusplus
 }
 #endif
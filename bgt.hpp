@@ -0,0 +1,188 @@
+#ifndef BGT_HPP
+#define BGT_HPP
+
+/* Header-only C++17 interface to BGT. Link with libbgt.a (-lbgt -lpthread -lz -lm).
+
+   Example:
+
+     bgt::File f("1kg11-1M.bgt");
+     bgt::Reader r(f);
+     r.add_group("population==\"CEU\"");
+     r.set_site_filter("AC1>10");
+     r.for_each_site<bgt::Out::Sites>([](const bgt::Site &s) {
+         printf("%s\t%d\n", s.chrom(), s.pos() + 1);
+     });
+ */
+
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "bgt.h"
+
+namespace bgt {
+
+/**
+ * RAII handle of an opened BGT database (bgt_file_t)
+ */
+class File {
+	bgt_file_t *f_ = nullptr;
+public:
+	explicit File(const char *prefix) : f_(bgt_open(prefix)) {
+		if (f_ == nullptr) throw std::runtime_error(std::string("failed to open BGT with prefix '") + prefix + "'");
+	}
+	explicit File(const std::string &prefix) : File(prefix.c_str()) {}
+	File(const File&) = delete;
+	File &operator=(const File&) = delete;
+	File(File &&o) noexcept : f_(o.f_) { o.f_ = nullptr; }
+	File &operator=(File &&o) noexcept { std::swap(f_, o.f_); return *this; }
+	~File() { if (f_) bgt_close(f_); }
+
+	bgt_file_t *get() const { return f_; }
+	int n_samples() const { return f_->f->n_rows; }
+	const char *sample(int i) const { return f_->f->rows[i].name; }
+};
+
+/**
+ * Lightweight view of the current site; valid until the reader advances
+ *
+ * Haplotype codes: 0 for REF, 1 for ALT, 2 for missing and 3 for another ALT (<M>).
+ */
+class Site {
+	const bgtm_t *bm_;
+	const bcf1_t *b_;
+public:
+	Site(const bgtm_t *bm, const bcf1_t *b) : bm_(bm), b_(b) {}
+
+	const bcf1_t *bcf() const { return b_; }
+	const bcf_hdr_t *header() const { return bm_->h_out; }
+	const char *chrom() const { return bm_->h_out->id[BCF_DT_CTG][b_->rid].key; }
+	int rid() const { return b_->rid; }
+	int pos() const { return b_->pos; } // 0-based
+	int rlen() const { return b_->rlen; }
+	std::string ref() const { int l_ref, l_alt; char *ref, *alt; bcf_get_ref_alt1(b_, &l_ref, &ref, &l_alt, &alt); return std::string(ref, l_ref); }
+	std::string alt() const { int l_ref, l_alt; char *ref, *alt; bcf_get_ref_alt1(b_, &l_ref, &ref, &l_alt, &alt); return std::string(alt, l_alt); }
+
+	int n_haplotypes() const { return bm_->n_out << 1; }
+	int hap(int i) const { return bm_->a[1][i] << 1 | bm_->a[0][i]; }
+	const uint8_t *plane(int k) const { return bm_->a[k]; }
+	int group(int sample) const { return bm_->group[sample]; } // 1-based
+	const char *table_line() const { return bm_->tbl_line.s; } // only with Reader::set_table()
+	const bgt_info_t &info() const { return bm_->ss; } // AC/AN/etc; only with a site filter, table, groups or BGT_F_SET_AC
+};
+
+/**
+ * Output of Reader::for_each_site(), fixed at compile time
+ */
+enum class Out {
+	Sites,     // site only; neither genotypes nor AC/AN are written to the BCF record
+	Genotypes, // BCF record with AC/AN and sample genotypes
+	Table      // a table line per site, requiring Reader::set_table(); the BCF record is as with Sites
+};
+
+/**
+ * RAII handle of a multi-BGT reader (bgtm_t)
+ *
+ * Setters throw std::runtime_error on errors. They must be called before the
+ * first site is read.
+ */
+class Reader {
+	bgtm_t *bm_ = nullptr;
+	bcf1_t *b_ = nullptr;
+	int flag_ = 0;
+	bool prepared_ = false;
+
+	static void check(bool ok, const char *msg) { if (!ok) throw std::runtime_error(msg); }
+	void prepare(int flag) {
+		if (prepared_) return;
+		bgtm_set_flag(bm_, bm_->flag | flag_ | flag);
+		bgtm_prepare(bm_);
+		prepared_ = true;
+	}
+public:
+	explicit Reader(const File &f) : Reader(std::vector<const File*>{&f}) {}
+	explicit Reader(const std::vector<const File*> &files) {
+		std::vector<bgt_file_t*> fs;
+		for (const File *f : files) fs.push_back(f->get());
+		bm_ = bgtm_reader_init((int)fs.size(), fs.data());
+		b_ = bcf_init1();
+	}
+	Reader(const Reader&) = delete;
+	Reader &operator=(const Reader&) = delete;
+	Reader(Reader &&o) noexcept : bm_(o.bm_), b_(o.b_), flag_(o.flag_), prepared_(o.prepared_) { o.bm_ = nullptr, o.b_ = nullptr; }
+	~Reader() {
+		if (b_) bcf_destroy1(b_);
+		if (bm_) bgtm_reader_destroy(bm_);
+	}
+
+	bgtm_t *get() const { return bm_; }
+	void set_region(const char *reg) { check(bgtm_set_region(bm_, reg) >= 0, "failed to set region"); }
+	void set_start(int64_t n) { bgtm_set_start(bm_, n); }
+	void set_alleles(const char *expr) { check(bgtm_set_alleles(bm_, expr, 0, 0) >= 0, "failed to set alleles"); }
+	void add_group(const char *expr) { check(bgtm_add_group(bm_, expr) >= 0, "failed to add sample group"); }
+	void set_site_filter(const char *expr) { check(bgtm_set_flt_site(bm_, expr) == 0, "failed to parse the site filter"); }
+	void set_table(const char *fmt) { check(bgtm_set_table(bm_, fmt) == 0, "failed to parse table fields"); }
+	void set_flag(int flag) { flag_ |= flag; } // extra BGT_F_* flags
+
+	/**
+	 * Call $cb on each site passing the filters
+	 *
+	 * Reader options are fixed on the first call. $cb takes a const Site& and
+	 * returns void, or bool with false to stop. The loop is instantiated per
+	 * output mode and callback: it steps bgtm_read_core() directly, and only
+	 * Out::Genotypes formats genotypes, so Sites and Table skip the GT and
+	 * AC/AN INFO encoding of every record. Filters, groups and alleles are
+	 * still tested at run time in bgtm_read_core().
+	 *
+	 * @return number of sites visited
+	 */
+	template<Out O = Out::Sites, class F>
+	int64_t for_each_site(F &&cb) {
+		int64_t n = 0;
+		int ret;
+		if constexpr (O == Out::Table)
+			if (bm_->n_fields == 0) throw std::runtime_error("Out::Table requires set_table()");
+		prepare(O == Out::Genotypes? 0 : BGT_F_NO_GT|BGT_F_NO_INFO);
+		while ((ret = bgtm_read_core(bm_, b_)) >= 0) {
+			if (ret > 0) continue; // rejected by filters or alleles
+			if constexpr (O == Out::Genotypes)
+				if ((bm_->flag & BGT_F_NO_GT) == 0) // set by bgtm_prepare() if no sample can be output
+					bgt_gen_gt(bm_->h_out, b_, bm_->n_out, (const uint8_t**)bm_->a, bm_->mgs);
+			Site s(bm_, b_);
+			++n;
+			if constexpr (std::is_same_v<decltype(cb(s)), bool>) {
+				if (!cb(s)) break;
+			} else cb(s);
+		}
+		return n;
+	}
+
+	class iterator {
+		Reader *r_;
+		bool end_;
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = Site;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const Site*;
+		using reference = Site;
+		iterator(Reader *r, bool end) : r_(r), end_(end) { if (!end_) ++*this; }
+		Site operator*() const { return Site(r_->bm_, r_->b_); }
+		iterator &operator++() { end_ = bgtm_read(r_->bm_, r_->b_) < 0; return *this; }
+		bool operator==(const iterator &o) const { return end_ == o.end_; }
+		bool operator!=(const iterator &o) const { return end_ != o.end_; }
+	};
+
+	/**
+	 * Range over sites with genotypes, as in "for (const auto &s : reader)"
+	 */
+	iterator begin() { prepare(0); return iterator(this, false); }
+	iterator end() { return iterator(this, true); }
+};
+
+} // namespace bgt
+
+#endif
@@ -30,6 +30,7 @@
 #include <pthread.h>
 #include <sys/types.h>
 #include "bgzf.h"
+#include "readahead.h"
 
 #if defined(_USE_KNETFILE) || defined(_USE_KURL)
 #ifdef _USE_KURL
@@ -322,6 +323,14 @@ int bgzf_read_block(BGZF *fp)
 	int64_t block_address;
 	block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
 	if (fp->cache_size && load_block_from_cache(fp, block_address)) return 0;
+	if (fp->ra_blocks > 0) { // renew the hint when half of the window has been read or after a seek
+		int64_t w = (int64_t)fp->ra_blocks * BGZF_MAX_BLOCK_SIZE;
+		if (block_address + w/2 >= fp->ra_end || block_address + w < fp->ra_end) {
+			int64_t beg = block_address > fp->ra_end || block_address + w < fp->ra_end? block_address : fp->ra_end;
+			fp->ra_end = block_address + w;
+			ra_willneed(_bgzf_fileno(fp->fp), beg, fp->ra_end - beg);
+		}
+	}
 	count = _bgzf_read(fp->fp, header, sizeof(header));
 	if (count == 0) { // no data read
 		fp->block_length = 0;
@@ -617,6 +626,18 @@ void bgzf_set_cache_size(BGZF *fp, int cache_size)
 	if (fp) fp->cache_size = cache_size;
 }
 
+void bgzf_set_readahead(BGZF *fp, int n_blocks)
+{
+	if (fp == 0 || fp->is_write) return;
+	fp->ra_blocks = n_blocks, fp->ra_end = 0;
+	if (n_blocks > 0) ra_sequential(_bgzf_fileno(fp->fp));
+}
+
+void bgzf_willneed(BGZF *fp, int64_t coff, int64_t len)
+{
+	if (fp && !fp->is_write) ra_willneed(_bgzf_fileno(fp->fp), coff, len);
+}
+
 int bgzf_check_EOF(BGZF *fp)
 {
 	uint8_t buf[28];
@@ -48,6 +48,8 @@ typedef struct {
     int64_t block_address;
     void *uncompressed_block, *compressed_block;
 	void *cache; // a pointer to a hash table
+	int ra_blocks; // number of blocks to read ahead; 0 to disable
+	int64_t ra_end; // end of the range hinted for read-ahead
 	void *fp; // actual file handler; FILE* on writing; FILE* or knetFile* on reading
 #ifdef BGZF_MT
 	void *mt; // only used for multi-threading
@@ -166,6 +168,23 @@ extern "C" {
 	 */
 	void bgzf_set_cache_size(BGZF *fp, int size);
 
+	/**
+	 * Read ahead of the file position in the background
+	 *
+	 * @param fp        BGZF file handler
+	 * @param n_blocks  prefetch the next n_blocks blocks (see ra_willneed()); 0 to disable (default)
+	 */
+	void bgzf_set_readahead(BGZF *fp, int n_blocks);
+
+	/**
+	 * Prefetch a range of the compressed file in the background (see ra_willneed())
+	 *
+	 * @param fp     BGZF file handler
+	 * @param coff   file offset of the range
+	 * @param len    length of the range in bytes
+	 */
+	void bgzf_willneed(BGZF *fp, int64_t coff, int64_t len);
+
 	/**
 	 * Flush the file if the remaining buffer size is smaller than _size_ 
 	 */
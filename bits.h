@@ -0,0 +1,54 @@
+#ifndef BITS_H
+#define BITS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline int popcount64(uint64_t x) // SWAR; inlined and vectorized without -mpopcnt
+{
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (x * 0x0101010101010101ULL) >> 56;
+}
+
+/* One-hot bit planes of a block of sites. Each of the n rows (samples or
+ * sample pairs) has n_planes planes of n_words 64-bit words, and bit s of a
+ * plane is set if the row is in that class at site s of the block. */
+typedef struct {
+	int n, n_planes, n_words, n_sites; // n_sites: #sites in the current block
+	uint64_t *bits; // bits[(i*n_planes+p)*n_words+w]
+} bitplane_t;
+
+static inline void bp_init(bitplane_t *b, int n, int n_planes, int n_words)
+{
+	b->n = n, b->n_planes = n_planes, b->n_words = n_words, b->n_sites = 0;
+	b->bits = (uint64_t*)calloc((size_t)n * n_planes * n_words, 8);
+}
+
+static inline void bp_destroy(bitplane_t *b) { free(b->bits); }
+
+// plane 0 of row i; plane p follows at +p*n_words
+static inline const uint64_t *bp_row(const bitplane_t *b, int i) { return &b->bits[(size_t)i * b->n_planes * b->n_words]; }
+
+// #words used by the current block
+static inline int bp_used(const bitplane_t *b) { return (b->n_sites + 63) >> 6; }
+
+// put row i into class p at the current site
+static inline void bp_set(bitplane_t *b, int i, int p)
+{
+	b->bits[((size_t)i * b->n_planes + p) * b->n_words + (b->n_sites >> 6)] |= 1ULL << (b->n_sites & 63);
+}
+
+// move to the next site; return true if the block is full and should be counted
+static inline int bp_next(bitplane_t *b) { return ++b->n_sites == b->n_words * 64; }
+
+// start a new block after counting
+static inline void bp_clear(bitplane_t *b)
+{
+	memset(b->bits, 0, (size_t)b->n * b->n_planes * b->n_words * 8);
+	b->n_sites = 0;
+}
+
+#endif
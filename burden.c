@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include "bgt.h"
+#include "kstring.h"
+
+#include "khash.h"
+KHASH_MAP_INIT_STR(s2g, int)
+
+#include "ksort.h"
+KSORT_INIT_GENERIC(uint32_t)
+
+typedef struct {
+	int n, m;
+	uint32_t *a; // sample index, one entry per qualifying allele
+} bgt_burden1_t;
+
+typedef struct {
+	int n, m;
+	int *g; // indices of groups the allele is annotated to
+} bgt_burden_al_t;
+
+typedef struct {
+	int n, m;
+	char **name;
+	bgt_burden1_t *g;
+	int n_al, m_al;
+	bgt_burden_al_t *al;
+	khash_t(s2g) *al2g; // allele => index in ->al
+	khash_t(s2g) *name2g; // group name => group index
+	kstring_t list; // comma-leading list of alleles for bgtm_set_alleles()
+} bgt_burden_t;
+
+static int burden_get_group(bgt_burden_t *bd, const char *name)
+{
+	int absent;
+	khint_t k;
+	k = kh_put(s2g, bd->name2g, name, &absent);
+	if (absent) {
+		if (bd->n == bd->m) {
+			bd->m = bd->m? bd->m<<1 : 16;
+			bd->name = (char**)realloc(bd->name, bd->m * sizeof(char*));
+			bd->g = (bgt_burden1_t*)realloc(bd->g, bd->m * sizeof(bgt_burden1_t));
+		}
+		memset(&bd->g[bd->n], 0, sizeof(bgt_burden1_t));
+		kh_key(bd->name2g, k) = bd->name[bd->n] = strdup(name);
+		kh_val(bd->name2g, k) = bd->n++;
+	}
+	return kh_val(bd->name2g, k);
+}
+
+// add group $g to allele $a unless it is there already
+static void burden_al_add(bgt_burden_al_t *a, int g)
+{
+	int i;
+	for (i = 0; i < a->n; ++i)
+		if (a->g[i] == g) return;
+	if (a->n == a->m) {
+		a->m = a->m? a->m<<1 : 2;
+		a->g = (int*)realloc(a->g, a->m * sizeof(int));
+	}
+	a->g[a->n++] = g;
+}
+
+// read alleles passing $ke, and map each allele to the values of $key in all its annotation lines
+static int burden_read_anno(bgt_burden_t *bd, const char *fn, kexpr_t *ke, const char *key)
+{
+	fms_t *f;
+	const char *s;
+	int l_key = strlen(key), n_al = 0;
+	kstring_t al = {0,0,0}, tmp = {0,0,0};
+	if ((f = fms_open(fn)) == 0) return -1;
+	while ((s = fms_read(f, ke, 0)) != 0) {
+		const char *p, *q, *v = 0;
+		bgt_allele_t a;
+		int absent, g;
+		khint_t k;
+		for (p = s; *p && *p != '\t'; ++p);
+		for (q = p; *q; ) { // find "key:type:value"
+			const char *r;
+			for (r = ++q; *r && *r != '\t'; ++r);
+			if (r - q > l_key + 3 && strncmp(q, key, l_key) == 0 && q[l_key] == ':' && q[l_key+2] == ':') {
+				v = q + l_key + 3;
+				break;
+			}
+			q = r;
+		}
+		if (v == 0) continue; // no group key
+		memset(&a, 0, sizeof(bgt_allele_t));
+		kputsn(s, p - s, &al);
+		if (bgt_al_parse(al.s, &a) == 0) {
+			for (q = v; *q && *q != '\t'; ++q);
+			tmp.l = 0; kputsn(v, q - v, &tmp);
+			g = burden_get_group(bd, tmp.s);
+			bgt_al_format(&a, &tmp);
+			k = kh_put(s2g, bd->al2g, tmp.s, &absent);
+			if (absent) {
+				if (bd->n_al == bd->m_al) {
+					bd->m_al = bd->m_al? bd->m_al<<1 : 16;
+					bd->al = (bgt_burden_al_t*)realloc(bd->al, bd->m_al * sizeof(bgt_burden_al_t));
+				}
+				memset(&bd->al[bd->n_al], 0, sizeof(bgt_burden_al_t));
+				kh_key(bd->al2g, k) = strdup(tmp.s);
+				kh_val(bd->al2g, k) = bd->n_al++;
+				kputc(',', &bd->list); kputs(al.s, &bd->list);
+				++n_al;
+			}
+			burden_al_add(&bd->al[kh_val(bd->al2g, k)], g);
+		}
+		free(a.chr.s);
+		al.l = 0;
+	}
+	free(al.s); free(tmp.s);
+	fms_close(f);
+	return n_al;
+}
+
+static void burden_destroy(bgt_burden_t *bd)
+{
+	int i;
+	khint_t k;
+	for (i = 0; i < bd->n; ++i) free(bd->g[i].a);
+	free(bd->g);
+	for (i = 0; i < bd->n_al; ++i) free(bd->al[i].g);
+	free(bd->al);
+	for (k = 0; k < kh_end(bd->al2g); ++k)
+		if (kh_exist(bd->al2g, k)) free((char*)kh_key(bd->al2g, k));
+	for (i = 0; i < bd->n; ++i) free(bd->name[i]);
+	free(bd->name);
+	kh_destroy(s2g, bd->al2g);
+	kh_destroy(s2g, bd->name2g);
+	free(bd->list.s);
+}
+
+// add sample $s to group $g
+static inline void burden_add(bgt_burden1_t *g, uint32_t s)
+{
+	if (g->n == g->m) {
+		g->m = g->m? g->m<<1 : 16;
+		g->a = (uint32_t*)realloc(g->a, g->m * 4);
+	}
+	g->a[g->n++] = s;
+}
+
+static void burden_print(const bgtm_t *bm, bgt_burden_t *bd)
+{
+	int i, j, k;
+	kstring_t s = {0,0,0};
+	for (i = 0; i < bd->n; ++i) {
+		bgt_burden1_t *g = &bd->g[i];
+		ks_introsort(uint32_t, g->n, g->a);
+		for (j = 0; j < g->n; j = k) {
+			uint32_t x = g->a[j];
+			const bgt_t *bgt = bm->bgt[bm->sample_idx[x]>>32];
+			for (k = j + 1; k < g->n && g->a[k] == x; ++k);
+			if (bm->mgs[x] > 1) continue;
+			s.l = 0;
+			kputs(bd->name[i], &s); kputc('\t', &s);
+			kputs(bgt->f->f->rows[(uint32_t)bm->sample_idx[x]].name, &s); kputc('\t', &s);
+			kputw(k - j, &s);
+			puts(s.s);
+		}
+	}
+	free(s.s);
+}
+
+int main_burden(int argc, char *argv[])
+{
+	int i, c, err, n_files = 0, n_groups = 0, n_al, m_hap = 0;
+	char *reg = 0, *site_flt = 0, *aexpr = 0, *dbfn = 0, *key = 0, *gexpr[BGT_MAX_GROUPS];
+	int32_t *hap = 0;
+	bgt_file_t **files;
+	bgt_burden_t bd;
+	kexpr_t *ke;
+	bgtm_t *bm;
+	bcf1_t *b;
+	bgt_allele_t a;
+	kstring_t s = {0,0,0};
+
+	while ((c = getopt(argc, argv, "r:f:a:d:k:s:")) >= 0) {
+		if (c == 'r') reg = optarg;
+		else if (c == 'f') site_flt = optarg;
+		else if (c == 'a') aexpr = optarg;
+		else if (c == 'd') dbfn = optarg;
+		else if (c == 'k') key = optarg;
+		else if (c == 's' && n_groups < BGT_MAX_GROUPS) gexpr[n_groups++] = optarg;
+	}
+	if (argc - optind < 1 || dbfn == 0 || aexpr == 0 || key == 0) {
+		fprintf(stderr, "Usage: bgt burden [options] -d <anno.fmf> -a <expr> -k <key> <bgt-prefix> [...]\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -d FILE      variant annotations in FMF []\n");
+		fprintf(stderr, "  -a EXPR      qualifying alleles, as an expression on annotations []\n");
+		fprintf(stderr, "  -k STR       annotation key to group alleles by (e.g. gene) []\n");
+		fprintf(stderr, "  -s EXPR      samples list (see 'bgt view') [all]\n");
+		fprintf(stderr, "  -r STR       region [all]\n");
+		fprintf(stderr, "  -f STR       frequency filters []\n");
+		fprintf(stderr, "Output: TAB-delimited group, sample and the count of qualifying alleles in the\n");
+		fprintf(stderr, "  sample, for non-zero counts only.\n");
+		return 1;
+	}
+
+	memset(&bd, 0, sizeof(bgt_burden_t));
+	bd.al2g = kh_init(s2g);
+	bd.name2g = kh_init(s2g);
+	ke = ke_parse(aexpr, &err);
+	if (err) {
+		fprintf(stderr, "[E::%s] failed to parse the allele expression.\n", __func__);
+		if (ke) ke_destroy(ke);
+		return 1;
+	}
+	n_al = burden_read_anno(&bd, dbfn, ke, key);
+	ke_destroy(ke);
+	if (n_al < 0) {
+		fprintf(stderr, "[E::%s] failed to open the annotation file '%s'\n", __func__, dbfn);
+		return 1;
+	} else if (n_al == 0) {
+		fprintf(stderr, "[W::%s] no alleles selected.\n", __func__);
+		burden_destroy(&bd);
+		return 0;
+	}
+
+	n_files = argc - optind;
+	files = (bgt_file_t**)calloc(n_files, sizeof(bgt_file_t*));
+	for (i = 0; i < n_files; ++i) {
+		files[i] = bgt_open(argv[optind+i]);
+		if (files[i] == 0) {
+			fprintf(stderr, "[E::%s] failed to open BGT with prefix '%s'\n", __func__, argv[optind+i]);
+			return 1;
+		}
+	}
+	bm = bgtm_reader_init(n_files, files);
+	bgtm_set_flag(bm, BGT_F_NO_GT);
+	if (site_flt && bgtm_set_flt_site(bm, site_flt) != 0) {
+		fprintf(stderr, "[E::%s] failed to set frequency filters. Syntax error?\n", __func__);
+		return 1;
+	}
+	if (reg && bgtm_set_region(bm, reg) < 0) {
+		fprintf(stderr, "[E::%s] failed to set region. Region format error?\n", __func__);
+		return 1;
+	}
+	bgtm_set_alleles(bm, bd.list.s, 0, 0);
+	for (i = 0; i < n_groups; ++i) {
+		if (bgtm_add_group(bm, gexpr[i]) < 0) {
+			fprintf(stderr, "[E::%s] failed to add sample group '%s'.\n", __func__, gexpr[i]);
+			return 1;
+		}
+	}
+	bgtm_prepare(bm);
+
+	b = bcf_init1();
+	memset(&a, 0, sizeof(bgt_allele_t));
+	while (bgtm_read(bm, b) >= 0) {
+		int code = 1, n_hap;
+		khint_t k;
+		bgt_allele_t r;
+		memset(&r, 0, sizeof(bgt_allele_t));
+		bgt_al_from_bcf(bm->h_out, b, &a, &r);
+		bgt_al_format(&a, &s);
+		k = kh_get(s2g, bd.al2g, s.s);
+		if (k == kh_end(bd.al2g)) { // the annotation may be on the reference allele
+			bgt_al_format(&r, &s);
+			k = kh_get(s2g, bd.al2g, s.s);
+			code = 0;
+		}
+		free(r.chr.s);
+		if (k == kh_end(bd.al2g)) continue;
+		n_hap = bgtm_carriers(bm, code, &m_hap, &hap);
+		{
+			const bgt_burden_al_t *p = &bd.al[kh_val(bd.al2g, k)];
+			int j;
+			for (j = 0; j < p->n; ++j)
+				for (i = 0; i < n_hap; ++i)
+					burden_add(&bd.g[p->g[j]], hap[i]>>1);
+		}
+	}
+	bcf_destroy1(b);
+	burden_print(bm, &bd);
+
+	free(a.chr.s); free(s.s); free(hap);
+	burden_destroy(&bd);
+	bgtm_reader_destroy(bm);
+	for (i = 0; i < n_files; ++i) bgt_close(files[i]);
+	free(files);
+	return 0;
+}
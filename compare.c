@@ -0,0 +1,382 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include "bgt.h"
+#include "kstring.h"
+#include "bits.h"
+#include "kseq.h"
+#include "khash.h"
+KHASH_DECLARE(s2i, kh_cstr_t, int64_t)
+
+#define CMP_BLOCK_WORDS 16 // sites are packed in blocks of 16*64
+
+/* For each pair of samples, a site is put into one of four genotype classes
+ * on either side: 0, 1 or 2 copies of the ALT allele, or missing (3). A site
+ * present in one BGT only is missing in the other. Classes of a block of sites
+ * are packed into one-hot bit planes, four for A and four for B, such that cell
+ * (x,y) of the 4x4 concordance matrix is the popcount of A[x] & B[y]. */
+typedef struct {
+	int n; // #sample pairs
+	int *ia, *ib; // index of each pair in bgt_t::out of A and of B
+	bitplane_t bp; // 8 planes per pair; p<4 for A and p>=4 for B
+	uint64_t (*cnt)[16];
+	int64_t n_site[3]; // #sites in both, in A only and in B only
+} cmp_t;
+
+static void cmp_init(cmp_t *c, int n, int *ia, int *ib)
+{
+	memset(c, 0, sizeof(cmp_t));
+	c->n = n, c->ia = ia, c->ib = ib;
+	bp_init(&c->bp, n, 8, CMP_BLOCK_WORDS);
+	c->cnt = (uint64_t(*)[16])calloc(n, sizeof(*c->cnt));
+}
+
+static void cmp_flush(cmp_t *c)
+{
+	int k, x, y, w, n_words = bp_used(&c->bp);
+	if (c->bp.n_sites == 0) return;
+	for (k = 0; k < c->n; ++k) {
+		const uint64_t *a = bp_row(&c->bp, k), *b = a + 4 * CMP_BLOCK_WORDS;
+		for (x = 0; x < 4; ++x) {
+			const uint64_t *ax = a + x * CMP_BLOCK_WORDS;
+			for (y = 0; y < 4; ++y) {
+				const uint64_t *by = b + y * CMP_BLOCK_WORDS;
+				uint32_t s = 0;
+				for (w = 0; w < n_words; ++w)
+					s += popcount64(ax[w] & by[w]);
+				c->cnt[k][x<<2|y] += s;
+			}
+		}
+	}
+	bp_clear(&c->bp);
+}
+
+static void cmp_merge(cmp_t *c, const cmp_t *t)
+{
+	int k, j;
+	for (j = 0; j < 3; ++j) c->n_site[j] += t->n_site[j];
+	for (k = 0; k < c->n; ++k)
+		for (j = 0; j < 16; ++j)
+			c->cnt[k][j] += t->cnt[k][j];
+}
+
+static inline int cmp_class(const uint8_t *const*a, int i)
+{
+	int c1 = a[1][i<<1|0]<<1 | a[0][i<<1|0], c2 = a[1][i<<1|1]<<1 | a[0][i<<1|1];
+	return c1 == 2 || c2 == 2? 3 : (c1 == 1) + (c2 == 1);
+}
+
+// pack a site into the current block; $a or $b is NULL if the site is absent from that side
+static void cmp_add(cmp_t *c, const uint8_t *const*a, const uint8_t *const*b, uint64_t *site)
+{
+	int k;
+	++c->n_site[a && b? 0 : a? 1 : 2];
+	for (k = 0; k < c->n; ++k) {
+		int x = a? cmp_class(a, c->ia[k]) : 3, y = b? cmp_class(b, c->ib[k]) : 3;
+		bp_set(&c->bp, k, x);
+		bp_set(&c->bp, k, 4 + y);
+		if (site) ++site[x<<2|y];
+	}
+	if (bp_next(&c->bp)) cmp_flush(c);
+}
+
+// #called in both, #concordant, non-reference discordance and the matrix
+static void cmp_format(const uint64_t *m, kstring_t *s)
+{
+	int x, y;
+	uint64_t called = 0, conc = m[0] + m[5] + m[10];
+	for (x = 0; x < 3; ++x)
+		for (y = 0; y < 3; ++y)
+			called += m[x<<2|y];
+	kputl(called, s); kputc('\t', s);
+	kputl(conc, s); kputc('\t', s);
+	if (called > m[0]) ksprintf(s, "%.4f", (double)(called - conc) / (called - m[0]));
+	else kputs("NA", s);
+	kputc('\t', s);
+	for (x = 0; x < 16; ++x) {
+		if (x) kputc(',', s);
+		kputl(m[x], s);
+	}
+}
+
+static void cmp_print_site(const bgt_t *bgt, const bcf1_t *b0, int which, const uint64_t *m, kstring_t *s)
+{
+	int l_ref, l_alt;
+	char *ref, *alt;
+	bcf_get_ref_alt1(b0, &l_ref, &ref, &l_alt, &alt);
+	s->l = 0;
+	kputs(bgt->f->h0->id[BCF_DT_CTG][b0->rid].key, s); kputc('\t', s);
+	kputw(b0->pos + 1, s); kputc('\t', s);
+	kputsn(ref, l_ref, s); kputc('\t', s);
+	kputsn(alt, l_alt, s); kputc('\t', s);
+	kputs(which == 0? "AB" : which == 1? "A" : "B", s); kputc('\t', s);
+	cmp_format(m, s);
+	puts(s->s);
+}
+
+// co-iterate A and B by allele; $rb may be NULL if B has no records in range
+static void cmp_read(bgt_t *ra, bgt_t *rb, cmp_t *c, int per_site)
+{
+	bgt_rec_t a, b;
+	uint64_t site[16];
+	kstring_t s = {0,0,0};
+	bgt_read_rec(ra, &a);
+	if (rb) bgt_read_rec(rb, &b);
+	else b.b0 = 0;
+	while (a.b0 || b.b0) {
+		int x = !a.b0? 1 : !b.b0? -1 : bcfcmp(a.b0, b.b0);
+		if (per_site) memset(site, 0, sizeof(site));
+		cmp_add(c, x <= 0? a.a : 0, x >= 0? b.a : 0, per_site? site : 0);
+		if (per_site) cmp_print_site(x <= 0? ra : rb, x <= 0? a.b0 : b.b0, x == 0? 0 : x < 0? 1 : 2, site, &s);
+		if (x <= 0) bgt_read_rec(ra, &a);
+		if (x >= 0) bgt_read_rec(rb, &b);
+	}
+	free(s.s);
+}
+
+/*** multi-threading over checkpoint chunks of A ***/
+
+typedef struct {
+	int64_t (*beg)[2]; // first row of each chunk in A and in B
+	bgt_t *(*r)[2];
+	cmp_t *c;
+} cmp_shared_t;
+
+static void cmp_chunk(void *data, int tid, int c, int64_t beg, int64_t end)
+{
+	cmp_shared_t *sh = (cmp_shared_t*)data;
+	bgt_t *ra = sh->r[tid][0], *rb = sh->r[tid][1];
+	bgt_set_start(ra, beg);
+	bgt_set_end(ra, end);
+	if (sh->beg[c][1] < sh->beg[c+1][1]) {
+		bgt_set_start(rb, sh->beg[c][1]);
+		bgt_set_end(rb, sh->beg[c+1][1]);
+		cmp_read(ra, rb, &sh->c[tid], 0);
+	} else cmp_read(ra, 0, &sh->c[tid], 0);
+}
+
+// first row in B not smaller than row $i of A, searched from row $lo of B
+static int64_t cmp_lower_bound(bgt_t *ra, bgt_t *rb, int64_t i, int64_t lo, int64_t hi)
+{
+	bgt_set_start(ra, i);
+	if (bgt_read_core0(ra) < 0) return hi;
+	while (lo < hi) {
+		int64_t mid = lo + ((hi - lo) >> 1);
+		bgt_set_start(rb, mid);
+		if (bgt_read_core0(rb) < 0 || bcfcmp(rb->b0, ra->b0) >= 0) hi = mid;
+		else lo = mid + 1;
+	}
+	return lo;
+}
+
+static bgt_t *cmp_reader_init(const bgt_file_t *f, const char *reg, int n, char *const*names)
+{
+	bgt_t *bgt;
+	bgt = bgt_reader_init(f);
+	if (reg && bgt_set_region(bgt, reg) < 0) {
+		fprintf(stderr, "[E::%s] failed to set region. Region format error?\n", __func__);
+		bgt_reader_destroy(bgt);
+		return 0;
+	}
+	bgt_add_group_core(bgt, n, names, 0);
+	bgt_prepare(bgt);
+	return bgt;
+}
+
+static khash_t(s2i) *cmp_out_hash(const bgt_t *bgt)
+{
+	int i, absent;
+	khash_t(s2i) *h;
+	h = kh_init(s2i);
+	for (i = 0; i < bgt->n_out; ++i) {
+		khint_t k = kh_put(s2i, h, bgt->f->f->rows[bgt->out[i]].name, &absent);
+		kh_val(h, k) = i;
+	}
+	return h;
+}
+
+static int cmp_ctg_compatible(const bcf_hdr_t *h1, const bcf_hdr_t *h2)
+{
+	int i, n = h1->n[BCF_DT_CTG] < h2->n[BCF_DT_CTG]? h1->n[BCF_DT_CTG] : h2->n[BCF_DT_CTG];
+	for (i = 0; i < n; ++i)
+		if (strcmp(h1->id[BCF_DT_CTG][i].key, h2->id[BCF_DT_CTG][i].key) != 0) return 0;
+	return 1;
+}
+
+int main_compare(int argc, char *argv[])
+{
+	int i, c, n_threads = 1, per_site = 0, n_pairs = 0, n_lines = 0, m_lines = 0, *ia, *ib;
+	char *reg = 0, *gexpr = 0, *fn_pair = 0, **lines = 0, **sa, **sb;
+	bgt_file_t *f[2];
+	bgt_t *r[2], *tmp;
+	khash_t(s2i) *hp = 0, *hb, *ho[2];
+	khint_t k;
+	cmp_t cmp;
+	kstring_t s = {0,0,0};
+
+	while ((c = getopt(argc, argv, "r:s:p:S@:")) >= 0) {
+		if (c == 'r') reg = optarg;
+		else if (c == 's') gexpr = optarg;
+		else if (c == 'p') fn_pair = optarg;
+		else if (c == 'S') per_site = 1;
+		else if (c == '@') n_threads = atoi(optarg);
+	}
+	if (argc - optind < 2) {
+		fprintf(stderr, "Usage: bgt compare [options] <A-prefix> <B-prefix>\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -s EXPR      samples list in A (see 'bgt view') [all]\n");
+		fprintf(stderr, "  -p FILE      TAB-delimited sample names in A and in B [same names]\n");
+		fprintf(stderr, "  -r STR       region [all]\n");
+		fprintf(stderr, "  -S           output per-site instead of per-sample concordance\n");
+		fprintf(stderr, "  -@ INT       number of threads; ignored with -r, -S or sharded BGTs [1]\n");
+		fprintf(stderr, "Output: a '#sites' line with #sites in both, in A only and in B only, followed\n");
+		fprintf(stderr, "  by one line per sample pair: names in A and B, #sites called in both,\n");
+		fprintf(stderr, "  #concordant, non-reference discordance and the 4x4 matrix of genotypes in A\n");
+		fprintf(stderr, "  (0, 1 or 2 ALT alleles, or missing) by those in B. With -S, the two names are\n");
+		fprintf(stderr, "  replaced with CHROM, POS, REF, ALT and where the allele is present (AB/A/B).\n");
+		return 1;
+	}
+
+	for (i = 0; i < 2; ++i) {
+		if ((f[i] = bgt_open(argv[optind+i])) == 0) {
+			fprintf(stderr, "[E::%s] failed to open BGT with prefix '%s'\n", __func__, argv[optind+i]);
+			return 1;
+		}
+	}
+	if (!cmp_ctg_compatible(f[0]->h0, f[1]->h0)) {
+		fprintf(stderr, "[E::%s] the two BGTs have different contig dictionaries\n", __func__);
+		return 1;
+	}
+
+	// pair samples in A with samples in B
+	if (fn_pair) {
+		htsFile *fp;
+		kstring_t str = {0,0,0};
+		if ((fp = hts_open(fn_pair, "r", 0)) == 0) {
+			fprintf(stderr, "[E::%s] failed to read sample pairs from '%s'\n", __func__, fn_pair);
+			return 1;
+		}
+		hp = kh_init(s2i);
+		while (hts_getline(fp, KS_SEP_LINE, &str) >= 0) {
+			char *p, *q;
+			int l, absent;
+			for (p = str.s; *p && isspace(*p); ++p);
+			for (q = p; *q && !isspace(*q); ++q);
+			if (*q == 0) continue;
+			for (*q++ = 0; *q && isspace(*q); ++q);
+			if (*q == 0) continue;
+			k = kh_put(s2i, hp, p, &absent);
+			if (!absent) continue;
+			if (n_lines == m_lines) {
+				m_lines = m_lines? m_lines<<1 : 16;
+				lines = (char**)realloc(lines, m_lines * sizeof(char*));
+			}
+			for (l = 0; q[l] && !isspace(q[l]); ++l);
+			q[l] = 0;
+			lines[n_lines] = (char*)malloc(q - p + l + 1); // the name in B follows the NULL-terminated name in A
+			memcpy(lines[n_lines], p, q - p + l + 1);
+			kh_key(hp, k) = lines[n_lines];
+			kh_val(hp, k) = q - p;
+			++n_lines;
+		}
+		free(str.s);
+		hts_close(fp);
+	}
+	hb = kh_init(s2i);
+	for (i = 0; i < f[1]->f->n_rows; ++i) {
+		int absent;
+		kh_put(s2i, hb, f[1]->f->rows[i].name, &absent);
+	}
+	tmp = bgt_reader_init(f[0]);
+	if (gexpr && bgt_add_group(tmp, gexpr) < 0) {
+		fprintf(stderr, "[E::%s] failed to add sample group '%s'.\n", __func__, gexpr);
+		return 1;
+	}
+	bgt_prepare(tmp);
+	sa = (char**)malloc(tmp->n_out * sizeof(char*));
+	sb = (char**)malloc(tmp->n_out * sizeof(char*));
+	for (i = 0; i < tmp->n_out; ++i) {
+		char *name = f[0]->f->rows[tmp->out[i]].name, *partner = name;
+		if (hp) {
+			if ((k = kh_get(s2i, hp, name)) == kh_end(hp)) continue;
+			partner = (char*)kh_key(hp, k) + kh_val(hp, k);
+		}
+		if (kh_get(s2i, hb, partner) == kh_end(hb)) continue;
+		sa[n_pairs] = name, sb[n_pairs++] = partner;
+	}
+	bgt_reader_destroy(tmp);
+	kh_destroy(s2i, hb);
+
+	if ((r[0] = cmp_reader_init(f[0], reg, n_pairs, sa)) == 0 || (r[1] = cmp_reader_init(f[1], reg, n_pairs, sb)) == 0)
+		return 1;
+	ho[0] = cmp_out_hash(r[0]), ho[1] = cmp_out_hash(r[1]);
+	ia = (int*)malloc((n_pairs + 1) * sizeof(int));
+	ib = (int*)malloc((n_pairs + 1) * sizeof(int));
+	for (i = c = 0; i < n_pairs; ++i) { // drop samples filtered out by bgt_prepare(), e.g. by the missing genotype status
+		khint_t ka = kh_get(s2i, ho[0], sa[i]), kb = kh_get(s2i, ho[1], sb[i]);
+		if (ka == kh_end(ho[0]) || kb == kh_end(ho[1])) continue;
+		sa[c] = sa[i], sb[c] = sb[i], ia[c] = kh_val(ho[0], ka), ib[c++] = kh_val(ho[1], kb);
+	}
+	n_pairs = c;
+	kh_destroy(s2i, ho[0]); kh_destroy(s2i, ho[1]);
+	if (n_pairs == 0) {
+		fprintf(stderr, "[E::%s] no samples to compare\n", __func__);
+		return 1;
+	}
+
+	cmp_init(&cmp, n_pairs, ia, ib);
+	if (n_threads > 1 && !per_site && reg == 0 && f[0]->n_shards == 0 && f[1]->n_shards == 0 && bgt_get_n(r[0]) > 0) {
+		int64_t n = bgt_get_n(r[0]), step;
+		int n_chunks, shift = pbf_get_shift(r[0]->pb);
+		cmp_shared_t sh;
+		step = bgt_chunk_size(n, shift, n_threads); // chunks of A; B is cut at the matching rows
+		n_chunks = (n + step - 1) / step;
+		sh.beg = (int64_t(*)[2])calloc(n_chunks + 1, sizeof(*sh.beg));
+		for (i = 1; i <= n_chunks; ++i) {
+			sh.beg[i][0] = i < n_chunks? i * step : n;
+			sh.beg[i][1] = i < n_chunks? cmp_lower_bound(r[0], r[1], sh.beg[i][0], sh.beg[i-1][1], bgt_get_n(r[1])) : bgt_get_n(r[1]);
+		}
+		sh.r = (bgt_t*(*)[2])calloc(n_threads, sizeof(*sh.r));
+		sh.c = (cmp_t*)calloc(n_threads, sizeof(cmp_t));
+		sh.r[0][0] = r[0], sh.r[0][1] = r[1];
+		for (i = 1; i < n_threads; ++i) {
+			sh.r[i][0] = cmp_reader_init(f[0], 0, n_pairs, sa);
+			sh.r[i][1] = cmp_reader_init(f[1], 0, n_pairs, sb);
+		}
+		for (i = 0; i < n_threads; ++i)
+			cmp_init(&sh.c[i], n_pairs, ia, ib);
+		bgt_chunks(n, shift, n_threads, cmp_chunk, &sh);
+		for (i = 0; i < n_threads; ++i) {
+			cmp_flush(&sh.c[i]);
+			cmp_merge(&cmp, &sh.c[i]);
+			bp_destroy(&sh.c[i].bp); free(sh.c[i].cnt);
+			if (i > 0) bgt_reader_destroy(sh.r[i][0]), bgt_reader_destroy(sh.r[i][1]);
+		}
+		free(sh.c); free(sh.r); free(sh.beg);
+	} else {
+		cmp_read(r[0], r[1], &cmp, per_site);
+		cmp_flush(&cmp);
+	}
+
+	if (!per_site) {
+		printf("#sites\t%lld\t%lld\t%lld\n", (long long)cmp.n_site[0], (long long)cmp.n_site[1], (long long)cmp.n_site[2]);
+		for (i = 0; i < n_pairs; ++i) {
+			s.l = 0;
+			kputs(sa[i], &s); kputc('\t', &s);
+			kputs(sb[i], &s); kputc('\t', &s);
+			cmp_format(cmp.cnt[i], &s);
+			puts(s.s);
+		}
+	}
+
+	free(s.s); bp_destroy(&cmp.bp); free(cmp.cnt);
+	free(ia); free(ib); free(sa); free(sb);
+	if (hp) kh_destroy(s2i, hp);
+	for (i = 0; i < n_lines; ++i) free(lines[i]);
+	free(lines);
+	bgt_reader_destroy(r[0]); bgt_reader_destroy(r[1]);
+	bgt_close(f[0]); bgt_close(f[1]);
+	return 0;
+}
@@ -0,0 +1,282 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include "bgt.h"
+#include "kstring.h"
+
+/* M3VCF-style export. Sites are cut into blocks, each represented by its unique
+ * haplotypes: a block line maps every haplotype to one of REPS unique
+ * haplotypes, and each variant line lists the alleles of these REPS haplotypes.
+ * Consecutive blocks on a contig share one site. Block lines are tagged with
+ * "B<k>" and variant lines with "B<k>.M<i>", the i-th marker of block k. The
+ * body is written to a temporary file first, as the header gives the number of
+ * blocks and markers.
+ *
+ * Unique haplotypes are not found by hashing. We run the PBWT from the first
+ * site of the block with divergence tracking, such that identical haplotypes
+ * are adjacent in the prefix array S and only the first of them has D[j] past
+ * the block start. A block is extended while the estimated output size per
+ * site, REPS + 2*#haplotypes/length, keeps improving; it is cut at the best
+ * length once it has grown by half that length (at least 4 sites) without
+ * improvement, and the sites after the cut are fed to the PBWT again. */
+
+typedef struct {
+	int n_hap, max_len, n_bytes; // n_bytes: bytes per packed site
+	int n, n_fed; // #sites buffered from the block start, and #sites fed to the PBWT
+	int rid, ovl; // ovl: the first buffered site is the last site of the previous block
+	int32_t s; // PBWT row of the first buffered site
+	int64_t i_marker, n_blocks, n_markers, n_missing;
+	int best_len;
+	double best_cost;
+	int32_t *buf, *S0, *D0, *S, *D, *Sb, *Db; // Sb and Db: the PBWT after $best_len sites
+	int32_t *cls, *rep; // unique haplotype of each haplotype; a representative of each unique haplotype
+	uint8_t *col, *a; // col: 2-bit packed sites; a: one unpacked site
+	int *pos;
+	kstring_t *var; // CHROM, POS, ID, REF and ALT of each buffered site
+	const bcf_hdr_t *h;
+	FILE *fp; // temporary file for the body
+	kstring_t out;
+} m3_t;
+
+static m3_t *m3_init(int n_hap, int max_len, const bcf_hdr_t *h)
+{
+	m3_t *m;
+	m = (m3_t*)calloc(1, sizeof(m3_t));
+	m->n_hap = n_hap, m->max_len = max_len, m->h = h, m->rid = -1;
+	m->n_bytes = (n_hap + 3) >> 2;
+	m->S0 = m->buf = (int32_t*)malloc((size_t)n_hap * 4 * 8);
+	m->D0 = m->S0 + n_hap, m->S = m->D0 + n_hap, m->D = m->S + n_hap;
+	m->Sb = m->D + n_hap, m->Db = m->Sb + n_hap, m->cls = m->Db + n_hap, m->rep = m->cls + n_hap;
+	m->col = (uint8_t*)calloc((size_t)(max_len + 1) * m->n_bytes, 1);
+	m->a = (uint8_t*)malloc(n_hap);
+	m->pos = (int*)calloc(max_len + 1, sizeof(int));
+	m->var = (kstring_t*)calloc(max_len + 1, sizeof(kstring_t));
+	return m;
+}
+
+static void m3_destroy(m3_t *m)
+{
+	int i;
+	for (i = 0; i <= m->max_len; ++i) free(m->var[i].s);
+	free(m->var); free(m->pos); free(m->a); free(m->col); free(m->buf); free(m->out.s);
+	free(m);
+}
+
+static inline int m3_get(const m3_t *m, int i, int j) { return m->col[(size_t)i * m->n_bytes + (j>>2)] >> ((j&3)<<1) & 3; }
+
+static void m3_unpack(m3_t *m, int i)
+{
+	int j;
+	const uint8_t *p = &m->col[(size_t)i * m->n_bytes];
+	for (j = 0; j + 4 <= m->n_hap; j += 4, ++p)
+		m->a[j] = *p&3, m->a[j+1] = *p>>2&3, m->a[j+2] = *p>>4&3, m->a[j+3] = *p>>6;
+	for (; j < m->n_hap; ++j)
+		m->a[j] = m3_get(m, i, j);
+}
+
+// feed the next buffered site to the PBWT; return 1 if the block should be cut
+static int m3_feed(m3_t *m)
+{
+	int32_t j, u, *t, i = m->n_fed++, k = m->s + i;
+	double cost;
+	if (i == 0) {
+		for (j = 0; j < m->n_hap; ++j) m->S0[j] = j, m->D0[j] = m->s;
+		m->best_len = 0;
+	}
+	m3_unpack(m, i);
+	pbc_div_core(m->n_hap, k, m->S0, m->D0, m->a, m->S, m->D);
+	t = m->S0, m->S0 = m->S, m->S = t;
+	t = m->D0, m->D0 = m->D, m->D = t;
+	for (j = u = 0; j < m->n_hap; ++j)
+		if (j == 0 || m->D0[j] > m->s) ++u;
+	cost = u + 2. * m->n_hap / (i + 1);
+	if (m->best_len == 0 || cost < m->best_cost) {
+		m->best_len = i + 1, m->best_cost = cost;
+		memcpy(m->Sb, m->S0, m->n_hap * 4);
+		memcpy(m->Db, m->D0, m->n_hap * 4);
+	}
+	return (i + 1 >= m->max_len || i + 1 >= m->best_len + (m->best_len > 8? m->best_len>>1 : 4));
+}
+
+static void m3_print_block(m3_t *m)
+{
+	int i, j, u, len = m->best_len;
+	const char *chr = m->h->id[BCF_DT_CTG][m->rid].key;
+	kstring_t *s = &m->out;
+	for (j = u = 0; j < m->n_hap; ++j) {
+		if (j == 0 || m->Db[j] > m->s) m->rep[u++] = m->Sb[j];
+		m->cls[m->Sb[j]] = u - 1;
+	}
+	s->l = 0;
+	ksprintf(s, "%s\t%d-%d\t<BLOCK:%lld-%lld>\t.\t.\t.\t.\tB%lld;VARIANTS=%d;REPS=%d", chr, m->pos[0], m->pos[len-1],
+			(long long)m->i_marker, (long long)(m->i_marker + len - 1), (long long)m->n_blocks, len, u);
+	for (j = 0; j < m->n_hap; j += 2) {
+		kputc('\t', s); kputw(m->cls[j], s);
+		kputc('|', s); kputw(m->cls[j+1], s);
+	}
+	kputc('\n', s);
+	fwrite(s->s, 1, s->l, m->fp);
+	for (i = 0; i < len; ++i) {
+		s->l = 0;
+		kputsn(m->var[i].s, m->var[i].l, s);
+		ksprintf(s, "\t.\t.\tB%lld.M%d\t", (long long)m->n_blocks, i);
+		for (j = 0; j < u; ++j)
+			kputc("01.0"[m3_get(m, i, m->rep[j])], s);
+		kputc('\n', s);
+		fwrite(s->s, 1, s->l, m->fp);
+	}
+	++m->n_blocks;
+	m->n_markers += len - m->ovl;
+}
+
+// write the block of the best length and keep the remaining sites; the last site of the block is kept with $ovl
+static void m3_cut(m3_t *m, int ovl)
+{
+	int i, d = m->best_len - ovl;
+	m3_print_block(m);
+	if (d > 0) { // rotate, such that kstring_t buffers are reused
+		kstring_t *t;
+		t = (kstring_t*)alloca(d * sizeof(kstring_t));
+		memcpy(t, m->var, d * sizeof(kstring_t));
+		memmove(m->var, m->var + d, (m->n - d) * sizeof(kstring_t));
+		memcpy(m->var + m->n - d, t, d * sizeof(kstring_t));
+	}
+	for (i = d; i < m->n; ++i) m->pos[i-d] = m->pos[i];
+	memmove(m->col, m->col + (size_t)d * m->n_bytes, (size_t)(m->n - d) * m->n_bytes);
+	m->n -= d, m->n_fed = 0, m->s += d, m->i_marker += d, m->ovl = ovl;
+}
+
+static void m3_process(m3_t *m)
+{
+	while (m->n_fed < m->n)
+		if (m3_feed(m)) m3_cut(m, 1);
+}
+
+// write all buffered sites, at the end of a contig
+static void m3_flush(m3_t *m)
+{
+	while (m->n > m->ovl) {
+		m3_process(m);
+		if (m->best_len == m->n) {
+			m3_cut(m, 0);
+			break;
+		} else m3_cut(m, 1);
+	}
+	m->i_marker += m->n; // the shared site has been counted once
+	m->n = m->n_fed = m->ovl = 0;
+}
+
+static void m3_add(m3_t *m, const bcf1_t *b, const uint8_t *const*a)
+{
+	int j, l_ref, l_alt;
+	char *ref, *alt;
+	uint8_t *p;
+	kstring_t *s;
+	if (b->rid != m->rid) {
+		if (m->rid >= 0) m3_flush(m);
+		m->rid = b->rid;
+	}
+	p = &m->col[(size_t)m->n * m->n_bytes];
+	memset(p, 0, m->n_bytes);
+	for (j = 0; j < m->n_hap; ++j) {
+		int c = a[1][j]<<1 | a[0][j]; // <M> is written as REF, and missing as '.'
+		if (c == 2) ++m->n_missing;
+		p[j>>2] |= (c == 3? 0 : c) << ((j&3)<<1);
+	}
+	bcf_get_ref_alt1(b, &l_ref, &ref, &l_alt, &alt);
+	s = &m->var[m->n];
+	s->l = 0;
+	kputs(m->h->id[BCF_DT_CTG][b->rid].key, s); kputc('\t', s);
+	kputw(b->pos + 1, s); kputs("\t.\t", s);
+	kputsn(ref, l_ref, s); kputc('\t', s);
+	kputsn(alt, l_alt, s);
+	m->pos[m->n++] = b->pos + 1;
+	m3_process(m);
+}
+
+int main_export(int argc, char *argv[])
+{
+	int i, c, max_len = 1000;
+	char buf[0x10000], *reg = 0, *site_flt = 0, *gexpr = 0, *fmt = "m3vcf";
+	bgt_file_t *f;
+	bgtm_t *bm;
+	bcf1_t *b;
+	m3_t *m;
+
+	while ((c = getopt(argc, argv, "r:f:s:O:b:")) >= 0) {
+		if (c == 'r') reg = optarg;
+		else if (c == 'f') site_flt = optarg;
+		else if (c == 's') gexpr = optarg;
+		else if (c == 'O') fmt = optarg;
+		else if (c == 'b') max_len = atoi(optarg);
+	}
+	if (argc - optind < 1) {
+		fprintf(stderr, "Usage: bgt export [options] <bgt-prefix>\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -O STR       output format; only 'm3vcf' for now [%s]\n", fmt);
+		fprintf(stderr, "  -s EXPR      samples list (see 'bgt view') [all]\n");
+		fprintf(stderr, "  -r STR       region [all]\n");
+		fprintf(stderr, "  -f STR       frequency filters []\n");
+		fprintf(stderr, "  -b INT       max number of sites per block [%d]\n", max_len);
+		return 1;
+	}
+	if (strcmp(fmt, "m3vcf") != 0) {
+		fprintf(stderr, "[E::%s] unsupported output format '%s'\n", __func__, fmt);
+		return 1;
+	}
+	if (max_len < 2) max_len = 2;
+
+	if ((f = bgt_open(argv[optind])) == 0) {
+		fprintf(stderr, "[E::%s] failed to open BGT with prefix '%s'\n", __func__, argv[optind]);
+		return 1;
+	}
+	bm = bgtm_reader_init(1, &f);
+	bgtm_set_flag(bm, BGT_F_NO_GT);
+	if (site_flt && bgtm_set_flt_site(bm, site_flt) != 0) {
+		fprintf(stderr, "[E::%s] failed to set frequency filters. Syntax error?\n", __func__);
+		return 1;
+	}
+	if (reg && bgtm_set_region(bm, reg) < 0) {
+		fprintf(stderr, "[E::%s] failed to set region. Region format error?\n", __func__);
+		return 1;
+	}
+	if (gexpr && bgtm_add_group(bm, gexpr) < 0) {
+		fprintf(stderr, "[E::%s] failed to add sample group '%s'.\n", __func__, gexpr);
+		return 1;
+	}
+	bgtm_prepare(bm);
+
+	m = m3_init(bm->n_out * 2, max_len, bm->h_out);
+	if ((m->fp = tmpfile()) == 0) {
+		fprintf(stderr, "[E::%s] failed to create a temporary file\n", __func__);
+		return 1;
+	}
+	b = bcf_init1();
+	while (bgtm_read(bm, b) >= 0)
+		m3_add(m, b, (const uint8_t*const*)bm->a);
+	if (m->rid >= 0) m3_flush(m);
+	bcf_destroy1(b);
+
+	printf("##fileformat=M3VCF\n##version=1.1\n##compression=block\n");
+	printf("##n_blocks=%lld\n##n_haps=%d\n##n_markers=%lld\n", (long long)m->n_blocks, bm->n_out * 2, (long long)m->n_markers);
+	fputs("#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO", stdout);
+	for (i = 0; i < bm->n_out; ++i) {
+		putchar('\t');
+		fputs(f->f->rows[(uint32_t)bm->sample_idx[i]].name, stdout);
+	}
+	putchar('\n');
+	rewind(m->fp);
+	while ((c = fread(buf, 1, sizeof(buf), m->fp)) > 0)
+		fwrite(buf, 1, c, stdout);
+	fclose(m->fp);
+	if (hts_verbose >= 3)
+		fprintf(stderr, "[M::%s] wrote %lld markers in %lld blocks\n", __func__, (long long)m->n_markers, (long long)m->n_blocks);
+	if (m->n_missing && hts_verbose >= 2)
+		fprintf(stderr, "[W::%s] %lld missing haplotype alleles are written as '.'\n", __func__, (long long)m->n_missing);
+
+	m3_destroy(m);
+	bgtm_reader_destroy(bm);
+	bgt_close(f);
+	return 0;
+}
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <zlib.h>
+#include <sys/stat.h>
 #include "fmf.h"
 #include "kseq.h"
 #include "khash.h"
@@ -159,20 +160,35 @@ struct fms_s {
 	kstream_t *ks;
 	kstring_t s;
 	gzFile fp;
+	int64_t size; // file size if uncompressed; -1 otherwise
 };
 
 fms_t *fms_open(const char *fn)
 {
 	fms_t *f;
 	gzFile fp;
+	struct stat st;
 	fp = fn && strcmp(fn, "-")? gzopen(fn, "r") : gzdopen(fileno(stdin), "r");
 	if (fp == 0) return 0;
 	f = (fms_t*)calloc(1, sizeof(fms_t));
 	f->ks = ks_init(fp);
 	f->fp = fp;
+	f->size = fn && strcmp(fn, "-") && gzdirect(fp) && stat(fn, &st) == 0? st.st_size : -1;
 	return f;
 }
 
+int64_t fms_size(const fms_t *f) { return f->size; }
+
+int fms_seek(fms_t *f, int64_t off)
+{
+	int dret;
+	if (f->size < 0 || off < 0 || off >= f->size) return -1;
+	if (gzseek(f->fp, off, SEEK_SET) < 0) return -1;
+	f->ks->begin = f->ks->end = 0, f->ks->is_eof = 0;
+	if (off > 0 && ks_getuntil(f->ks, KS_SEP_LINE, &f->s, &dret) < 0) return -1; // skip to the next line
+	return 0;
+}
+
 void fms_close(fms_t *f)
 {
 	if (f == 0) return;
@@ -182,21 +198,17 @@ void fms_close(fms_t *f)
 	free(f);
 }
 
-static int fms_read_and_test(fms_t *f, kexpr_t *ke, char **end0)
+static char *fmf_assign_core(kexpr_t *ke, char *s)
 {
-	char *p, *q, *r, *rr;
-	int i, err = 0, is_true, dret, ret;
-	ret = ks_getuntil(f->ks, KS_SEP_LINE, &f->s, &dret);
-	if (ret < 0) return ret;
-	if (f->s.l == 0) return 0;
-	if (ke) ke_unset(ke);
-	for (p = q = f->s.s, i = 0;; ++p) {
+	char *p, *q, *r, *rr, *end0 = 0;
+	int i;
+	for (p = q = s, i = 0;; ++p) {
 		if (*p == 0 || *p == '\t') {
 			int c = *p, c2;
 			*p = 0;
 			if (i == 0) { // row name
 				if (ke) ke_set_str(ke, "_ROW_", q);
-				*end0 = p;
+				end0 = p;
 			} else { // metadata
 				for (r = q; *r && *r != ':'; ++r);
 				c2 = *r; *r = 0; rr = r;
@@ -212,6 +224,19 @@ static int fms_read_and_test(fms_t *f, kexpr_t *ke, char **end0)
 			*p = c;
 		}
 	}
+	return end0;
+}
+
+void fmf_assign_line(kexpr_t *ke, char *line) { fmf_assign_core(ke, line); }
+
+static int fms_read_and_test(fms_t *f, kexpr_t *ke, char **end0)
+{
+	int err = 0, is_true, dret, ret;
+	ret = ks_getuntil(f->ks, KS_SEP_LINE, &f->s, &dret);
+	if (ret < 0) return ret;
+	if (f->s.l == 0) return 0;
+	if (ke) ke_unset(ke);
+	*end0 = fmf_assign_core(ke, f->s.s);
 	is_true = ke == 0 || !!ke_eval_int(ke, &err);
 	return (!err && is_true);
 }
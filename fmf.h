@@ -49,6 +49,9 @@ int fmf_test(const fmf_t *f, int r, kexpr_t *ke);
 fms_t *fms_open(const char *fn);
 void fms_close(fms_t *f);
 const char *fms_read(fms_t *f, kexpr_t *ke, int name_only);
+int64_t fms_size(const fms_t *f); // -1 if the file is compressed or not a regular file
+int fms_seek(fms_t *f, int64_t off); // seek to the first line starting at or after off; uncompressed only
+void fmf_assign_line(kexpr_t *ke, char *line); // set metadata of one FMF line as variables
 
 #ifdef __cplusplus
 }
@@ -76,6 +76,7 @@ htsFile *hts_open(const char *fn, const char *mode, const char *fn_aux)
 
 void hts_close(htsFile *fp)
 {
+	if (fp->idx) hts_idx_destroy(fp->idx); // index not saved
 	free(fp->fn);
 	if (!fp->is_bin) {
 		free(fp->line.s);
@@ -33,6 +33,7 @@ typedef struct {
 	kstring_t line;
 	char *fn, *fn_aux;
 	void *fp; // file pointer; actual type depending on is_bin and is_write
+	struct __hts_idx_t *idx; // index built while writing; NULL if not requested
 } htsFile;
 
 /**********************
@@ -1,26 +1,377 @@
 #include <stdlib.h>
 #include <unistd.h>
+#include <limits.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include "atomic.h"
 #include "pbwt.h"
+#include "fmf.h"
+#include "bgt.h"
+
+// first haplotype column of each block of blk_size samples
+static int32_t *import_blk_beg(int n_samples, int blk_size, int *n_blk)
+{
+	int32_t i, *beg;
+	if (blk_size <= 0 || blk_size >= n_samples) {
+		*n_blk = 1;
+		return 0;
+	}
+	*n_blk = (n_samples + blk_size - 1) / blk_size;
+	beg = (int32_t*)malloc(*n_blk * 4);
+	for (i = 0; i < *n_blk; ++i) beg[i] = i * blk_size * 2;
+	return beg;
+}
+
+/*********************************
+ * External sorting during import *
+ *********************************/
+
+/* With -s, atoms are buffered as compact records and written as sorted runs
+ * to temporary files once the buffer exceeds the memory limit. The runs are
+ * then merged with a heap, at most SRT_MAX_OPEN at a time; with more runs,
+ * consecutive groups are first merged into longer runs. A record is a
+ * srt_hdr_t, followed by "REF\0ALT\0" and genotypes packed four per byte. */
+
+#define SRT_MAX_OPEN 64 // max number of runs open during a merge
+
+typedef struct {
+	int32_t rid, pos, rlen, l_ref; // l_ref: length of "REF\0ALT", i.e. bcf_atom_t::ref.l
+	int32_t has_multi;
+} srt_hdr_t;
+
+typedef struct {
+	int32_t rid, pos, rlen;
+	const char *alt;
+	uint64_t off; // offset of the record in srt_t::buf
+} srt_key_t;
+
+typedef struct {
+	const char *prefix;
+	int n_gt, n_runs, first; // runs [first,n_runs) are on disk
+	int64_t max_mem;
+	kstring_t buf;
+	int64_t n, m;
+	srt_key_t *key;
+} srt_t;
+
+typedef struct {
+	int i; // run index; ties are broken by it to keep the input order
+	bcf_atom_t a;
+} srt_head_t;
+
+static inline int srt_key_cmp(const srt_key_t *a, const srt_key_t *b)
+{
+	int ret;
+	if (a->rid != b->rid) return a->rid - b->rid;
+	if (a->pos != b->pos) return a->pos - b->pos;
+	if (a->rlen != b->rlen) return a->rlen - b->rlen;
+	if ((ret = strcmp(a->alt, b->alt)) != 0) return ret;
+	return a->off < b->off? -1 : a->off > b->off;
+}
+
+static inline int srt_head_cmp(const srt_head_t *a, const srt_head_t *b)
+{
+	int ret = bcf_atom_cmp(&a->a, &b->a);
+	return ret? ret : a->i - b->i;
+}
+
+#include "ksort.h"
+#define srt_key_lt(a, b) (srt_key_cmp(&(a), &(b)) < 0)
+KSORT_INIT(srt, srt_key_t, srt_key_lt)
+
+// restore the min-heap property from the root
+static void srt_heap_down(int n, srt_head_t *heap, int i)
+{
+	srt_head_t t = heap[i];
+	int k;
+	while ((k = (i << 1) + 1) < n) {
+		if (k + 1 < n && srt_head_cmp(&heap[k+1], &heap[k]) < 0) ++k;
+		if (srt_head_cmp(&t, &heap[k]) <= 0) break;
+		heap[i] = heap[k], i = k;
+	}
+	heap[i] = t;
+}
+
+static srt_t *srt_init(const char *prefix, int n_gt, int64_t max_mem)
+{
+	srt_t *s;
+	s = (srt_t*)calloc(1, sizeof(srt_t));
+	s->prefix = prefix, s->n_gt = n_gt, s->max_mem = max_mem;
+	return s;
+}
+
+static void srt_run_name(const srt_t *s, int i, kstring_t *fn)
+{
+	fn->l = 0;
+	ksprintf(fn, "%s.sort%.4d.tmp", s->prefix, i);
+}
+
+// decode a record into $a; $p points to srt_hdr_t
+static void srt_dec(const uint8_t *p, int n_gt, bcf_atom_t *a)
+{
+	srt_hdr_t h;
+	int i;
+	memcpy(&h, p, sizeof(srt_hdr_t));
+	p += sizeof(srt_hdr_t);
+	a->rid = h.rid, a->pos = h.pos, a->rlen = h.rlen, a->has_multi = h.has_multi;
+	a->ref.l = 0;
+	kputsn((const char*)p, h.l_ref, &a->ref);
+	a->alt = a->ref.s + strlen(a->ref.s) + 1;
+	p += h.l_ref + 1;
+	a->n_gt = n_gt;
+	a->gt = (uint8_t*)realloc(a->gt, n_gt);
+	for (i = 0; i < n_gt; ++i)
+		a->gt[i] = p[i>>2] >> ((i&3)<<1) & 3;
+}
+
+// remove the temporary files left on disk and exit
+static void srt_abort(srt_t *s)
+{
+	kstring_t fn = {0,0,0};
+	int i;
+	for (i = s->first; i < s->n_runs; ++i) {
+		srt_run_name(s, i, &fn);
+		remove(fn.s);
+	}
+	exit(1);
+}
+
+// append a record of $a to $buf
+static void srt_enc(const bcf_atom_t *a, int n_gt, kstring_t *buf)
+{
+	srt_hdr_t h;
+	int i, l_gt = (n_gt + 3) >> 2;
+	uint8_t *p;
+	h.rid = a->rid, h.pos = a->pos, h.rlen = a->rlen, h.l_ref = a->ref.l, h.has_multi = a->has_multi;
+	kputsn((const char*)&h, sizeof(srt_hdr_t), buf);
+	kputsn(a->ref.s, a->ref.l, buf);
+	kputc(0, buf);
+	ks_resize(buf, buf->l + l_gt + 1);
+	p = (uint8_t*)buf->s + buf->l;
+	memset(p, 0, l_gt);
+	for (i = 0; i < a->n_gt; ++i)
+		p[i>>2] |= (a->gt[i]&3) << ((i&3)<<1);
+	buf->l += l_gt;
+}
+
+static void srt_spill(srt_t *s)
+{
+	kstring_t fn = {0,0,0};
+	int64_t i;
+	FILE *fp;
+	if (s->n == 0) return;
+	for (i = 0; i < s->n; ++i) { // the buffer is not moved any more, so ALT can be located
+		const uint8_t *p = (const uint8_t*)s->buf.s + s->key[i].off + sizeof(srt_hdr_t);
+		s->key[i].alt = (const char*)p + strlen((const char*)p) + 1;
+	}
+	ks_introsort(srt, s->n, s->key);
+	srt_run_name(s, s->n_runs, &fn);
+	if ((fp = fopen(fn.s, "wb")) == 0) {
+		fprintf(stderr, "[E::%s] failed to create temporary file '%s'\n", __func__, fn.s);
+		srt_abort(s);
+	}
+	for (i = 0; i < s->n; ++i) {
+		const uint8_t *p = (const uint8_t*)s->buf.s + s->key[i].off;
+		srt_hdr_t h;
+		memcpy(&h, p, sizeof(srt_hdr_t));
+		fwrite(p, 1, sizeof(srt_hdr_t) + h.l_ref + 1 + ((s->n_gt + 3) >> 2), fp);
+	}
+	++s->n_runs; // removed by srt_abort() from now on
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "[E::%s] failed to write temporary file '%s'\n", __func__, fn.s);
+		srt_abort(s);
+	}
+	if (hts_verbose >= 3)
+		fprintf(stderr, "[M::%s] wrote %lld sorted atoms to '%s'\n", __func__, (long long)s->n, fn.s);
+	free(fn.s);
+	s->n = 0, s->buf.l = 0;
+}
+
+static void srt_add(srt_t *s, const bcf_atom_t *a)
+{
+	if (s->n == s->m) {
+		s->m = s->m? s->m<<1 : 1024;
+		s->key = (srt_key_t*)realloc(s->key, s->m * sizeof(srt_key_t));
+	}
+	s->key[s->n].rid = a->rid, s->key[s->n].pos = a->pos, s->key[s->n].rlen = a->rlen;
+	s->key[s->n++].off = s->buf.l;
+	srt_enc(a, s->n_gt, &s->buf);
+	if ((int64_t)s->buf.l + s->n * (int64_t)sizeof(srt_key_t) >= s->max_mem)
+		srt_spill(s);
+}
+
+// read the next record of a run into $h->a; return -1 at the end
+static int srt_read1(FILE *fp, int n_gt, kstring_t *tmp, srt_head_t *h)
+{
+	srt_hdr_t x;
+	int l;
+	if (fread(&x, sizeof(srt_hdr_t), 1, fp) != 1) return -1;
+	l = x.l_ref + 1 + ((n_gt + 3) >> 2);
+	tmp->l = 0;
+	ks_resize(tmp, sizeof(srt_hdr_t) + l);
+	memcpy(tmp->s, &x, sizeof(srt_hdr_t));
+	if (fread(tmp->s + sizeof(srt_hdr_t), 1, l, fp) != (size_t)l) return -1;
+	srt_dec((const uint8_t*)tmp->s, n_gt, &h->a);
+	return 0;
+}
+
+typedef void (*srt_func_t)(const bcf_atom_t *a, void *data);
+
+// call $func on all atoms of runs [beg,end) in the sorted order and remove these runs
+static void srt_merge(srt_t *s, int beg, int end, srt_func_t func, void *data)
+{
+	FILE **fp;
+	srt_head_t *heap;
+	kstring_t tmp = {0,0,0};
+	int i, n = end - beg, n_heap = 0;
+	fp = (FILE**)calloc(n, sizeof(FILE*));
+	heap = (srt_head_t*)calloc(n, sizeof(srt_head_t));
+	for (i = 0; i < n; ++i) {
+		srt_run_name(s, beg + i, &tmp);
+		if ((fp[i] = fopen(tmp.s, "rb")) == 0) {
+			fprintf(stderr, "[E::%s] failed to open temporary file '%s'\n", __func__, tmp.s);
+			srt_abort(s);
+		}
+		heap[n_heap].i = i;
+		if (srt_read1(fp[i], s->n_gt, &tmp, &heap[n_heap]) == 0) ++n_heap;
+	}
+	for (i = n_heap / 2 - 1; i >= 0; --i)
+		srt_heap_down(n_heap, heap, i);
+	while (n_heap > 0) {
+		func(&heap->a, data);
+		if (srt_read1(fp[heap->i], s->n_gt, &tmp, heap) < 0) { // the run is finished
+			srt_head_t t = heap[0];
+			heap[0] = heap[n_heap-1], heap[n_heap-1] = t;
+			--n_heap;
+		}
+		srt_heap_down(n_heap, heap, 0);
+	}
+	for (i = 0; i < n; ++i) {
+		fclose(fp[i]);
+		srt_run_name(s, beg + i, &tmp);
+		remove(tmp.s);
+		free(heap[i].a.ref.s); free(heap[i].a.gt);
+	}
+	free(fp); free(heap); free(tmp.s);
+}
+
+typedef struct {
+	int n_gt;
+	FILE *fp;
+	kstring_t buf;
+} srt_writer_t;
+
+static void srt_write1(const bcf_atom_t *a, void *data)
+{
+	srt_writer_t *w = (srt_writer_t*)data;
+	w->buf.l = 0;
+	srt_enc(a, w->n_gt, &w->buf);
+	fwrite(w->buf.s, 1, w->buf.l, w->fp);
+}
+
+// merge consecutive groups of SRT_MAX_OPEN runs into new runs, keeping their order for ties
+static void srt_merge_pass(srt_t *s)
+{
+	srt_writer_t w;
+	kstring_t fn = {0,0,0};
+	int beg, end = s->n_runs, n_in = s->n_runs - s->first;
+	memset(&w, 0, sizeof(srt_writer_t));
+	w.n_gt = s->n_gt;
+	for (beg = s->first; beg < end; beg += SRT_MAX_OPEN) {
+		srt_run_name(s, s->n_runs, &fn);
+		if ((w.fp = fopen(fn.s, "wb")) == 0) {
+			fprintf(stderr, "[E::%s] failed to create temporary file '%s'\n", __func__, fn.s);
+			srt_abort(s);
+		}
+		++s->n_runs;
+		srt_merge(s, beg, beg + SRT_MAX_OPEN < end? beg + SRT_MAX_OPEN : end, srt_write1, &w);
+		s->first = beg + SRT_MAX_OPEN < end? beg + SRT_MAX_OPEN : end;
+		if (fclose(w.fp) != 0) {
+			fprintf(stderr, "[E::%s] failed to write temporary file '%s'\n", __func__, fn.s);
+			srt_abort(s);
+		}
+	}
+	if (hts_verbose >= 3)
+		fprintf(stderr, "[M::%s] merged %d runs into %d\n", __func__, n_in, s->n_runs - end);
+	free(fn.s); free(w.buf.s);
+}
+
+// call $func on all atoms in the sorted order and remove the temporary files
+static void srt_finish(srt_t *s, srt_func_t func, void *data)
+{
+	int64_t i;
+	if (s->n_runs == 0) { // everything fits in memory
+		bcf_atom_t a;
+		memset(&a, 0, sizeof(bcf_atom_t));
+		for (i = 0; i < s->n; ++i) {
+			const uint8_t *p = (const uint8_t*)s->buf.s + s->key[i].off + sizeof(srt_hdr_t);
+			s->key[i].alt = (const char*)p + strlen((const char*)p) + 1;
+		}
+		ks_introsort(srt, s->n, s->key);
+		for (i = 0; i < s->n; ++i) {
+			srt_dec((const uint8_t*)s->buf.s + s->key[i].off, s->n_gt, &a);
+			func(&a, data);
+		}
+		free(a.ref.s); free(a.gt);
+	} else {
+		srt_spill(s);
+		free(s->buf.s); free(s->key);
+		s->buf.s = 0, s->key = 0, s->buf.m = s->m = 0;
+		while (s->n_runs - s->first > SRT_MAX_OPEN)
+			srt_merge_pass(s);
+		srt_merge(s, s->first, s->n_runs, func, data);
+	}
+	free(s->buf.s); free(s->key); free(s);
+}
+
+typedef struct {
+	bcf_hdr_t *h0;
+	htsFile *out;
+	pbf_t *pb, *pb1;
+	uint8_t *bits[2], *bit1;
+	bcf1_t *b;
+	int64_t n;
+} import_aux_t;
+
+// write the site to the BCF and the genotypes to the PBF
+static void import_write1(const bcf_atom_t *a, void *data)
+{
+	import_aux_t *aux = (import_aux_t*)data;
+	int32_t i, val = aux->n;
+	bcf_atom2bcf(a, aux->b, 1, -1);
+	bcf_append_info_ints(aux->h0, aux->b, "_row", 1, &val);
+	for (i = 0; i < a->n_gt; ++i) {
+		aux->bits[0][i] = a->gt[i]&1, aux->bits[1][i] = a->gt[i]>>1&1;
+		aux->bit1[i] = (a->gt[i] == 1);
+	}
+	pbf_write(aux->pb, aux->bits);
+	if (aux->pb1) pbf_write(aux->pb1, &aux->bit1);
+	bcf_subset(aux->h0, aux->b, 0, 0);
+	vcf_write1(aux->out, aux->h0, aux->b);
+	++aux->n;
+}
 
 int main_import(int argc, char *argv[])
 {
-	int i, j, c, clevel = -1, flag = 0, id_GT = -1, gen_pb1 = 0;
+	int i, j, c, clevel = -1, flag = 0, id_GT = -1, gen_pb1 = 0, n_threads = 1, blk_size = 0, n_blk, to_sort = 0;
+	int32_t *blk_beg;
+	int64_t max_mem = 1024;
 	char *fn_ref = 0, moder[8], modew[8];
 	char *prefix, *fn;
-	uint8_t *bits[2], *bit1;
-	int64_t n = 0;
-	htsFile *in, *out;
-	bcf_hdr_t *h0;
+	htsFile *in;
 	FILE *fp;
-	pbf_t *pb, *pb1 = 0;
 	bcf_atombuf_t *ab;
 	const bcf_atom_t *a;
+	import_aux_t aux;
+	srt_t *srt = 0;
 
-	while ((c = getopt(argc, argv, "1l:SFt:")) >= 0) {
+	while ((c = getopt(argc, argv, "1l:SFt:@:b:sm:")) >= 0) {
 		switch (c) {
+		case '@': n_threads = atoi(optarg); break;
+		case 'b': blk_size = atoi(optarg); break;
+		case 's': to_sort = 1; break;
+		case 'm': max_mem = atol(optarg); break;
 		case '1': gen_pb1 = 1; break;
 		case 'l': clevel = atoi(optarg); flag |= 2; break;
 		case 'S': flag |= 1; break;
@@ -29,11 +380,15 @@ int main_import(int argc, char *argv[])
 		}
 	}
 	if (argc - optind < 2) {
-		fprintf(stderr, "Usage: bgt import [options] <out-prefix> <in.bcf>|<in.vcf>|<in.vcf.gz>\n");
+		fprintf(stderr, "Usage: bgt import [options] <out-prefix> <in.bcf>|<in.vcf>|<in.vcf.gz> [...]\n");
 		fprintf(stderr, "Options:\n");
 		fprintf(stderr, "  -S           input is VCF\n");
 		fprintf(stderr, "  -t FILE      list of reference names and lengths [null]\n");
 		fprintf(stderr, "  -F           keep filtered variants\n");
+		fprintf(stderr, "  -@ INT       number of threads for parsing VCF (GT only) [%d]\n", n_threads);
+		fprintf(stderr, "  -b INT       encode haplotypes in blocks of INT samples; 0 for one block [0]\n");
+		fprintf(stderr, "  -s           sort the input, which may be unsorted or concatenated, by position\n");
+		fprintf(stderr, "  -m INT       memory in MB for sorting before spilling to temporary files [%ld]\n", (long)max_mem);
 		fprintf(stderr, "  -1           generate .pb1 file (not used for now)\n");
 		return 1;
 	}
@@ -44,15 +399,20 @@ int main_import(int argc, char *argv[])
 
 	in = hts_open(argv[optind+1], moder, fn_ref);
 	assert(in);
-	ab = bcf_atombuf_init(in, flag&4);
+	ab = bcf_atombuf_init2(in, flag&4, n_threads);
 	assert(ab->h->n[BCF_DT_SAMPLE] > 0);
-	h0 = bcf_hdr_subset(ab->h, 0, 0, 0);
-	id_GT = bcf_id2int(h0, BCF_DT_ID, "GT");
+	memset(&aux, 0, sizeof(import_aux_t));
+	aux.h0 = bcf_hdr_subset(ab->h, 0, 0, 0);
+	id_GT = bcf_id2int(aux.h0, BCF_DT_ID, "GT");
 	if (id_GT < 0) {
-		bcf_hdr_append(h0, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">");
-		id_GT = bcf_id2int(h0, BCF_DT_ID, "GT");
+		bcf_hdr_append(aux.h0, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">");
+		id_GT = bcf_id2int(aux.h0, BCF_DT_ID, "GT");
 	}
-	bcf_hdr_append(h0, "##INFO=<ID=_row,Number=1,Type=Integer,Description=\"row number\">");
+	bcf_hdr_append(aux.h0, "##INFO=<ID=_row,Number=1,Type=Integer,Description=\"row number\">");
+
+	// views materialized from an earlier import no longer apply
+	sprintf(fn, "%s.views", prefix);
+	remove(fn);
 
 	// write sample list
 	sprintf(fn, "%s.spl", prefix);
@@ -65,57 +425,451 @@ int main_import(int argc, char *argv[])
 
 	// prepare PBF to write
 	sprintf(fn, "%s.pbf", prefix);
-	pb = pbf_open_w(fn, ab->h->n[BCF_DT_SAMPLE]*2, 2, 13);
-	bits[0] = (uint8_t*)calloc(ab->h->n[BCF_DT_SAMPLE]*2, 1);
-	bits[1] = (uint8_t*)calloc(ab->h->n[BCF_DT_SAMPLE]*2, 1);
+	blk_beg = import_blk_beg(ab->h->n[BCF_DT_SAMPLE], blk_size, &n_blk);
+	aux.pb = pbf_open_wb(fn, ab->h->n[BCF_DT_SAMPLE]*2, 2, 13, n_blk, blk_beg);
+	free(blk_beg);
+	aux.bits[0] = (uint8_t*)calloc(ab->h->n[BCF_DT_SAMPLE]*2, 1);
+	aux.bits[1] = (uint8_t*)calloc(ab->h->n[BCF_DT_SAMPLE]*2, 1);
 
 	if (gen_pb1) {
 		sprintf(fn, "%s.pb1", prefix);
-		pb1 = pbf_open_w(fn, ab->h->n[BCF_DT_SAMPLE]*2, 1, 13);
+		aux.pb1 = pbf_open_w(fn, ab->h->n[BCF_DT_SAMPLE]*2, 1, 13);
 	}
-	bit1 = (uint8_t*)calloc(ab->h->n[BCF_DT_SAMPLE]*2, 1);
+	aux.bit1 = (uint8_t*)calloc(ab->h->n[BCF_DT_SAMPLE]*2, 1);
 
 	// write site-only BCF header
 	strcpy(modew, "wb");
 	if (clevel >= 0 && clevel <= 9) sprintf(modew + 2, "%d", clevel);
 	sprintf(fn, "%s.bcf", prefix);
-	out = hts_open(fn, modew, 0);
-	vcf_hdr_write(out, h0);
+	aux.out = hts_open(fn, modew, 0);
+	vcf_hdr_write(aux.out, aux.h0);
+	bcf_idx_init(aux.out, aux.h0, 14);
 
+	if (to_sort) srt = srt_init(prefix, ab->h->n[BCF_DT_SAMPLE]*2, max_mem<<20);
+	aux.b = bcf_init1();
 	for (j = optind + 1; j < argc; ++j) {
-		bcf1_t *b;
 		if (j != optind + 1) { // the first file has already been opened
 			in = hts_open(argv[j], moder, fn_ref);
-			ab = bcf_atombuf_init(in, flag&4);
+			ab = bcf_atombuf_init2(in, flag&4, n_threads);
 		}
-		b = bcf_init1();
 		while ((a = bcf_atom_read(ab)) != 0) {
-			int32_t i, val = n;
-			bcf_atom2bcf(a, b, 1, -1);
-			bcf_append_info_ints(h0, b, "_row", 1, &val);
-			for (i = 0; i < a->n_gt; ++i) {
-				bits[0][i] = a->gt[i]&1, bits[1][i] = a->gt[i]>>1&1;
-				bit1[i] = (a->gt[i] == 1);
-			}
-			pbf_write(pb, bits);
-			if (pb1) pbf_write(pb1, &bit1);
-			bcf_subset(h0, b, 0, 0);
-			vcf_write1(out, h0, b);
-			++n;
+			if (srt) srt_add(srt, a);
+			else import_write1(a, &aux);
 		}
-		bcf_destroy1(b);
 		bcf_atombuf_destroy(ab);
 		hts_close(in);
 	}
+	if (srt) srt_finish(srt, import_write1, &aux);
+	bcf_destroy1(aux.b);
+
+	bcf_idx_save(aux.out);
+	hts_close(aux.out);
+	free(aux.bit1); free(aux.bits[0]); free(aux.bits[1]);
+	if (aux.pb1) pbf_close(aux.pb1);
+	pbf_close(aux.pb);
+	bcf_hdr_destroy(aux.h0);
+	free(fn);
+	return 0;
+}
+
+// replace the value of INFO $id, which must be an integer, with $val
+static void concat_set_info_int(bcf1_t *b, int id, int32_t val, kstring_t *tmp)
+{
+	int i;
+	uint8_t *p, *end;
+	bcf_unpack(b, BCF_UN_INFO);
+	tmp->l = 0;
+	kputsn(b->shared.s, b->unpack_ptr - (uint8_t*)b->shared.s, tmp);
+	for (i = 0, p = b->unpack_ptr; i < b->n_info; ++i, p = end) {
+		bcf_info_t *f = &b->d.info[i];
+		end = f->vptr + (f->len << bcf_type_shift[f->type]);
+		if (f->key == id) {
+			bcf_enc_int1(tmp, id);
+			bcf_enc_vint(tmp, 1, &val, -1);
+		} else kputsn((char*)p, end - p, tmp);
+	}
+	b->shared.l = 0;
+	kputsn(tmp->s, tmp->l, &b->shared);
+	b->unpacked = 0;
+}
+
+// move <prefix>.*.tmp written by concat into place, or remove them on failure
+static int concat_finish(const char *prefix, int ok)
+{
+	static const char *sfx[] = { ".spl", ".pbf", ".bcf", ".bcf.csi", 0 };
+	static const char *sfx_tmp[] = { ".spl.tmp", ".pbf.tmp", ".bcf.tmp", ".bcf.tmp.csi", 0 }; // the index is named after the BCF
+	char *fn, *fn_tmp;
+	int i, ret = 0;
+	fn = (char*)malloc(strlen(prefix) + 10);
+	fn_tmp = (char*)malloc(strlen(prefix) + 14);
+	for (i = 0; sfx[i]; ++i) {
+		sprintf(fn, "%s%s", prefix, sfx[i]);
+		sprintf(fn_tmp, "%s%s", prefix, sfx_tmp[i]);
+		if (ok && ret == 0 && rename(fn_tmp, fn) < 0) {
+			fprintf(stderr, "[E::%s] failed to rename '%s' to '%s'\n", __func__, fn_tmp, fn);
+			ret = -1;
+		}
+		if (!ok || ret < 0) remove(fn_tmp);
+	}
+	if (ok && ret == 0) { // views of a BGT previously at <prefix> no longer apply
+		sprintf(fn, "%s.views", prefix);
+		remove(fn);
+	}
+	free(fn); free(fn_tmp);
+	return ret;
+}
+
+int main_concat(int argc, char *argv[])
+{
+	int i, j, c, n, clevel = -1, id_row, last_rid = -1, last_pos = -1, ret = 0;
+	char *fn, **fn_pbf, modew[8];
+	int64_t n_rows = 0;
+	kstring_t tmp = {0,0,0};
+	fmf_t *spl0 = 0;
+	htsFile *out;
+	bcf_hdr_t *h0;
+	bcf1_t *b;
+	FILE *fp;
+
+	while ((c = getopt(argc, argv, "l:")) >= 0)
+		if (c == 'l') clevel = atoi(optarg);
+	if (argc - optind < 3) {
+		fprintf(stderr, "Usage: bgt concat [-l level] <out-prefix> <in1-prefix> <in2-prefix> [...]\n");
+		fprintf(stderr, "Note: input BGTs must have identical samples and be given in the coordinate order.\n");
+		return 1;
+	}
+	n = argc - optind - 1;
+	fn = (char*)malloc(strlen(argv[optind]) + 13);
+	fn_pbf = (char**)calloc(n, sizeof(char*));
 
+	// check and copy the sample list
+	for (i = 0; i < n; ++i) {
+		const char *prefix = argv[optind + 1 + i];
+		fmf_t *spl;
+		fn_pbf[i] = (char*)malloc(strlen(prefix) + 9);
+		sprintf(fn_pbf[i], "%s.spl", prefix);
+		if ((spl = fmf_read(fn_pbf[i])) == 0) {
+			fprintf(stderr, "[E::%s] failed to read the sample list '%s'\n", __func__, fn_pbf[i]);
+			return 1;
+		}
+		if (spl0 == 0) spl0 = spl;
+		else {
+			if (spl->n_rows != spl0->n_rows) ret = -1;
+			for (j = 0; j < spl->n_rows && ret == 0; ++j)
+				if (strcmp(spl->rows[j].name, spl0->rows[j].name) != 0) ret = -1;
+			fmf_destroy(spl);
+			if (ret < 0) {
+				fprintf(stderr, "[E::%s] samples in '%s' differ from the first BGT\n", __func__, prefix);
+				return 1;
+			}
+		}
+		sprintf(fn_pbf[i], "%s.pbf", prefix);
+	}
+	// write to <out-prefix>.*.tmp; renamed by concat_finish() only if everything succeeds
+	sprintf(fn, "%s.spl.tmp", argv[optind]);
+	if ((fp = fopen(fn, "wb")) == 0) {
+		fprintf(stderr, "[E::%s] failed to create '%s'\n", __func__, fn);
+		return 1;
+	}
+	for (i = 0; i < spl0->n_rows; ++i) {
+		char *s;
+		s = fmf_write(spl0, i);
+		fputs(s, fp); fputc('\n', fp);
+		free(s);
+	}
+	fclose(fp);
+	fmf_destroy(spl0);
+
+	// concatenate PBF; no re-encoding
+	sprintf(fn, "%s.pbf.tmp", argv[optind]);
+	if (pbf_concat(fn, n, fn_pbf) < 0) {
+		fprintf(stderr, "[E::%s] failed to concatenate PBF. Inconsistent or corrupted inputs?\n", __func__);
+		concat_finish(argv[optind], 0);
+		return 1;
+	}
+
+	// concatenate site-only BCF, renumbering _row
+	strcpy(modew, "wb");
+	if (clevel >= 0 && clevel <= 9) sprintf(modew + 2, "%d", clevel);
+	sprintf(fn, "%s.bcf.tmp", argv[optind]);
+	if ((out = hts_open(fn, modew, 0)) == 0) {
+		fprintf(stderr, "[E::%s] failed to create '%s'\n", __func__, fn);
+		concat_finish(argv[optind], 0);
+		return 1;
+	}
+	h0 = 0, id_row = -1;
+	b = bcf_init1();
+	for (i = 0; i < n && ret == 0; ++i) {
+		const char *prefix = argv[optind + 1 + i];
+		int64_t n_rec = 0;
+		htsFile *in;
+		bcf_hdr_t *h;
+		pbf_t *pb;
+		sprintf(fn_pbf[i] + strlen(prefix), ".bcf");
+		if ((in = hts_open(fn_pbf[i], "rb", 0)) == 0) {
+			fprintf(stderr, "[E::%s] failed to open '%s'\n", __func__, fn_pbf[i]);
+			ret = -1;
+			break;
+		}
+		h = vcf_hdr_read(in);
+		if (h0 == 0) {
+			h0 = h;
+			vcf_hdr_write(out, h0);
+			bcf_idx_init(out, h0, 14);
+			id_row = bcf_id2int(h0, BCF_DT_ID, "_row");
+		}
+		while (vcf_read1(in, h, b) >= 0) {
+			int rid = b->rid;
+			if (h != h0) rid = bcf_name2id(h0, h->id[BCF_DT_CTG][b->rid].key);
+			if (rid < 0 || rid < last_rid || (rid == last_rid && b->pos < last_pos)) {
+				if (rid < 0) fprintf(stderr, "[E::%s] contig '%s' is absent from the first BGT\n", __func__, h->id[BCF_DT_CTG][b->rid].key);
+				else fprintf(stderr, "[E::%s] '%s' is not in the coordinate order after the previous BGT\n", __func__, prefix);
+				ret = -1;
+				break;
+			}
+			b->rid = last_rid = rid, last_pos = b->pos;
+			concat_set_info_int(b, id_row, n_rows + n_rec, &tmp);
+			vcf_write1(out, h0, b);
+			++n_rec;
+		}
+		if (h != h0) bcf_hdr_destroy(h);
+		hts_close(in);
+		sprintf(fn_pbf[i] + strlen(prefix), ".pbf");
+		pb = pbf_open_r(fn_pbf[i]);
+		if (ret == 0 && n_rec != pbf_get_n(pb)) {
+			fprintf(stderr, "[E::%s] '%s' has %lld sites but %d PBF rows\n", __func__, prefix, (long long)n_rec, pbf_get_n(pb));
+			ret = -1;
+		}
+		pbf_close(pb);
+		n_rows += n_rec;
+	}
+	bcf_destroy1(b);
+	if (ret == 0 && bcf_idx_save(out) < 0) ret = -1;
 	hts_close(out);
-	free(bit1); free(bits[0]); free(bits[1]);
-	if (pb1) pbf_close(pb1);
+	if (h0) bcf_hdr_destroy(h0);
+	if (concat_finish(argv[optind], ret == 0) < 0) ret = -1;
+
+	free(tmp.s);
+	for (i = 0; i < n; ++i) free(fn_pbf[i]);
+	free(fn_pbf); free(fn);
+	return ret < 0? 1 : 0;
+}
+
+int main_reindex(int argc, char *argv[])
+{
+	int c, shift = 13, blk_size = -1, n_blk = -1;
+	int32_t *blk_beg = 0;
+	char *fn, *fn_tmp;
+	pbf_t *pb;
+
+	while ((c = getopt(argc, argv, "s:b:")) >= 0) {
+		if (c == 's') shift = atoi(optarg);
+		else if (c == 'b') blk_size = atoi(optarg);
+	}
+	if (argc - optind < 1) {
+		fprintf(stderr, "Usage: bgt reindex [-s shift] [-b blkSize] <bgt-prefix>\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -s INT     keep a PBF checkpoint every 2^INT sites [13]\n");
+		fprintf(stderr, "  -b INT     encode haplotypes in blocks of INT samples; 0 for one block [unchanged]\n");
+		fprintf(stderr, "Notes: smaller -s speeds up random access at the cost of a larger .pbf. With -b,\n");
+		fprintf(stderr, "  queries skip blocks without selected samples and 'view -@' decodes blocks in parallel.\n");
+		return 1;
+	}
+	if (shift < 0 || shift > 30) {
+		fprintf(stderr, "[E::%s] option -s must be between 0 and 30.\n", __func__);
+		return 1;
+	}
+	fn = (char*)malloc(strlen(argv[optind]) + 9);
+	fn_tmp = (char*)malloc(strlen(argv[optind]) + 13);
+	sprintf(fn, "%s.pbf", argv[optind]);
+	sprintf(fn_tmp, "%s.pbf.tmp", argv[optind]);
+	if ((pb = pbf_open_r(fn)) == 0) {
+		fprintf(stderr, "[E::%s] failed to open '%s'\n", __func__, fn);
+		free(fn); free(fn_tmp);
+		return 1;
+	}
+	if (blk_size >= 0) blk_beg = import_blk_beg(pbf_get_m(pb) / 2, blk_size, &n_blk);
+	if (hts_verbose >= 3)
+		fprintf(stderr, "[M::%s] re-encoding %d rows with checkpoints every %d rows (was %d) in %d column blocks (was %d)\n", __func__,
+				pbf_get_n(pb), 1<<shift, 1<<pbf_get_shift(pb), n_blk < 0? pbf_get_n_blk(pb) : n_blk, pbf_get_n_blk(pb));
 	pbf_close(pb);
+	if (pbf_reindex(fn_tmp, fn, shift, n_blk, blk_beg) < 0 || rename(fn_tmp, fn) < 0) {
+		fprintf(stderr, "[E::%s] failed to rewrite '%s'\n", __func__, fn);
+		remove(fn_tmp);
+		free(fn); free(fn_tmp); free(blk_beg);
+		return 1;
+	}
+	free(fn); free(fn_tmp); free(blk_beg);
+	return 0;
+}
+
+int main_alidx(int argc, char *argv[])
+{
+	int64_t n;
+	if (argc < 2) {
+		fprintf(stderr, "Usage: bgt alidx <bgt-prefix>\n");
+		fprintf(stderr, "Note: writes <bgt-prefix>.aix, which 'bgt view -a' uses to look up alleles on\n");
+		fprintf(stderr, "  any contigs without a scan. Rebuild it after the .bcf changes.\n");
+		return 1;
+	}
+	if ((n = bgt_aix_build(argv[1])) < 0) {
+		fprintf(stderr, "[E::%s] failed to index alleles of BGT with prefix '%s'\n", __func__, argv[1]);
+		return 1;
+	}
+	if (hts_verbose >= 3)
+		fprintf(stderr, "[M::%s] indexed the alleles of %lld records\n", __func__, (long long)n);
+	return 0;
+}
+
+int main_materialize(int argc, char *argv[])
+{
+	int i, c, clevel = -1, drop_mono = 1, reg_view = 1, n_groups = 0, id_row;
+	char *fn, modew[8], *reg = 0, *gexpr[BGT_MAX_GROUPS];
+	const char *prefix;
+	int64_t n = 0, n_dropped = 0;
+	kstring_t tmp = {0,0,0};
+	bgt_file_t *bf;
+	bgt_t *bgt;
+	bgt_rec_t r;
+	bcf_hdr_t *h0;
+	bcf1_t *b;
+	htsFile *out;
+	pbf_t *pb;
+	FILE *fp;
+
+	while ((c = getopt(argc, argv, "l:s:r:kn")) >= 0) {
+		if (c == 'l') clevel = atoi(optarg);
+		else if (c == 'r') reg = optarg;
+		else if (c == 'k') drop_mono = 0;
+		else if (c == 'n') reg_view = 0;
+		else if (c == 's' && n_groups < BGT_MAX_GROUPS) gexpr[n_groups++] = optarg;
+	}
+	if (argc - optind < 2 || n_groups == 0) {
+		fprintf(stderr, "Usage: bgt materialize [options] -s <expr> <in-prefix> <out-prefix>\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -s EXPR      samples list (see 'bgt view'); multiple -s are merged\n");
+		fprintf(stderr, "  -r STR       region [all]\n");
+		fprintf(stderr, "  -k           keep sites without the ALT allele in the selected samples\n");
+		fprintf(stderr, "  -n           don't register the output in <in-prefix>.views\n");
+		fprintf(stderr, "  -l INT       compression level for BCF [default]\n");
+		fprintf(stderr, "Notes: registered views are used automatically for queries on a subset of their samples\n");
+		fprintf(stderr, "  and within the region given by -r. Without -k, they are only used if the site filter\n");
+		fprintf(stderr, "  has an 'AC>0' or 'AC>=1' term joined by '&&'.\n");
+		return 1;
+	}
+	prefix = argv[optind+1];
+	if ((bf = bgt_open(argv[optind])) == 0) {
+		fprintf(stderr, "[E::%s] failed to open BGT with prefix '%s'\n", __func__, argv[optind]);
+		return 1;
+	}
+	bgt = bgt_reader_init(bf);
+	for (i = 0; i < n_groups; ++i) {
+		if (bgt_add_group(bgt, gexpr[i]) < 0) {
+			fprintf(stderr, "[E::%s] failed to add sample group '%s'.\n", __func__, gexpr[i]);
+			return 1;
+		}
+	}
+	if (reg && bgt_set_region(bgt, reg) < 0) {
+		fprintf(stderr, "[E::%s] failed to set region. Region format error?\n", __func__);
+		return 1;
+	}
+	bgt_prepare(bgt);
+	if (bgt->n_out == 0) {
+		fprintf(stderr, "[E::%s] no samples selected\n", __func__);
+		return 1;
+	}
+	fn = (char*)malloc(strlen(prefix) + 9);
+
+	// write the sample list with metadata
+	sprintf(fn, "%s.spl", prefix);
+	fp = fopen(fn, "wb");
+	for (i = 0; i < bgt->n_out; ++i) {
+		char *s;
+		s = fmf_write(bf->f, bgt->out[i]);
+		fputs(s, fp); fputc('\n', fp);
+		free(s);
+	}
+	fclose(fp);
+
+	// site-only BCF header with provenance
+	h0 = bcf_hdr_subset(bf->h0, 0, 0, 0);
+	ksprintf(&tmp, "##bgtViewSource=%s", argv[optind]);
+	bcf_hdr_append(h0, tmp.s);
+	tmp.l = 0;
+	kputs("##bgtViewSourceId=", &tmp);
+	bgt_fingerprint(bgt, &tmp);
+	bcf_hdr_append(h0, tmp.s);
+	for (i = 0; i < n_groups; ++i) {
+		tmp.l = 0;
+		ksprintf(&tmp, "##bgtViewSamples=%s", gexpr[i]);
+		bcf_hdr_append(h0, tmp.s);
+	}
+	if (reg) {
+		tmp.l = 0;
+		ksprintf(&tmp, "##bgtViewRegion=%s", reg);
+		bcf_hdr_append(h0, tmp.s);
+	}
+	tmp.l = 0;
+	ksprintf(&tmp, "##bgtViewDropMono=%d", drop_mono);
+	bcf_hdr_append(h0, tmp.s);
+	id_row = bcf_id2int(h0, BCF_DT_ID, "_row");
+	strcpy(modew, "wb");
+	if (clevel >= 0 && clevel <= 9) sprintf(modew + 2, "%d", clevel);
+	sprintf(fn, "%s.bcf", prefix);
+	out = hts_open(fn, modew, 0);
+	vcf_hdr_write(out, h0);
+	bcf_idx_init(out, h0, 14);
+
+	// re-encode the subset
+	sprintf(fn, "%s.pbf", prefix);
+	pb = pbf_open_w(fn, bgt->n_out<<1, 2, pbf_get_shift(bgt->pb));
+	b = bcf_init1();
+	while (bgt_read_rec(bgt, &r) >= 0) {
+		if (drop_mono) {
+			int j, has_alt = 0;
+			for (j = 0; j < bgt->n_out<<1 && !has_alt; ++j)
+				has_alt = (r.a[0][j] == 1 && r.a[1][j] == 0);
+			if (!has_alt) {
+				++n_dropped;
+				continue;
+			}
+		}
+		pbf_write(pb, (uint8_t*const*)r.a);
+		bcfcpy(b, r.b0);
+		concat_set_info_int(b, id_row, n++, &tmp);
+		vcf_write1(out, h0, b);
+	}
+	bcf_destroy1(b);
+	pbf_close(pb);
+	bcf_idx_save(out);
+	hts_close(out);
 	bcf_hdr_destroy(h0);
+	if (hts_verbose >= 3)
+		fprintf(stderr, "[M::%s] wrote %d samples and %lld sites; dropped %lld sites\n", __func__, bgt->n_out, (long long)n, (long long)n_dropped);
 
-	bcf_index_build(fn, 14);
-	free(fn);
+	// register the view; relative paths in .views are resolved against the directory of <in-prefix>
+	tmp.l = 0;
+	if (prefix[0] != '/' && strchr(argv[optind], '/')) {
+		char cwd[PATH_MAX];
+		if (getcwd(cwd, PATH_MAX) == 0) reg_view = 0;
+		else ksprintf(&tmp, "%s/", cwd);
+	}
+	kputs(prefix, &tmp);
+	for (i = 0; i < bf->n_views && reg_view; ++i)
+		if (strcmp(bf->view_fn[i], tmp.s) == 0)
+			reg_view = 0; // already registered
+	if (reg_view) {
+		fn = (char*)realloc(fn, strlen(argv[optind]) + 7);
+		sprintf(fn, "%s.views", argv[optind]);
+		if ((fp = fopen(fn, "a")) != 0) {
+			fprintf(fp, "%s\n", tmp.s);
+			fclose(fp);
+		} else fprintf(stderr, "[W::%s] failed to register the view in '%s'\n", __func__, fn);
+	}
+
+	free(tmp.s); free(fn);
+	bgt_reader_destroy(bgt);
+	bgt_close(bf);
 	return 0;
 }
 
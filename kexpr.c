@@ -429,6 +429,26 @@ void ke_destroy(kexpr_t *ke)
 	free(ke->e); free(ke);
 }
 
+int ke_has_var(const kexpr_t *ke, const char *var)
+{
+	int i, n = 0;
+	for (i = 0; i < ke->n; ++i) {
+		const ke1_t *e = &ke->e[i];
+		if (e->ttype == KET_VAL && e->name && strcmp(e->name, var) == 0) ++n;
+	}
+	return n;
+}
+
+const char *ke_var_name(const kexpr_t *ke, int i)
+{
+	int j;
+	for (j = 0; j < ke->n; ++j) {
+		const ke1_t *e = &ke->e[j];
+		if (e->ttype == KET_VAL && e->name && i-- == 0) return e->name;
+	}
+	return 0;
+}
+
 int ke_set_int(kexpr_t *ke, const char *var, int64_t y)
 {
 	int i, n = 0;
@@ -43,6 +43,12 @@ extern "C" {
 	// set a variable to string value and return the occurrence of the variable
 	int ke_set_str(kexpr_t *ke, const char *var, const char *x);
 
+	// return the occurrence of a variable in the expression
+	int ke_has_var(const kexpr_t *ke, const char *var);
+
+	// return the name of the i-th variable occurrence, or NULL if there are no more
+	const char *ke_var_name(const kexpr_t *ke, int i);
+
 	// set a user-defined function
 	int ke_set_real_func1(kexpr_t *ke, const char *name, double (*func)(double));
 	int ke_set_real_func2(kexpr_t *ke, const char *name, double (*func)(double, double));
@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <pthread.h>
+#include "bgt.h"
+#include "kstring.h"
+#include "bits.h"
+
+#define KIN_BLOCK_WORDS 64 // sites are packed in blocks of 64*64
+#define KIN_TILE 128 // samples whose planes (1.5KB each) are kept in L2 while all rows are paired with them
+
+/* Genotypes of a block of sites are packed into three bit planes per sample:
+ * heterozygous, hom-REF and hom-ALT, with missing genotypes absent from all
+ * three. For each pair of samples in the upper triangle, we count:
+ *
+ *   c[0]: both heterozygous
+ *   c[1]: IBS0, i.e. opposite homozygotes
+ *   c[2]: sample i heterozygous where j is called
+ *   c[3]: sample j heterozygous where i is called
+ *
+ * Pairs are visited in tiles of KIN_TILE samples j; each row i is paired
+ * with one tile before moving to the next tile. Threads are started once and
+ * take interleaved rows of every tile in each block. */
+typedef struct {
+	int n, n_threads;
+	bitplane_t bp; // planes 0, 1 and 2: het, hom-REF and hom-ALT
+	uint32_t (*cnt)[4];
+	// worker threads; the calling thread works as thread 0
+	int n_left, quit;
+	int64_t gen; // incremented for each block
+	pthread_mutex_t lock;
+	pthread_cond_t go, done;
+	pthread_t *tid;
+	struct kin_worker_s *w;
+} kin_t;
+
+typedef struct kin_worker_s {
+	kin_t *k;
+	int tid;
+} kin_worker_t;
+
+static inline int64_t kin_idx(int n, int i, int j) { return (int64_t)i * (2 * n - i - 1) / 2 + (j - i - 1); }
+
+// pair row i with samples [beg,end), all greater than i
+static void kin_row(kin_t *k, int i, int beg, int end, int n_words)
+{
+	const uint64_t *hi = bp_row(&k->bp, i);
+	const uint64_t *ri = hi + KIN_BLOCK_WORDS, *ai = ri + KIN_BLOCK_WORDS;
+	uint32_t (*c)[4] = &k->cnt[kin_idx(k->n, i, beg)];
+	int j, w;
+	for (j = beg; j < end; ++j, ++c) {
+		const uint64_t *hj = bp_row(&k->bp, j);
+		const uint64_t *rj = hj + KIN_BLOCK_WORDS, *aj = rj + KIN_BLOCK_WORDS;
+		uint32_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+		for (w = 0; w < n_words; ++w) {
+			c0 += popcount64(hi[w] & hj[w]);
+			c1 += popcount64((ri[w] & aj[w]) | (ai[w] & rj[w]));
+			c2 += popcount64(hi[w] & (hj[w] | rj[w] | aj[w]));
+			c3 += popcount64(hj[w] & (hi[w] | ri[w] | ai[w]));
+		}
+		(*c)[0] += c0, (*c)[1] += c1, (*c)[2] += c2, (*c)[3] += c3;
+	}
+}
+
+static void kin_part(kin_t *k, int tid)
+{
+	int i, j0, n_words = bp_used(&k->bp);
+	for (j0 = 0; j0 < k->n; j0 += KIN_TILE) {
+		int j1 = j0 + KIN_TILE < k->n? j0 + KIN_TILE : k->n;
+		for (i = tid; i < j1 - 1; i += k->n_threads) // interleaved rows, as row lengths decrease within a tile
+			kin_row(k, i, i + 1 > j0? i + 1 : j0, j1, n_words);
+	}
+}
+
+static void *kin_worker(void *data)
+{
+	kin_worker_t *w = (kin_worker_t*)data;
+	kin_t *k = w->k;
+	int64_t gen = 0;
+	for (;;) {
+		pthread_mutex_lock(&k->lock);
+		while (k->gen == gen && !k->quit)
+			pthread_cond_wait(&k->go, &k->lock);
+		if (k->quit) {
+			pthread_mutex_unlock(&k->lock);
+			break;
+		}
+		gen = k->gen;
+		pthread_mutex_unlock(&k->lock);
+		kin_part(k, w->tid);
+		pthread_mutex_lock(&k->lock);
+		if (--k->n_left == 0) pthread_cond_signal(&k->done);
+		pthread_mutex_unlock(&k->lock);
+	}
+	return 0;
+}
+
+static void kin_init(kin_t *k, int n, int n_threads)
+{
+	int t;
+	memset(k, 0, sizeof(kin_t));
+	k->n = n, k->n_threads = n_threads > 0? n_threads : 1;
+	bp_init(&k->bp, k->n, 3, KIN_BLOCK_WORDS);
+	k->cnt = (uint32_t(*)[4])calloc(k->n > 1? (size_t)k->n * (k->n - 1) / 2 : 1, 16);
+	if (k->n_threads == 1) return;
+	pthread_mutex_init(&k->lock, 0);
+	pthread_cond_init(&k->go, 0);
+	pthread_cond_init(&k->done, 0);
+	k->tid = (pthread_t*)calloc(k->n_threads, sizeof(pthread_t));
+	k->w = (kin_worker_t*)calloc(k->n_threads, sizeof(kin_worker_t));
+	for (t = 1; t < k->n_threads; ++t) {
+		k->w[t].k = k, k->w[t].tid = t;
+		pthread_create(&k->tid[t], 0, kin_worker, &k->w[t]);
+	}
+}
+
+static void kin_destroy(kin_t *k)
+{
+	int t;
+	if (k->n_threads > 1) {
+		pthread_mutex_lock(&k->lock);
+		k->quit = 1;
+		pthread_cond_broadcast(&k->go);
+		pthread_mutex_unlock(&k->lock);
+		for (t = 1; t < k->n_threads; ++t) pthread_join(k->tid[t], 0);
+		pthread_mutex_destroy(&k->lock);
+		pthread_cond_destroy(&k->go);
+		pthread_cond_destroy(&k->done);
+		free(k->tid); free(k->w);
+	}
+	bp_destroy(&k->bp); free(k->cnt);
+}
+
+static void kin_flush(kin_t *k)
+{
+	if (k->bp.n_sites == 0) return;
+	if (k->n_threads > 1) {
+		pthread_mutex_lock(&k->lock);
+		k->n_left = k->n_threads - 1;
+		++k->gen;
+		pthread_cond_broadcast(&k->go);
+		pthread_mutex_unlock(&k->lock);
+		kin_part(k, 0);
+		pthread_mutex_lock(&k->lock);
+		while (k->n_left > 0)
+			pthread_cond_wait(&k->done, &k->lock);
+		pthread_mutex_unlock(&k->lock);
+	} else kin_part(k, 0);
+	bp_clear(&k->bp);
+}
+
+// pack a site into the current block; <M> is counted as REF
+static void kin_add(kin_t *k, const uint8_t *const*a)
+{
+	int i;
+	for (i = 0; i < k->n; ++i) {
+		int c1 = a[1][i<<1|0]<<1 | a[0][i<<1|0], c2 = a[1][i<<1|1]<<1 | a[0][i<<1|1], p;
+		if (c1 == 2 || c2 == 2) continue;
+		p = (c1 == 1) + (c2 == 1);
+		p = p == 1? 0 : p == 0? 1 : 2;
+		bp_set(&k->bp, i, p);
+	}
+	if (bp_next(&k->bp)) kin_flush(k);
+}
+
+static const char *kin_name(const bgtm_t *bm, int i)
+{
+	const bgt_t *bgt = bm->bgt[bm->sample_idx[i]>>32];
+	return bgt->f->f->rows[(uint32_t)bm->sample_idx[i]].name;
+}
+
+int main_kinship(int argc, char *argv[])
+{
+	int i, j, c, n_files = 0, n_groups = 0, n_threads = 1;
+	char *reg = 0, *site_flt = 0, *gexpr[BGT_MAX_GROUPS];
+	double min_kin = -HUGE_VAL;
+	int64_t n_sites = 0;
+	bgt_file_t **files;
+	bgtm_t *bm;
+	bcf1_t *b;
+	kin_t k;
+	kstring_t s = {0,0,0};
+
+	while ((c = getopt(argc, argv, "r:f:s:m:@:")) >= 0) {
+		if (c == 'r') reg = optarg;
+		else if (c == 'f') site_flt = optarg;
+		else if (c == 'm') min_kin = atof(optarg);
+		else if (c == '@') n_threads = atoi(optarg);
+		else if (c == 's' && n_groups < BGT_MAX_GROUPS) gexpr[n_groups++] = optarg;
+	}
+	if (argc - optind < 1) {
+		fprintf(stderr, "Usage: bgt kinship [options] <bgt-prefix> [...]\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -s EXPR      samples list (see 'bgt view') [all]\n");
+		fprintf(stderr, "  -r STR       region [all]\n");
+		fprintf(stderr, "  -f STR       frequency filters, e.g. 'AC/AN>.01' []\n");
+		fprintf(stderr, "  -m FLOAT     only output pairs with kinship at least FLOAT [all pairs]\n");
+		fprintf(stderr, "  -@ INT       number of threads [1]\n");
+		fprintf(stderr, "Output: TAB-delimited sample pair, #sites both heterozygous, #IBS0 sites and\n");
+		fprintf(stderr, "  the KING-robust kinship coefficient.\n");
+		return 1;
+	}
+
+	n_files = argc - optind;
+	files = (bgt_file_t**)calloc(n_files, sizeof(bgt_file_t*));
+	for (i = 0; i < n_files; ++i) {
+		files[i] = bgt_open(argv[optind+i]);
+		if (files[i] == 0) {
+			fprintf(stderr, "[E::%s] failed to open BGT with prefix '%s'\n", __func__, argv[optind+i]);
+			return 1;
+		}
+	}
+	bm = bgtm_reader_init(n_files, files);
+	bgtm_set_flag(bm, BGT_F_NO_GT);
+	if (site_flt && bgtm_set_flt_site(bm, site_flt) != 0) {
+		fprintf(stderr, "[E::%s] failed to set frequency filters. Syntax error?\n", __func__);
+		return 1;
+	}
+	if (reg && bgtm_set_region(bm, reg) < 0) {
+		fprintf(stderr, "[E::%s] failed to set region. Region format error?\n", __func__);
+		return 1;
+	}
+	for (i = 0; i < n_groups; ++i) {
+		if (bgtm_add_group(bm, gexpr[i]) < 0) {
+			fprintf(stderr, "[E::%s] failed to add sample group '%s'.\n", __func__, gexpr[i]);
+			return 1;
+		}
+	}
+	bgtm_prepare(bm);
+
+	kin_init(&k, bm->n_out, n_threads);
+	b = bcf_init1();
+	while (bgtm_read(bm, b) >= 0) {
+		kin_add(&k, (const uint8_t*const*)bm->a);
+		++n_sites;
+	}
+	kin_flush(&k);
+	bcf_destroy1(b);
+
+	printf("#sites\t%lld\n", (long long)n_sites);
+	for (i = 0; i < k.n; ++i) {
+		for (j = i + 1; j < k.n; ++j) {
+			const uint32_t *p = k.cnt[kin_idx(k.n, i, j)];
+			double kin = p[2] + p[3] > 0? ((double)p[0] - 2. * p[1]) / (p[2] + p[3]) : NAN;
+			if (min_kin > -HUGE_VAL && !(kin >= min_kin)) continue;
+			s.l = 0;
+			kputs(kin_name(bm, i), &s); kputc('\t', &s);
+			kputs(kin_name(bm, j), &s); kputc('\t', &s);
+			kputuw(p[0], &s); kputc('\t', &s);
+			kputuw(p[1], &s); kputc('\t', &s);
+			if (isnan(kin)) kputs("NA", &s);
+			else ksprintf(&s, "%.4f", kin);
+			puts(s.s);
+		}
+	}
+
+	free(s.s); kin_destroy(&k);
+	bgtm_reader_destroy(bm);
+	for (i = 0; i < n_files; ++i) bgt_close(files[i]);
+	free(files);
+	return 0;
+}
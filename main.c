@@ -9,16 +9,42 @@ int main_import(int argc, char *argv[]);
 int main_view(int argc, char *argv[]);
 int main_getalt(int argc, char *argv[]);
 int main_bcfidx(int argc, char *argv[]);
+int main_concat(int argc, char *argv[]);
+int main_materialize(int argc, char *argv[]);
+int main_reindex(int argc, char *argv[]);
+int main_alidx(int argc, char *argv[]);
 int main_fmf(int argc, char *argv[]);
 int main_atomize(int argc, char *argv[]);
+int main_burden(int argc, char *argv[]);
+int main_sfs(int argc, char *argv[]);
+int main_popstats(int argc, char *argv[]);
+int main_kinship(int argc, char *argv[]);
+int main_pca(int argc, char *argv[]);
+int main_compare(int argc, char *argv[]);
+int main_sketch(int argc, char *argv[]);
+int main_sketch_query(int argc, char *argv[]);
+int main_export(int argc, char *argv[]);
 
 static int usage()
 {
 	fprintf(stderr, "Usage: bgt <command> <argument>\n");
 	fprintf(stderr, "Commands:\n");
 	fprintf(stderr, "  import       convert VCF to BGT\n");
+	fprintf(stderr, "  concat       concatenate BGTs of the same samples\n");
+	fprintf(stderr, "  materialize  write and register a BGT of a sample subset\n");
+	fprintf(stderr, "  reindex      rewrite PBF with a different checkpoint interval\n");
+	fprintf(stderr, "  alidx        index alleles for lookups across contigs\n");
 	fprintf(stderr, "  atomize      atomize VCF\n");
 	fprintf(stderr, "  view         extract from BGT\n");
+	fprintf(stderr, "  burden       per-sample counts of qualifying alleles by annotation group\n");
+	fprintf(stderr, "  sfs          site frequency spectrum, joint across up to 3 sample groups\n");
+	fprintf(stderr, "  popstats     windowed pi, theta_W, Tajima's D and Fst\n");
+	fprintf(stderr, "  kinship      pairwise KING-robust kinship\n");
+	fprintf(stderr, "  pca          randomized principal component analysis\n");
+	fprintf(stderr, "  compare      per-sample genotype concordance between two BGTs\n");
+	fprintf(stderr, "  sketch       MinHash sketches of ALT allele sites per sample\n");
+	fprintf(stderr, "  sketch-query find near-duplicate samples from sketches\n");
+	fprintf(stderr, "  export       export haplotypes to other formats (M3VCF)\n");
 	fprintf(stderr, "  fmf          manipulate FMF files\n");
 	fprintf(stderr, "  bcfidx       (re)index BCF with record number index\n");
 	fprintf(stderr, "  version      show version number\n");
@@ -29,8 +55,21 @@ int main(int argc, char *argv[])
 {
 	if (argc < 2) return usage();
 	if (strcmp(argv[1], "import") == 0) return main_import(argc-1, argv+1);
+	else if (strcmp(argv[1], "concat") == 0) return main_concat(argc-1, argv+1);
+	else if (strcmp(argv[1], "materialize") == 0) return main_materialize(argc-1, argv+1);
+	else if (strcmp(argv[1], "reindex") == 0) return main_reindex(argc-1, argv+1);
+	else if (strcmp(argv[1], "alidx") == 0) return main_alidx(argc-1, argv+1);
 	else if (strcmp(argv[1], "atomize") == 0) return main_atomize(argc-1, argv+1);
 	else if (strcmp(argv[1], "view") == 0 || strcmp(argv[1], "mview") == 0 ) return main_view(argc-1, argv+1);
+	else if (strcmp(argv[1], "burden") == 0) return main_burden(argc-1, argv+1);
+	else if (strcmp(argv[1], "sfs") == 0) return main_sfs(argc-1, argv+1);
+	else if (strcmp(argv[1], "popstats") == 0) return main_popstats(argc-1, argv+1);
+	else if (strcmp(argv[1], "kinship") == 0) return main_kinship(argc-1, argv+1);
+	else if (strcmp(argv[1], "pca") == 0) return main_pca(argc-1, argv+1);
+	else if (strcmp(argv[1], "compare") == 0) return main_compare(argc-1, argv+1);
+	else if (strcmp(argv[1], "sketch") == 0) return main_sketch(argc-1, argv+1);
+	else if (strcmp(argv[1], "sketch-query") == 0) return main_sketch_query(argc-1, argv+1);
+	else if (strcmp(argv[1], "export") == 0) return main_export(argc-1, argv+1);
 	else if (strcmp(argv[1], "fmf") == 0 ) return main_fmf(argc-1, argv+1);
 	else if (strcmp(argv[1], "getalt") == 0) return main_getalt(argc-1, argv+1);
 	else if (strcmp(argv[1], "bcfidx") == 0) return main_bcfidx(argc-1, argv+1);
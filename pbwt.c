@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include "pbwt.h"
+#include "readahead.h"
 
 /********************************
  * Run-length encoding/decoding *
@@ -89,6 +90,30 @@ void pbc_dec_core(int m, const int32_t *S0, const uint8_t *u, int32_t *S, uint8_
 	}
 }
 
+// Given S_{k-1}, its divergence array D_{k-1} and A_k of symbols 0-3, derive S_k and D_k (Durbin 2014, algorithm 2).
+// D[j] is the first row from which S[j] and S[j-1] are identical up to row $k; D[0] is k+1.
+void pbc_div_core(int m, int k, const int32_t *S0, const int32_t *D0, const uint8_t *a, int32_t *S, int32_t *D)
+{
+	int32_t j, c, n[4], off[4], p[4];
+	memset(n, 0, 16);
+	for (j = 0; j < m; ++j) ++n[a[S0[j]]&3];
+	for (c = 0, off[0] = 0; c < 3; ++c) off[c+1] = off[c] + n[c];
+	if (n[0] == m || n[1] == m || n[2] == m || n[3] == m) { // a constant row doesn't change the order
+		memcpy(S, S0, m * 4);
+		memcpy(D, D0, m * 4);
+		D[0] = k + 1;
+		return;
+	}
+	for (c = 0; c < 4; ++c) p[c] = k + 1;
+	for (j = 0; j < m; ++j) {
+		int32_t b = a[S0[j]]&3, d = D0[j];
+		p[0] = p[0] > d? p[0] : d, p[1] = p[1] > d? p[1] : d; // branchless
+		p[2] = p[2] > d? p[2] : d, p[3] = p[3] > d? p[3] : d;
+		S[off[b]] = S0[j], D[off[b]++] = p[b];
+		p[b] = 0;
+	}
+}
+
 pbc_t *pbc_init(int m)
 {
 	int j;
@@ -173,6 +198,27 @@ void pbs_dec(int m, int r, pbs_dat_t *d, const uint8_t *u, uint8_t *a) // IMPORT
  * File I/O *
  ************/
 
+#include <pthread.h>
+
+int pbf_min_par = 0x10000; // decode blocks in parallel only if at least this many columns are decoded
+
+struct pbf_pool_s;
+static void pbf_pool_destroy(struct pbf_pool_s *q);
+
+typedef struct { // a block of columns, encoded with its own PBWT
+	int32_t beg, m; // first column and number of columns
+	pbc_t **pb;     // pbwt full codecs, one per group
+	int n_sub;      // number of selected columns; 0 if the block is skipped
+	int is_sub;     // decode with pbs_dec(); otherwise all columns are decoded
+	pbs_dat_t **sub;
+	int *sub_list;  // selected columns, relative to ->beg
+	int32_t *map;   // output position of each decoded column, or NULL if they start at ->out_beg
+	int32_t out_beg;
+	int stale;      // S has not been updated since the block was skipped
+	uint8_t **buf;  // encoded row, one per group (reading only)
+	int32_t *invS;  // reading only
+} pbf_blk_t;
+
 struct pbf_s {
 	FILE *fp;   // PBF file handler
 	int32_t m;  // number of columns
@@ -181,26 +227,90 @@ struct pbf_s {
 	int32_t is_writing; // file opend for writing
 	int64_t n;  // number of rows
 
-	pbc_t **pb; // pbwt full codecs
-	const uint8_t **ret; // ret[g] points to pb[g]->u; this is for return (writing only)
+	int32_t n_blk;  // number of column blocks; PBF\1 if 1 and PBF\2 otherwise
+	pbf_blk_t *blk;
+	uint64_t off_hdr; // file offset of the first record
+
+	const uint8_t **ret; // ret[g] points to blk[0].pb[g]->u with one block, or to out[g] otherwise
+	uint8_t **out;       // decoded row gathered from all blocks (reading only)
 
 	int32_t n_idx, m_idx;
 	uint64_t *idx; // file offset of "S" records
+	uint64_t off_idx; // file offset of the "I" record (reading only)
+
+	int32_t n_seg;  // number of segments; S is reset to identity at the start of each segment
+	uint64_t *seg;  // start row of each segment
+	int32_t *seg_idx; // index of the first "S" record of each segment in idx[]
 
 	int n_sub;
-	pbs_dat_t **sub;
-	int *sub_list;
+	int n_threads;
+	struct pbf_pool_s *pool; // decoding threads, started by pbf_set_n_threads()
 
 	int64_t k;     // the row index just processed (reading only)
-	uint8_t *buf;  // reading only
-	int32_t *invS; // reading only
+
+	int32_t i_idx;    // the last "S" record read, as an index into idx[] (reading only)
+	int32_t ra_spans; // number of checkpoint spans to read ahead; 0 to disable
 };
 
-pbf_t *pbf_open_w(const char *fn, int m, int g, int shift)
+// prefetch the current and the next ra_spans checkpoint spans
+static void pbf_readahead(const pbf_t *pb)
+{
+	int32_t i = pb->i_idx < 0? 0 : pb->i_idx, j = i + 1 + pb->ra_spans;
+	uint64_t end;
+	if (pb->ra_spans <= 0 || pb->idx == 0 || i >= pb->n_idx) return;
+	end = j < pb->n_idx? pb->idx[j] : pb->off_idx;
+	ra_willneed(fileno(pb->fp), pb->idx[i], end - pb->idx[i]);
+}
+
+static void pbf_write_hdr(FILE *fp, int m, int g, int shift, int n_blk, const pbf_blk_t *blk)
+{
+	int32_t i, v[4];
+	v[0] = m, v[1] = g, v[2] = shift, v[3] = n_blk;
+	fwrite(n_blk > 1? "PBF\2" : "PBF\1", 1, 4, fp);
+	fwrite(v, 4, n_blk > 1? 4 : 3, fp);
+	if (n_blk > 1)
+		for (i = 0; i < n_blk; ++i)
+			fwrite(&blk[i].beg, 4, 1, fp);
+}
+
+// allocate blocks starting at columns beg[0..n_blk-1], with beg[0]==0; one block covering all columns if n_blk<=1
+static void pbf_init_blk(pbf_t *pb, int n_blk, const int32_t *beg)
+{
+	int32_t b, g;
+	if (n_blk <= 1 || beg == 0) n_blk = 1;
+	pb->n_blk = n_blk;
+	pb->blk = (pbf_blk_t*)calloc(n_blk, sizeof(pbf_blk_t));
+	for (b = 0; b < n_blk; ++b) {
+		pbf_blk_t *p = &pb->blk[b];
+		p->beg = n_blk > 1? beg[b] : 0;
+		p->m = (b + 1 < n_blk? beg[b+1] : pb->m) - p->beg;
+		p->pb = (pbc_t**)calloc(pb->g, sizeof(void*));
+		for (g = 0; g < pb->g; ++g)
+			p->pb[g] = pbc_init(p->m);
+		p->n_sub = p->m, p->out_beg = p->beg;
+		if (!pb->is_writing) {
+			p->sub = (pbs_dat_t**)calloc(pb->g, sizeof(pbs_dat_t*));
+			p->buf = (uint8_t**)calloc(pb->g, sizeof(uint8_t*));
+			for (g = 0; g < pb->g; ++g)
+				p->buf[g] = (uint8_t*)calloc(p->m + 1, 1);
+			p->invS = (int32_t*)calloc(p->m, 4);
+		}
+	}
+	pb->ret = (const uint8_t**)calloc(pb->g, sizeof(uint8_t*));
+	if (n_blk > 1 && !pb->is_writing) {
+		pb->out = (uint8_t**)calloc(pb->g, sizeof(uint8_t*));
+		for (g = 0; g < pb->g; ++g)
+			pb->ret[g] = pb->out[g] = (uint8_t*)calloc(pb->m, 1);
+	} else {
+		for (g = 0; g < pb->g; ++g)
+			pb->ret[g] = pb->blk[0].pb[g]->u;
+	}
+}
+
+pbf_t *pbf_open_wb(const char *fn, int m, int g, int shift, int n_blk, const int32_t *beg)
 {
 	FILE *fp;
 	pbf_t *pb;
-	int32_t i, v[3];
 	if (fn && strcmp(fn, "-") != 0) {
 		if ((fp = fopen(fn, "wb")) == NULL)
 			return 0;
@@ -208,45 +318,47 @@ pbf_t *pbf_open_w(const char *fn, int m, int g, int shift)
 	pb = (pbf_t*)calloc(1, sizeof(pbf_t));
 	pb->fp = fp;
 	pb->m = m, pb->g = g, pb->shift = shift;
-	pb->pb = (pbc_t**)calloc(g, sizeof(void*));
-	for (i = 0; i < g; ++i)
-		pb->pb[i] = pbc_init(m);
-	v[0] = pb->m, v[1] = pb->g, v[2] = pb->shift;
-	fwrite("PBF\1", 1, 4, fp);
-	fwrite(v, 4, 3, fp);
 	pb->is_writing = 1;
+	pbf_init_blk(pb, n_blk, beg);
+	pbf_write_hdr(fp, m, g, shift, pb->n_blk, pb->blk);
 	return pb;
 }
 
+pbf_t *pbf_open_w(const char *fn, int m, int g, int shift)
+{
+	return pbf_open_wb(fn, m, g, shift, 1, 0);
+}
+
 pbf_t *pbf_open_r(const char *fn)
 {
 	pbf_t *pb;
 	FILE *fp;
-	int32_t i, v[3];
+	int32_t i, v[4], n_blk = 1, *beg = 0;
 	char magic[4];
 	if (fn && strcmp(fn, "-") != 0) {
 		if ((fp = fopen(fn, "rb")) == 0)
 			return 0;
 	} else fp = stdin;
 	fread(magic, 1, 4, fp);
-	if (strncmp(magic, "PBF\1", 4) != 0) {
+	if (strncmp(magic, "PBF\1", 4) != 0 && strncmp(magic, "PBF\2", 4) != 0) {
 		fclose(fp);
 		return 0;
 	}
 	pb = (pbf_t*)calloc(1, sizeof(pbf_t));
 	fread(v, 4, 3, fp);
 	pb->m = v[0], pb->g = v[1], pb->shift = v[2];
-	pb->pb = (pbc_t**)calloc(pb->g, sizeof(void*));
-	for (i = 0; i < pb->g; ++i)
-		pb->pb[i] = pbc_init(pb->m);
-	pb->buf = (uint8_t*)calloc(pb->m + 1, 1);
-	pb->invS = (int32_t*)calloc(pb->m, 4);
-	pb->ret = (const uint8_t**)calloc(pb->g, sizeof(uint8_t*));
-	for (i = 0; i < pb->g; ++i) pb->ret[i] = pb->pb[i]->u;
-	pb->sub = (pbs_dat_t**)calloc(pb->g, sizeof(pbs_dat_t*));
+	if (magic[3] == 2) { // column blocks
+		fread(&n_blk, 4, 1, fp);
+		beg = (int32_t*)calloc(n_blk, 4);
+		fread(beg, 4, n_blk, fp);
+	}
+	pb->off_hdr = ftell(fp);
+	pbf_init_blk(pb, n_blk, beg);
+	free(beg);
 	if (fseek(fp, -8, SEEK_END) >= 0) {
-		uint64_t off;
+		uint64_t off, end;
 		uint8_t t;
+		end = ftell(fp);
 		fread(&off, 8, 1, fp);
 		fseek(fp, off, SEEK_SET);
 		fread(&t, 1, 1, fp);
@@ -255,31 +367,64 @@ pbf_t *pbf_open_r(const char *fn)
 		pb->m_idx = pb->n_idx;
 		pb->idx = (uint64_t*)calloc(pb->n_idx, 8);
 		fread(pb->idx, 8, pb->n_idx, fp);
-		fseek(fp, 16, SEEK_SET);
+		pb->off_idx = off;
+		if ((uint64_t)ftell(fp) < end) { // segment start rows, written by pbf_concat()
+			fread(&pb->n_seg, 4, 1, fp);
+			pb->seg = (uint64_t*)calloc(pb->n_seg, 8);
+			fread(pb->seg, 8, pb->n_seg, fp);
+		}
+		fseek(fp, pb->off_hdr, SEEK_SET);
+	}
+	if (pb->n_seg == 0) { // one segment starting from row 0
+		pb->n_seg = 1;
+		pb->seg = (uint64_t*)calloc(1, 8);
 	}
+	pb->i_idx = -1;
+	pb->seg_idx = (int32_t*)calloc(pb->n_seg, 4);
+	for (i = 1; i < pb->n_seg; ++i)
+		pb->seg_idx[i] = pb->seg_idx[i-1] + ((pb->seg[i] - pb->seg[i-1] + (1ULL<<pb->shift) - 1) >> pb->shift);
+	pb->n_threads = 1;
 	pb->fp = fp;
 	return pb;
 }
 
+static void pbf_write_idx(FILE *fp, int64_t n, int32_t n_idx, const uint64_t *idx, int32_t n_seg, const uint64_t *seg)
+{
+	uint64_t off;
+	off = ftell(fp);
+	fputc('I', fp);
+	fwrite(&n, 8, 1, fp);
+	fwrite(&n_idx, 4, 1, fp);
+	fwrite(idx, 8, n_idx, fp);
+	if (n_seg > 1) {
+		fwrite(&n_seg, 4, 1, fp);
+		fwrite(seg, 8, n_seg, fp);
+	}
+	fwrite(&off, 8, 1, fp);
+}
+
 int pbf_close(pbf_t *pb)
 {
-	int g;
+	int b, g;
 	if (pb == 0) return 0;
-	if (pb->is_writing) { // write the index
-		uint64_t off;
-		off = ftell(pb->fp);
-		fputc('I', pb->fp);
-		fwrite(&pb->n, 8, 1, pb->fp);
-		fwrite(&pb->n_idx, 4, 1, pb->fp);
-		fwrite(pb->idx, 8, pb->n_idx, pb->fp);
-		fwrite(&off, 8, 1, pb->fp);
-	}
-	free(pb->idx); free(pb->ret); free(pb->invS); free(pb->buf); free(pb->sub_list);
-	for (g = 0; g < pb->g; ++g) {
-		free(pb->pb[g]);
-		if (pb->sub) free(pb->sub[g]);
+	if (pb->is_writing) // write the index
+		pbf_write_idx(pb->fp, pb->n, pb->n_idx, pb->idx, pb->n_seg, pb->seg);
+	pbf_pool_destroy(pb->pool);
+	free(pb->idx); free(pb->seg); free(pb->seg_idx); free(pb->ret);
+	for (b = 0; b < pb->n_blk; ++b) {
+		pbf_blk_t *p = &pb->blk[b];
+		for (g = 0; g < pb->g; ++g) {
+			free(p->pb[g]);
+			if (p->sub) free(p->sub[g]);
+			if (p->buf) free(p->buf[g]);
+		}
+		free(p->pb); free(p->sub); free(p->buf); free(p->sub_list); free(p->map); free(p->invS);
+	}
+	if (pb->out) {
+		for (g = 0; g < pb->g; ++g) free(pb->out[g]);
+		free(pb->out);
 	}
-	free(pb->sub); free(pb->pb);
+	free(pb->blk);
 	fclose(pb->fp);
 	free(pb);
 	return 0;
@@ -287,7 +432,7 @@ int pbf_close(pbf_t *pb)
 
 int pbf_write(pbf_t *pb, uint8_t *const*a)
 {
-	int g;
+	int b, g;
 	if (!pb->is_writing) return -1;
 	if ((pb->n & ((1ULL<<pb->shift) - 1)) == 0) {
 		if (pb->n_idx == pb->m_idx) {
@@ -296,98 +441,427 @@ int pbf_write(pbf_t *pb, uint8_t *const*a)
 		}
 		pb->idx[pb->n_idx++] = ftell(pb->fp); // save the index offset
 		fputc('S', pb->fp);
-		for (g = 0; g < pb->g; ++g) // write S[]
-			fwrite(pb->pb[g]->S, 4, pb->m, pb->fp);
+		for (b = 0; b < pb->n_blk; ++b) // write S[]
+			for (g = 0; g < pb->g; ++g)
+				fwrite(pb->blk[b].pb[g]->S, 4, pb->blk[b].m, pb->fp);
 	}
 	fputc('B', pb->fp);
-	for (g = 0; g < pb->g; ++g) {
-		pbc_t *pbc = pb->pb[g];
-		pbc_enc(pbc, a[g]);
-		fwrite(&pbc->l, 4, 1, pb->fp);
-		fwrite(pbc->u, 1, pbc->l, pb->fp);
+	for (b = 0; b < pb->n_blk; ++b) {
+		pbf_blk_t *p = &pb->blk[b];
+		int32_t len = 0;
+		for (g = 0; g < pb->g; ++g) {
+			pbc_enc(p->pb[g], a[g] + p->beg);
+			len += 4 + p->pb[g]->l;
+		}
+		if (pb->n_blk > 1) fwrite(&len, 4, 1, pb->fp); // so that a reader can skip the block
+		for (g = 0; g < pb->g; ++g) {
+			fwrite(&p->pb[g]->l, 4, 1, pb->fp);
+			fwrite(p->pb[g]->u, 1, p->pb[g]->l, pb->fp);
+		}
 	}
 	++pb->n;
 	return 0;
 }
 
+// find the rank of a subset of columns given S
+static inline void pbf_fill_sub(int m, const int32_t *S, int n_sub, pbs_dat_t *sub, int32_t *invS, int *sub_list)
+{
+	int i;
+	for (i = 0; i < m; ++i) invS[S[i]] = i;
+	for (i = 0; i < n_sub; ++i)
+		sub[i].r = invS[sub_list[sub[i].i]];
+	radix_sort_r(sub, sub + n_sub);
+}
+
+// read S of all blocks at an "S" record; S of a skipped block is not read
+static void pbf_read_S(pbf_t *pb)
+{
+	int b, g;
+	for (b = 0; b < pb->n_blk; ++b) {
+		pbf_blk_t *p = &pb->blk[b];
+		if (p->n_sub == 0) {
+			fseek(pb->fp, (long)p->m * 4 * pb->g, SEEK_CUR);
+			p->stale = 1;
+			continue;
+		}
+		for (g = 0; g < pb->g; ++g) {
+			fread(p->pb[g]->S, 4, p->m, pb->fp);
+			if (p->is_sub) // S may be reset at a segment boundary, so the subset ranks are recomputed
+				pbf_fill_sub(p->m, p->pb[g]->S, p->n_sub, p->sub[g], p->invS, p->sub_list);
+		}
+		p->stale = 0;
+	}
+}
+
+// decode the encoded row in ->buf and copy it to the output
+static void pbf_dec_blk(pbf_t *pb, pbf_blk_t *p)
+{
+	int g, i;
+	for (g = 0; g < pb->g; ++g) {
+		uint8_t *u = p->pb[g]->u;
+		if (p->is_sub) pbs_dec(p->m, p->n_sub, p->sub[g], p->buf[g], u), p->stale = 1; // pbs_dec() does not update S
+		else pbc_dec(p->pb[g], p->buf[g]);
+		if (pb->out == 0) continue; // with one block, ->ret points to u
+		if (p->map) {
+			uint8_t *out = pb->out[g];
+			for (i = 0; i < p->n_sub; ++i) out[p->map[i]] = u[i];
+		} else memcpy(pb->out[g] + p->out_beg, u, p->n_sub);
+	}
+}
+
+/* Threads are started once and woken for each row; block b is decoded by
+ * thread b%n_threads. The calling thread works as thread 0. */
+typedef struct pbf_pool_s {
+	pbf_t *pb;
+	int n_threads, n_left, quit;
+	int64_t gen; // incremented for each row to decode
+	pthread_mutex_t lock;
+	pthread_cond_t go, done;
+	pthread_t *tid;
+	struct pbf_worker_s *w;
+} pbf_pool_t;
+
+typedef struct pbf_worker_s {
+	pbf_pool_t *pool;
+	int tid;
+} pbf_worker_t;
+
+static void pbf_dec_part(pbf_t *pb, int tid, int n_threads)
+{
+	int b;
+	for (b = tid; b < pb->n_blk; b += n_threads)
+		if (pb->blk[b].n_sub > 0)
+			pbf_dec_blk(pb, &pb->blk[b]);
+}
+
+static void *pbf_worker(void *data)
+{
+	pbf_worker_t *w = (pbf_worker_t*)data;
+	pbf_pool_t *q = w->pool;
+	int64_t gen = 0;
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		while (q->gen == gen && !q->quit)
+			pthread_cond_wait(&q->go, &q->lock);
+		if (q->quit) {
+			pthread_mutex_unlock(&q->lock);
+			break;
+		}
+		gen = q->gen;
+		pthread_mutex_unlock(&q->lock);
+		pbf_dec_part(q->pb, w->tid, q->n_threads);
+		pthread_mutex_lock(&q->lock);
+		if (--q->n_left == 0) pthread_cond_signal(&q->done);
+		pthread_mutex_unlock(&q->lock);
+	}
+	return 0;
+}
+
+static pbf_pool_t *pbf_pool_init(pbf_t *pb, int n_threads)
+{
+	pbf_pool_t *q;
+	int t;
+	q = (pbf_pool_t*)calloc(1, sizeof(pbf_pool_t));
+	q->pb = pb, q->n_threads = n_threads;
+	pthread_mutex_init(&q->lock, 0);
+	pthread_cond_init(&q->go, 0);
+	pthread_cond_init(&q->done, 0);
+	q->tid = (pthread_t*)calloc(n_threads, sizeof(pthread_t));
+	q->w = (pbf_worker_t*)calloc(n_threads, sizeof(pbf_worker_t));
+	for (t = 1; t < n_threads; ++t) {
+		q->w[t].pool = q, q->w[t].tid = t;
+		pthread_create(&q->tid[t], 0, pbf_worker, &q->w[t]);
+	}
+	return q;
+}
+
+static void pbf_pool_destroy(pbf_pool_t *q)
+{
+	int t;
+	if (q == 0) return;
+	pthread_mutex_lock(&q->lock);
+	q->quit = 1;
+	pthread_cond_broadcast(&q->go);
+	pthread_mutex_unlock(&q->lock);
+	for (t = 1; t < q->n_threads; ++t) pthread_join(q->tid[t], 0);
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->go);
+	pthread_cond_destroy(&q->done);
+	free(q->tid); free(q->w); free(q);
+}
+
+// decode the current row with all threads in the pool
+static void pbf_pool_run(pbf_pool_t *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->n_left = q->n_threads - 1;
+	++q->gen;
+	pthread_cond_broadcast(&q->go);
+	pthread_mutex_unlock(&q->lock);
+	pbf_dec_part(q->pb, 0, q->n_threads);
+	pthread_mutex_lock(&q->lock);
+	while (q->n_left > 0)
+		pthread_cond_wait(&q->done, &q->lock);
+	pthread_mutex_unlock(&q->lock);
+}
+
 const uint8_t **pbf_read(pbf_t *pb)
 {
-	int g;
+	int b, g, n_dec = 0;
 	uint8_t t;
 	if (pb->is_writing) return 0;
 	fread(&t, 1, 1, pb->fp);
 	if (t == 'S') {
-		for (g = 0; g < pb->g; ++g)
-			fread(pb->pb[g]->S, 4, pb->m, pb->fp);
+		++pb->i_idx;
+		if (pb->ra_spans > 0) pbf_readahead(pb);
+		pbf_read_S(pb);
 		fread(&t, 1, 1, pb->fp);
 	}
-	if (t == 'B') {
+	if (t != 'B') return 0;
+	for (b = 0; b < pb->n_blk; ++b) {
+		pbf_blk_t *p = &pb->blk[b];
+		int32_t len = 0, l;
+		if (pb->n_blk > 1) fread(&len, 4, 1, pb->fp);
+		if (p->n_sub == 0) { // no selected columns in this block
+			fseek(pb->fp, len, SEEK_CUR);
+			p->stale = 1;
+			continue;
+		}
 		for (g = 0; g < pb->g; ++g) {
-			int32_t l;
 			fread(&l, 4, 1, pb->fp);
-			fread(pb->buf, 1, l, pb->fp);
-			pb->buf[l] = 0;
-			if (pb->n_sub > 0 && pb->n_sub < pb->m) // subset decoding
-				pbs_dec(pb->m, pb->n_sub, pb->sub[g], pb->buf, pb->pb[g]->u);
-			else pbc_dec(pb->pb[g], pb->buf); // full decoding
+			fread(p->buf[g], 1, l, pb->fp);
+			p->buf[g][l] = 0;
 		}
-		++pb->k;
-	} else return 0;
+		n_dec += p->n_sub;
+	}
+	if (pb->pool && n_dec >= pbf_min_par) pbf_pool_run(pb->pool);
+	else pbf_dec_part(pb, 0, 1);
+	++pb->k;
 	return pb->ret;
 }
 
-// find the rank of a subset of columns given S
-static inline void pbf_fill_sub(int m, const int32_t *S, int n_sub, pbs_dat_t *sub, int32_t *invS, int *sub_list)
+// jump to the "S" record before row k and decode forward to k
+static int pbf_seek_idx(pbf_t *pb, uint64_t k)
 {
-	int i;
-	for (i = 0; i < m; ++i) invS[S[i]] = i;
-	for (i = 0; i < n_sub; ++i)
-		sub[i].r = invS[sub_list[sub[i].i]];
-	radix_sort_r(sub, sub + n_sub);
+	int x, i, lo, hi;
+	uint64_t k0;
+	uint8_t t;
+	if (pb->idx == 0 || k >= pb->n) return -1;
+	for (lo = 0, hi = pb->n_seg; hi - lo > 1;) { // find the segment containing row k
+		int mid = (lo + hi) >> 1;
+		if (pb->seg[mid] <= k) lo = mid;
+		else hi = mid;
+	}
+	k0 = (k - pb->seg[lo]) >> pb->shift;
+	pb->i_idx = pb->seg_idx[lo] + k0;
+	if (pb->ra_spans > 0) pbf_readahead(pb);
+	fseek(pb->fp, pb->idx[pb->i_idx], SEEK_SET);
+	fread(&t, 1, 1, pb->fp);
+	assert(t == 'S'); // a bug or corrupted file if it is not an "S" line
+	pbf_read_S(pb);
+	pb->k = pb->seg[lo] + (k0 << pb->shift);
+	x = k - pb->k;
+	for (i = 0; i < x; ++i) pbf_read(pb);
+	return 0;
 }
 
 int pbf_seek(pbf_t *pb, uint64_t k)
 {
-	int x, i, g;
-	uint8_t t;
 	if (pb->is_writing) return -1;
 	if (k == pb->k) return 0;
 	if (k > pb->k && k - pb->k <= 1<<pb->shift) {
 		while (pb->k < k) pbf_read(pb);
 		return 0;
 	}
-	if (pb->idx == 0 || k >= pb->n) return -1;
-	fseek(pb->fp, pb->idx[k>>pb->shift], SEEK_SET);
-	fread(&t, 1, 1, pb->fp);
-	assert(t == 'S'); // a bug or corrupted file if it is not an "S" line
-	for (g = 0; g < pb->g; ++g) {
-		fread(pb->pb[g]->S, 4, pb->m, pb->fp);
-		if (pb->n_sub > 0 && pb->n_sub < pb->m) // update pb->sub if needed
-			pbf_fill_sub(pb->m, pb->pb[g]->S, pb->n_sub, pb->sub[g], pb->invS, pb->sub_list);
-	}
-	pb->k = k >> pb->shift << pb->shift;
-	x = k & ((1<<pb->shift) - 1);
-	for (i = 0; i < x; ++i) pbf_read(pb);
-	return 0;
+	return pbf_seek_idx(pb, k);
 }
 
 int pbf_subset(pbf_t *pb, int n_sub, int *sub)
 {
-	int i, g;
+	int i, b, g, stale = 0;
 	if (n_sub <= 0 || n_sub >= pb->m || sub == 0) n_sub = 0;
-	if ((pb->n_sub = n_sub) != 0) {
-		pb->sub_list = (int*)realloc(pb->sub_list, n_sub * sizeof(int));
-		memcpy(pb->sub_list, sub, n_sub * sizeof(int));
-		for (g = 0; g < pb->g; ++g) {
-			pb->sub[g] = (pbs_dat_t*)realloc(pb->sub[g], n_sub * sizeof(pbs_dat_t));
-			for (i = 0; i < n_sub; ++i) pb->sub[g][i].i = i;
-			pbf_fill_sub(pb->m, pb->pb[g]->S, n_sub, pb->sub[g], pb->invS, pb->sub_list);
+	pb->n_sub = n_sub;
+	for (b = 0; b < pb->n_blk; ++b) { // reset to decoding all columns
+		pbf_blk_t *p = &pb->blk[b];
+		p->n_sub = p->m, p->is_sub = 0, p->out_beg = p->beg;
+		free(p->map); p->map = 0;
+	}
+	if (n_sub > 0) {
+		int32_t *bi;
+		bi = (int32_t*)malloc(n_sub * 4);
+		for (b = 0; b < pb->n_blk; ++b) pb->blk[b].n_sub = 0;
+		for (i = 0; i < n_sub; ++i) { // find the block of each selected column
+			int lo, hi;
+			for (lo = 0, hi = pb->n_blk; hi - lo > 1;) {
+				int mid = (lo + hi) >> 1;
+				if (pb->blk[mid].beg <= sub[i]) lo = mid;
+				else hi = mid;
+			}
+			bi[i] = lo, ++pb->blk[lo].n_sub;
+		}
+		for (b = 0; b < pb->n_blk; ++b) {
+			pbf_blk_t *p = &pb->blk[b];
+			p->sub_list = (int*)realloc(p->sub_list, p->n_sub * sizeof(int));
+			p->map = (int32_t*)malloc(p->n_sub * 4);
+			p->n_sub = 0;
+		}
+		for (i = 0; i < n_sub; ++i) {
+			pbf_blk_t *p = &pb->blk[bi[i]];
+			p->sub_list[p->n_sub] = sub[i] - p->beg;
+			p->map[p->n_sub++] = i;
+		}
+		free(bi);
+		for (b = 0; b < pb->n_blk; ++b) {
+			pbf_blk_t *p = &pb->blk[b];
+			if (p->n_sub == 0) continue;
+			for (i = 0; i < p->n_sub && p->sub_list[i] == i; ++i);
+			p->is_sub = !(i == p->m && p->n_sub == p->m); // decode all if all columns are selected in order
+			for (i = 1; i < p->n_sub && p->map[i] == p->map[0] + i; ++i);
+			if (i == p->n_sub) { // output positions are contiguous
+				p->out_beg = p->map[0];
+				free(p->map); p->map = 0;
+			}
+			if (!p->is_sub) continue;
+			for (g = 0; g < pb->g; ++g) {
+				p->sub[g] = (pbs_dat_t*)realloc(p->sub[g], p->n_sub * sizeof(pbs_dat_t));
+				for (i = 0; i < p->n_sub; ++i) p->sub[g][i].i = i;
+				pbf_fill_sub(p->m, p->pb[g]->S, p->n_sub, p->sub[g], p->invS, p->sub_list);
+			}
+		}
+	}
+	for (b = 0; b < pb->n_blk; ++b)
+		if (pb->blk[b].n_sub > 0 && pb->blk[b].stale) stale = 1;
+	if (stale && !pb->is_writing) { // a block skipped so far is now selected; reload S from the last checkpoint
+		int64_t k = pb->k;
+		pb->k = -1;
+		if (pbf_seek_idx(pb, k) < 0) pb->k = k;
+	}
+	return 0;
+}
+
+int pbf_concat(const char *fn, int n, char *const*fn_in)
+{
+	FILE *fp;
+	pbf_t *pb = 0;
+	int32_t i, j;
+	int64_t n_rows = 0;
+	uint64_t off;
+	uint8_t *buf;
+	if (fn && strcmp(fn, "-") != 0) {
+		if ((fp = fopen(fn, "wb")) == NULL)
+			return -1;
+	} else fp = stdout;
+	buf = (uint8_t*)malloc(0x10000);
+	for (i = 0; i < n; ++i) {
+		pbf_t *p;
+		uint64_t delta, l;
+		if ((p = pbf_open_r(fn_in[i])) == 0 || p->idx == 0) {
+			pbf_close(p);
+			break;
+		}
+		if (pb == 0) { // use the first input for the header
+			pb = (pbf_t*)calloc(1, sizeof(pbf_t));
+			pb->m = p->m, pb->g = p->g, pb->shift = p->shift, pb->n_blk = p->n_blk;
+			pb->blk = (pbf_blk_t*)calloc(p->n_blk, sizeof(pbf_blk_t));
+			for (j = 0; j < p->n_blk; ++j) pb->blk[j].beg = p->blk[j].beg;
+			pbf_write_hdr(fp, pb->m, pb->g, pb->shift, pb->n_blk, pb->blk);
+		} else {
+			int diff = p->m != pb->m || p->g != pb->g || p->shift != pb->shift || p->n_blk != pb->n_blk;
+			for (j = 0; !diff && j < p->n_blk; ++j)
+				if (p->blk[j].beg != pb->blk[j].beg) diff = 1;
+			if (diff) {
+				pbf_close(p);
+				break;
+			}
+		}
+		if (p->n == 0) {
+			pbf_close(p);
+			continue;
+		}
+		// copy "S" and "B" records verbatim
+		delta = ftell(fp) - p->off_hdr;
+		for (off = p->off_hdr; off < p->off_idx; off += l) {
+			l = p->off_idx - off < 0x10000? p->off_idx - off : 0x10000;
+			if (fread(buf, 1, l, p->fp) != l) break;
+			fwrite(buf, 1, l, fp);
+		}
+		// rebase the index
+		if (pb->n_idx + p->n_idx > pb->m_idx) {
+			pb->m_idx = pb->n_idx + p->n_idx;
+			pb->idx = (uint64_t*)realloc(pb->idx, pb->m_idx * 8);
 		}
+		for (j = 0; j < p->n_idx; ++j)
+			pb->idx[pb->n_idx++] = p->idx[j] + delta;
+		pb->seg = (uint64_t*)realloc(pb->seg, (pb->n_seg + p->n_seg) * 8);
+		for (j = 0; j < p->n_seg; ++j)
+			pb->seg[pb->n_seg++] = p->seg[j] + n_rows;
+		n_rows += p->n;
+		pbf_close(p);
 	}
+	free(buf);
+	if (pb == 0 || i < n) { // don't leave a truncated PBF behind
+		if (fp != stdout) {
+			fclose(fp);
+			remove(fn);
+		}
+		if (pb) {
+			free(pb->idx); free(pb->seg); free(pb->blk); free(pb);
+		}
+		return -1;
+	}
+	pbf_write_idx(fp, n_rows, pb->n_idx, pb->idx, pb->n_seg, pb->seg);
+	if (fp != stdout) fclose(fp);
+	free(pb->idx); free(pb->seg); free(pb->blk); free(pb);
 	return 0;
 }
 
+int pbf_reindex(const char *fn, const char *fn_in, int shift, int n_blk, const int32_t *beg)
+{
+	pbf_t *in, *out;
+	const uint8_t **a;
+	int64_t i, n;
+	if ((in = pbf_open_r(fn_in)) == 0) return -1;
+	if (n_blk < 0) { // keep the column blocks of the input
+		int32_t b, *t;
+		t = (int32_t*)alloca(in->n_blk * 4);
+		for (b = 0; b < in->n_blk; ++b) t[b] = in->blk[b].beg;
+		out = pbf_open_wb(fn, in->m, in->g, shift, in->n_blk, t);
+	} else out = pbf_open_wb(fn, in->m, in->g, shift, n_blk, beg);
+	if (out == 0) {
+		pbf_close(in);
+		return -1;
+	}
+	for (i = 0, n = in->n; i < n; ++i) {
+		if ((a = pbf_read(in)) == 0) break;
+		pbf_write(out, (uint8_t*const*)a);
+	}
+	pbf_close(out);
+	pbf_close(in);
+	return i == n? 0 : -1;
+}
+
 int pbf_get_g(const pbf_t *pb) { return pb->g; }
 int pbf_get_m(const pbf_t *pb) { return pb->m; }
 int pbf_get_n(const pbf_t *pb) { return pb->n; }
 int pbf_get_shift(const pbf_t *pb) { return pb->shift; }
+int pbf_get_n_blk(const pbf_t *pb) { return pb->n_blk; }
+
+void pbf_set_n_threads(pbf_t *pb, int n_threads)
+{
+	pb->n_threads = n_threads > 0? n_threads : 1;
+	if (pb->n_threads > pb->n_blk) pb->n_threads = pb->n_blk;
+	pbf_pool_destroy(pb->pool);
+	pb->pool = 0;
+	if (pb->n_threads > 1 && !pb->is_writing)
+		pb->pool = pbf_pool_init(pb, pb->n_threads);
+}
+
+void pbf_set_readahead(pbf_t *pb, int n_spans)
+{
+	if (pb->is_writing || pb->fp == stdin) return;
+	pb->ra_spans = n_spans;
+	if (n_spans > 0) {
+		ra_sequential(fileno(pb->fp));
+		pbf_readahead(pb);
+	}
+}
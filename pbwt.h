@@ -34,6 +34,21 @@ extern "C" {
  */
 pbf_t *pbf_open_w(const char *fn, int m, int g, int shift);
 
+/**
+ * Open PBF file for write, with columns partitioned into blocks
+ *
+ * Each block is encoded with its own PBWT, such that a reader may skip
+ * blocks without selected columns and decode the rest in parallel.
+ *
+ * @param fn     file name. NULL or "-" for stdout
+ * @param m      number of columns
+ * @param g      number of groups
+ * @param shift  keeping S every 1<<shift rows
+ * @param n_blk  number of blocks; 1 for the PBF\1 format without blocks
+ * @param beg    first column of each block, in the ascending order; beg[0] must be 0
+ */
+pbf_t *pbf_open_wb(const char *fn, int m, int g, int shift, int n_blk, const int32_t *beg);
+
 /**
  * Open PBF for read
  *
@@ -82,10 +97,60 @@ int pbf_seek(pbf_t *pb, uint64_t k);
  */
 int pbf_subset(pbf_t *fp, int n_sub, int *sub);
 
+/**
+ * Concatenate PBF files without re-encoding
+ *
+ * Each input becomes a segment, at the start of which S is reset to identity.
+ * All inputs must have the same number of columns, groups and shift.
+ *
+ * @param fn     output file name. NULL or "-" for stdout
+ * @param n      number of input files
+ * @param fn_in  input file names
+ * @return 0 on success; -1 on error
+ */
+int pbf_concat(const char *fn, int n, char *const*fn_in);
+
+/**
+ * Rewrite a PBF file with a different checkpoint interval or column blocks
+ *
+ * All rows are decoded and re-encoded as one segment; S is written every
+ * 1<<shift rows.
+ *
+ * @param fn     output file name. NULL or "-" for stdout
+ * @param fn_in  input file name
+ * @param shift  keeping S every 1<<shift rows
+ * @param n_blk  number of column blocks; <0 to keep those of the input
+ * @param beg    first column of each block (see pbf_open_wb())
+ * @return 0 on success; -1 on error
+ */
+int pbf_reindex(const char *fn, const char *fn_in, int shift, int n_blk, const int32_t *beg);
+
+extern int pbf_min_par; // min number of decoded columns for parallel decoding [65536]
+
 int pbf_get_g(const pbf_t *pb);
 int pbf_get_m(const pbf_t *pb);
 int pbf_get_n(const pbf_t *pb);
 int pbf_get_shift(const pbf_t *pb);
+int pbf_get_n_blk(const pbf_t *pb);
+
+/**
+ * Decode column blocks in parallel
+ *
+ * Only effective for a PBF with column blocks when at least pbf_min_par
+ * columns are decoded. Threads are started here and stopped by pbf_close().
+ *
+ * @param pb         PBF file handler
+ * @param n_threads  number of threads
+ */
+void pbf_set_n_threads(pbf_t *pb, int n_threads);
+
+/**
+ * Prefetch checkpoint spans ahead of reading
+ *
+ * @param pb       PBF file handler
+ * @param n_spans  prefetch the next n_spans spans between "S" records (see ra_willneed()); 0 to disable
+ */
+void pbf_set_readahead(pbf_t *pb, int n_spans);
 
 /***********************
  * Low-level functions *
@@ -119,6 +184,23 @@ void pbc_enc(pbc_t *pb, const uint8_t *a);
  */
 void pbc_dec(pbc_t *pb, const uint8_t *b);
 
+/**
+ * Advance the positional prefix array and the divergence array by one row
+ *
+ * Haplotypes identical from row $s to row $k are adjacent in $S, and
+ * D[j]<=s for all but the first of them. To track matches from row $s, start
+ * with any permutation in S0 and D0[j]=s.
+ *
+ * @param m    number of columns
+ * @param k    index of the row
+ * @param S0   prefix array at row k-1
+ * @param D0   divergence array at row k-1
+ * @param a    row k; symbols 0-3
+ * @param S    prefix array at row k (out)
+ * @param D    divergence array at row k (out)
+ */
+void pbc_div_core(int m, int k, const int32_t *S0, const int32_t *D0, const uint8_t *a, int32_t *S, int32_t *D);
+
 /**
  * Decode a subset of columns without decoding all columns
  *
@@ -0,0 +1,308 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "bgt.h"
+#include "kstring.h"
+
+/* Randomized PCA (Halko et al, 2011) of the standardized genotype matrix X,
+ * with M sites as rows and N samples as columns. Each pass over the BGT
+ * computes Y = X'XQ for an N-by-L matrix Q, one site at a time, so that X is
+ * never held in memory:
+ *
+ *   Y <- X'X Omega, Omega random;  repeat: Q <- orth(Y), Y <- X'XQ
+ *   Q <- orth(Y), Z <- X'XQ, B <- Q'Z;  eigen-decompose B = V D V'
+ *
+ * and the top eigenvectors of the GRM X'X/M are columns of QV. All N-by-L
+ * matrices are row-major, i.e. a[i*L+l]. */
+
+typedef struct {
+	int N, L;
+	const char *reg;
+	const double *q;
+	double **y; // per-thread accumulators
+	int64_t *n_sites; // per-thread #sites
+	bgtm_t **bm;
+} pca_shared_t;
+
+static int64_t pca_read(bgtm_t *bm, int N, int L, const double *q, double *y)
+{
+	int i, l;
+	int64_t n_sites = 0;
+	double *t;
+	uint8_t *d;
+	bcf1_t *b;
+	t = (double*)malloc(L * sizeof(double));
+	d = (uint8_t*)malloc(N);
+	b = bcf_init1();
+	while (bgtm_read(bm, b) >= 0) {
+		const uint8_t *a0 = bm->a[0], *a1 = bm->a[1];
+		double p, sd, v[4];
+		if (bm->ss.an == 0 || bm->ss.ac[0] == 0 || bm->ss.ac[0] == bm->ss.an) continue;
+		p = (double)bm->ss.ac[0] / bm->ss.an;
+		sd = sqrt(2. * p * (1. - p));
+		for (i = 0; i < 3; ++i) v[i] = (i - 2. * p) / sd;
+		v[3] = 0.; // missing genotypes are imputed to the mean
+		for (i = 0; i < N; ++i) { // ALT dosage; <M> is counted as REF
+			int c1 = a1[i<<1|0]<<1 | a0[i<<1|0], c2 = a1[i<<1|1]<<1 | a0[i<<1|1];
+			d[i] = c1 == 2 || c2 == 2? 3 : (c1 == 1) + (c2 == 1);
+		}
+		memset(t, 0, L * sizeof(double));
+		for (i = 0; i < N; ++i) { // t = xQ
+			const double *qi = &q[(size_t)i * L];
+			double vi = v[d[i]];
+			for (l = 0; l < L; ++l) t[l] += vi * qi[l];
+		}
+		for (i = 0; i < N; ++i) { // y += x't
+			double *yi = &y[(size_t)i * L], vi = v[d[i]];
+			if (vi == 0.) continue;
+			for (l = 0; l < L; ++l) yi[l] += vi * t[l];
+		}
+		++n_sites;
+	}
+	bcf_destroy1(b);
+	free(t); free(d);
+	return n_sites;
+}
+
+static void pca_chunk(void *data, int tid, int chunk, int64_t beg, int64_t end)
+{
+	pca_shared_t *sh = (pca_shared_t*)data;
+	bgtm_set_start(sh->bm[tid], beg);
+	bgtm_set_end(sh->bm[tid], end);
+	sh->n_sites[tid] += pca_read(sh->bm[tid], sh->N, sh->L, sh->q, sh->y[tid]);
+}
+
+// a pass over the BGT: y = X'Xq; return #sites used
+static int64_t pca_pass(pca_shared_t *sh, int n_threads, const double *q, double *y)
+{
+	int i;
+	size_t j, NL = (size_t)sh->N * sh->L;
+	int64_t n_sites = 0;
+	sh->q = q;
+	for (i = 0; i < n_threads; ++i) {
+		memset(sh->y[i], 0, NL * sizeof(double));
+		sh->n_sites[i] = 0;
+	}
+	if (n_threads > 1) {
+		const bgt_t *bgt = sh->bm[0]->bgt[0];
+		bgt_chunks(bgt_get_n(bgt), pbf_get_shift(bgt->pb), n_threads, pca_chunk, sh);
+	} else {
+		if (sh->reg) bgtm_set_region(sh->bm[0], sh->reg);
+		else bgtm_set_start(sh->bm[0], 0);
+		sh->n_sites[0] = pca_read(sh->bm[0], sh->N, sh->L, sh->q, sh->y[0]);
+	}
+	memcpy(y, sh->y[0], NL * sizeof(double));
+	for (i = 1; i < n_threads; ++i)
+		for (j = 0; j < NL; ++j) y[j] += sh->y[i][j];
+	for (i = 0; i < n_threads; ++i) n_sites += sh->n_sites[i];
+	return n_sites;
+}
+
+// orthonormalize columns of a in place with modified Gram-Schmidt
+static void pca_orth(int N, int L, double *a)
+{
+	int i, l, m;
+	for (l = 0; l < L; ++l) {
+		double s;
+		for (m = 0; m < l; ++m) {
+			for (i = 0, s = 0.; i < N; ++i) s += a[(size_t)i*L+l] * a[(size_t)i*L+m];
+			for (i = 0; i < N; ++i) a[(size_t)i*L+l] -= s * a[(size_t)i*L+m];
+		}
+		for (i = 0, s = 0.; i < N; ++i) s += a[(size_t)i*L+l] * a[(size_t)i*L+l];
+		s = s > 0.? 1. / sqrt(s) : 0.;
+		for (i = 0; i < N; ++i) a[(size_t)i*L+l] *= s;
+	}
+}
+
+// eigen-decomposition of an L-by-L symmetric matrix with cyclic Jacobi rotations; eigenvectors are columns of v
+static void pca_jacobi(int L, double *a, double *v)
+{
+	int i, j, k, sweep;
+	for (i = 0; i < L * L; ++i) v[i] = 0.;
+	for (i = 0; i < L; ++i) v[i*L+i] = 1.;
+	for (sweep = 0; sweep < 100; ++sweep) {
+		double off = 0.;
+		for (i = 0; i < L; ++i)
+			for (j = i + 1; j < L; ++j) off += a[i*L+j] * a[i*L+j];
+		if (off < 1e-22) break;
+		for (i = 0; i < L; ++i) {
+			for (j = i + 1; j < L; ++j) {
+				double th, t, c, s;
+				if (fabs(a[i*L+j]) < 1e-300) continue;
+				th = (a[j*L+j] - a[i*L+i]) / (2. * a[i*L+j]);
+				t = (th >= 0.? 1. : -1.) / (fabs(th) + sqrt(th * th + 1.));
+				c = 1. / sqrt(t * t + 1.), s = t * c;
+				for (k = 0; k < L; ++k) { // columns i and j
+					double x = a[k*L+i], y = a[k*L+j];
+					a[k*L+i] = c * x - s * y, a[k*L+j] = s * x + c * y;
+				}
+				for (k = 0; k < L; ++k) { // rows i and j
+					double x = a[i*L+k], y = a[j*L+k];
+					a[i*L+k] = c * x - s * y, a[j*L+k] = s * x + c * y;
+				}
+				for (k = 0; k < L; ++k) {
+					double x = v[k*L+i], y = v[k*L+j];
+					v[k*L+i] = c * x - s * y, v[k*L+j] = s * x + c * y;
+				}
+			}
+		}
+	}
+}
+
+static bgtm_t *pca_reader_init(int n_files, bgt_file_t **files, const char *reg, const char *site_flt, int n_groups, char *const*gexpr)
+{
+	int i;
+	bgtm_t *bm;
+	bm = bgtm_reader_init(n_files, files);
+	bgtm_set_flag(bm, BGT_F_SET_AC|BGT_F_NO_GT);
+	if (site_flt && bgtm_set_flt_site(bm, site_flt) != 0) {
+		fprintf(stderr, "[E::%s] failed to set frequency filters. Syntax error?\n", __func__);
+		goto pca_err;
+	}
+	if (reg && bgtm_set_region(bm, reg) < 0) {
+		fprintf(stderr, "[E::%s] failed to set region. Region format error?\n", __func__);
+		goto pca_err;
+	}
+	for (i = 0; i < n_groups; ++i) {
+		if (bgtm_add_group(bm, gexpr[i]) < 0) {
+			fprintf(stderr, "[E::%s] failed to add sample group '%s'.\n", __func__, gexpr[i]);
+			goto pca_err;
+		}
+	}
+	bgtm_prepare(bm);
+	return bm;
+
+pca_err:
+	bgtm_reader_destroy(bm);
+	return 0;
+}
+
+int main_pca(int argc, char *argv[])
+{
+	int i, j, l, c, n_files = 0, n_groups = 0, n_threads = 1, k = 10, n_iter = 10, N, L, *order;
+	char *reg = 0, *site_flt = 0, *gexpr[BGT_MAX_GROUPS];
+	double *q, *y, *B, *V;
+	int64_t n_sites;
+	bgt_file_t **files;
+	pca_shared_t sh;
+	kstring_t s = {0,0,0};
+
+	while ((c = getopt(argc, argv, "r:f:s:k:i:@:")) >= 0) {
+		if (c == 'r') reg = optarg;
+		else if (c == 'f') site_flt = optarg;
+		else if (c == 'k') k = atoi(optarg);
+		else if (c == 'i') n_iter = atoi(optarg);
+		else if (c == '@') n_threads = atoi(optarg);
+		else if (c == 's' && n_groups < BGT_MAX_GROUPS) gexpr[n_groups++] = optarg;
+	}
+	if (argc - optind < 1 || k <= 0) {
+		fprintf(stderr, "Usage: bgt pca [options] <bgt-prefix> [...]\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -k INT       number of principal components [%d]\n", k);
+		fprintf(stderr, "  -i INT       number of power iterations; %d passes over the data in total [%d]\n", n_iter + 2, n_iter);
+		fprintf(stderr, "  -s EXPR      samples list (see 'bgt view') [all]\n");
+		fprintf(stderr, "  -r STR       region [all]\n");
+		fprintf(stderr, "  -f STR       frequency filters, e.g. 'AC/AN>.01' []\n");
+		fprintf(stderr, "  -@ INT       number of threads; ignored with -r or multiple BGTs [1]\n");
+		fprintf(stderr, "Output: a line of eigenvalues of the GRM, followed by a line per sample giving\n");
+		fprintf(stderr, "  the sample name and its coordinates on each principal component.\n");
+		return 1;
+	}
+
+	n_files = argc - optind;
+	files = (bgt_file_t**)calloc(n_files, sizeof(bgt_file_t*));
+	for (i = 0; i < n_files; ++i) {
+		files[i] = bgt_open(argv[optind+i]);
+		if (files[i] == 0) {
+			fprintf(stderr, "[E::%s] failed to open BGT with prefix '%s'\n", __func__, argv[optind+i]);
+			return 1;
+		}
+	}
+	if (n_files > 1 || reg) n_threads = 1;
+	if (n_threads < 1) n_threads = 1;
+
+	memset(&sh, 0, sizeof(pca_shared_t));
+	sh.reg = reg;
+	sh.bm = (bgtm_t**)calloc(n_threads, sizeof(bgtm_t*));
+	for (i = 0; i < n_threads; ++i)
+		if ((sh.bm[i] = pca_reader_init(n_files, files, reg, site_flt, n_groups, gexpr)) == 0)
+			return 1;
+	N = sh.N = sh.bm[0]->n_out;
+	if (N < 2) {
+		fprintf(stderr, "[E::%s] at least two samples are required\n", __func__);
+		return 1;
+	}
+	L = sh.L = k + 10 < N? k + 10 : N; // oversampling
+	if (k > L) k = L;
+	sh.n_sites = (int64_t*)calloc(n_threads, sizeof(int64_t));
+	sh.y = (double**)calloc(n_threads, sizeof(double*));
+	for (i = 0; i < n_threads; ++i)
+		sh.y[i] = (double*)malloc((size_t)N * L * sizeof(double));
+	q = (double*)malloc((size_t)N * L * sizeof(double));
+	y = (double*)malloc((size_t)N * L * sizeof(double));
+
+	srand48(11);
+	for (j = 0; j < N * L; ++j) { // Gaussian with Box-Muller
+		double u1 = drand48(), u2 = drand48();
+		q[j] = sqrt(-2. * log(1. - u1)) * cos(2. * M_PI * u2);
+	}
+	pca_pass(&sh, n_threads, q, y);
+	for (i = 0; i < n_iter; ++i) {
+		pca_orth(N, L, y);
+		memcpy(q, y, (size_t)N * L * sizeof(double));
+		pca_pass(&sh, n_threads, q, y);
+	}
+	pca_orth(N, L, y);
+	memcpy(q, y, (size_t)N * L * sizeof(double));
+	n_sites = pca_pass(&sh, n_threads, q, y); // y = X'XQ
+	if (n_sites == 0) {
+		fprintf(stderr, "[E::%s] no polymorphic sites\n", __func__);
+		return 1;
+	}
+
+	// B = Q'X'XQ/M, and its eigenvectors
+	B = (double*)calloc(L * L, sizeof(double));
+	V = (double*)malloc(L * L * sizeof(double));
+	for (i = 0; i < N; ++i)
+		for (l = 0; l < L; ++l)
+			for (j = 0; j < L; ++j)
+				B[l*L+j] += q[(size_t)i*L+l] * y[(size_t)i*L+j] / n_sites;
+	for (l = 0; l < L; ++l) // symmetrize against rounding errors
+		for (j = l + 1; j < L; ++j)
+			B[l*L+j] = B[j*L+l] = .5 * (B[l*L+j] + B[j*L+l]);
+	pca_jacobi(L, B, V);
+	order = (int*)malloc(L * sizeof(int));
+	for (l = 0; l < L; ++l) order[l] = l;
+	for (l = 1; l < L; ++l) // insertion sort by decreasing eigenvalues
+		for (j = l; j > 0 && B[order[j]*L+order[j]] > B[order[j-1]*L+order[j-1]]; --j) {
+			int t = order[j]; order[j] = order[j-1]; order[j-1] = t;
+		}
+
+	kputs("#eigval", &s);
+	for (l = 0; l < k; ++l) ksprintf(&s, "\t%.6g", B[order[l]*L+order[l]]);
+	puts(s.s);
+	for (i = 0; i < N; ++i) {
+		const bgtm_t *bm = sh.bm[0];
+		const bgt_t *bgt = bm->bgt[bm->sample_idx[i]>>32];
+		s.l = 0;
+		kputs(bgt->f->f->rows[(uint32_t)bm->sample_idx[i]].name, &s);
+		for (l = 0; l < k; ++l) { // (QV)[i][order[l]]
+			double x = 0.;
+			for (j = 0; j < L; ++j) x += q[(size_t)i*L+j] * V[j*L+order[l]];
+			ksprintf(&s, "\t%.6f", x);
+		}
+		puts(s.s);
+	}
+
+	free(s.s); free(order); free(B); free(V); free(q); free(y);
+	for (i = 0; i < n_threads; ++i) {
+		free(sh.y[i]);
+		bgtm_reader_destroy(sh.bm[i]);
+	}
+	free(sh.y); free(sh.bm); free(sh.n_sites);
+	for (i = 0; i < n_files; ++i) bgt_close(files[i]);
+	free(files);
+	return 0;
+}
@@ -0,0 +1,294 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "bgt.h"
+#include "kstring.h"
+
+/* Per-step bins of additive statistics. A window spans w/step consecutive
+ * bins, so bins from different threads or chunks can simply be summed. For
+ * each bin, x[] keeps #sites, then pi, S and theta_W sums for each group, then
+ * the numerator and denominator of Hudson's Fst for each pair of groups. */
+typedef struct {
+	int64_t n, m; // number of bins
+	double *x;
+} ps_bins_t;
+
+typedef struct {
+	int n_ctg, n_groups, n_val, step;
+	int N[BGT_MAX_GROUPS];
+	double *a1; // a1[n] = \sum_{i=1}^{n-1} 1/i
+	ps_bins_t *b;
+} ps_t;
+
+static void ps_init(ps_t *p, int n_ctg, int n_groups, const int *N, int step)
+{
+	int i, max_n = 0;
+	memset(p, 0, sizeof(ps_t));
+	p->n_ctg = n_ctg, p->n_groups = n_groups, p->step = step;
+	p->n_val = 1 + 3 * n_groups + n_groups * (n_groups - 1);
+	for (i = 0; i < n_groups; ++i) {
+		p->N[i] = N[i];
+		max_n = max_n > N[i]? max_n : N[i];
+	}
+	p->a1 = (double*)calloc(max_n + 1, sizeof(double));
+	for (i = 2; i <= max_n; ++i) p->a1[i] = p->a1[i-1] + 1. / (i - 1);
+	p->b = (ps_bins_t*)calloc(n_ctg, sizeof(ps_bins_t));
+}
+
+static void ps_destroy(ps_t *p)
+{
+	int i;
+	for (i = 0; i < p->n_ctg; ++i) free(p->b[i].x);
+	free(p->b); free(p->a1);
+}
+
+static double *ps_get_bin(ps_t *p, int rid, int64_t bin)
+{
+	ps_bins_t *b = &p->b[rid];
+	if (bin >= b->m) {
+		int64_t old_m = b->m;
+		b->m = bin + 1;
+		kroundup32(b->m);
+		b->x = (double*)realloc(b->x, b->m * p->n_val * sizeof(double));
+		memset(b->x + old_m * p->n_val, 0, (b->m - old_m) * p->n_val * sizeof(double));
+	}
+	if (bin >= b->n) b->n = bin + 1;
+	return b->x + bin * p->n_val;
+}
+
+static void ps_add(ps_t *p, const bcf1_t *b, const bgt_info_t *ss)
+{
+	int i, j;
+	double *x, *y, f[BGT_MAX_GROUPS];
+	x = ps_get_bin(p, b->rid, b->pos / p->step);
+	++x[0];
+	for (i = 0, y = x + 1; i < p->n_groups; ++i, y += 3) {
+		int n = p->n_groups > 1? ss->gan[i] : ss->an;
+		int c = p->n_groups > 1? ss->gac[i][0] : ss->ac[0];
+		f[i] = n > 0? (double)c / n : -1.;
+		if (c > 0 && c < n) {
+			y[0] += 2. * c * (n - c) / ((double)n * (n - 1));
+			y[1] += 1.;
+			y[2] += 1. / p->a1[n];
+		}
+	}
+	for (i = 0; i < p->n_groups; ++i) {
+		int ni = p->n_groups > 1? ss->gan[i] : ss->an;
+		for (j = i + 1; j < p->n_groups; ++j, y += 2) {
+			int nj = ss->gan[j];
+			double num, den;
+			if (ni < 2 || nj < 2) continue;
+			num = (f[i] - f[j]) * (f[i] - f[j]) - f[i] * (1. - f[i]) / (ni - 1) - f[j] * (1. - f[j]) / (nj - 1);
+			den = f[i] * (1. - f[j]) + f[j] * (1. - f[i]);
+			y[0] += num, y[1] += den;
+		}
+	}
+}
+
+static void ps_merge(ps_t *p, const ps_t *q)
+{
+	int i;
+	int64_t j;
+	for (i = 0; i < p->n_ctg; ++i) {
+		const ps_bins_t *b = &q->b[i];
+		double *x;
+		if (b->n == 0) continue;
+		x = ps_get_bin(p, i, b->n - 1) - (b->n - 1) * p->n_val;
+		for (j = 0; j < b->n * p->n_val; ++j)
+			x[j] += b->x[j];
+	}
+}
+
+static double ps_tajima_d(int n, double pi, double S)
+{
+	double a1 = 0., a2 = 0., b1, b2, c1, c2, e1, e2;
+	int i;
+	if (n < 4 || S == 0.) return NAN;
+	for (i = 1; i < n; ++i) a1 += 1. / i, a2 += 1. / ((double)i * i);
+	b1 = (n + 1.) / (3. * (n - 1));
+	b2 = 2. * ((double)n * n + n + 3) / (9. * n * (n - 1));
+	c1 = b1 - 1. / a1;
+	c2 = b2 - (n + 2.) / (a1 * n) + a2 / (a1 * a1);
+	e1 = c1 / a1, e2 = c2 / (a1 * a1 + a2);
+	return (pi - S / a1) / sqrt(e1 * S + e2 * S * (S - 1));
+}
+
+static inline void ps_putd(double x, kstring_t *s)
+{
+	if (isnan(x)) kputs("\tNA", s);
+	else ksprintf(s, "\t%.6g", x);
+}
+
+static void ps_print(const ps_t *p, const bcf_hdr_t *h, int win)
+{
+	int i, j, k, m = win / p->step, rid;
+	int64_t w;
+	double *sum;
+	kstring_t s = {0,0,0};
+
+	kputs("#chr\tstart\tend\tnSites", &s);
+	for (i = 0; i < p->n_groups; ++i)
+		ksprintf(&s, "\tpi%d\tthetaW%d\tD%d", i + 1, i + 1, i + 1);
+	for (i = 0; i < p->n_groups; ++i)
+		for (j = i + 1; j < p->n_groups; ++j)
+			ksprintf(&s, "\tFst%d_%d", i + 1, j + 1);
+	puts(s.s);
+	sum = (double*)malloc(p->n_val * sizeof(double));
+	for (rid = 0; rid < p->n_ctg; ++rid) {
+		const ps_bins_t *b = &p->b[rid];
+		int64_t len = h->id[BCF_DT_CTG][rid].val->info[0]; // 0 if ##contig has no length
+		for (w = 0; w < b->n; ++w) { // window [w*step,w*step+win), clipped at the contig end if known
+			const double *y;
+			int64_t st = w * p->step, en = len > 0 && st + win > len? len : st + win;
+			memset(sum, 0, p->n_val * sizeof(double));
+			for (k = 0; k < m && w + k < b->n; ++k)
+				for (i = 0; i < p->n_val; ++i)
+					sum[i] += b->x[(w + k) * p->n_val + i];
+			if (sum[0] == 0.) continue;
+			s.l = 0;
+			ksprintf(&s, "%s\t%lld\t%lld\t%d", h->id[BCF_DT_CTG][rid].key, (long long)st, (long long)en, (int)sum[0]);
+			for (i = 0, y = sum + 1; i < p->n_groups; ++i, y += 3) {
+				ps_putd(y[0] / (en - st), &s);
+				ps_putd(y[2] / (en - st), &s);
+				ps_putd(ps_tajima_d(p->N[i], y[0], y[1]), &s);
+			}
+			for (i = 0; i < p->n_groups; ++i)
+				for (j = i + 1; j < p->n_groups; ++j, y += 2)
+					ps_putd(y[1] > 0.? y[0] / y[1] : NAN, &s);
+			puts(s.s);
+		}
+	}
+	free(sum); free(s.s);
+}
+
+/*** multi-threading over checkpoint chunks ***/
+
+typedef struct {
+	bgtm_t **bm;
+	ps_t *p;
+} ps_shared_t;
+
+static void ps_read(bgtm_t *bm, ps_t *p)
+{
+	bcf1_t *b;
+	b = bcf_init1();
+	while (bgtm_read(bm, b) >= 0)
+		ps_add(p, b, &bm->ss);
+	bcf_destroy1(b);
+}
+
+static void ps_chunk(void *data, int tid, int chunk, int64_t beg, int64_t end)
+{
+	ps_shared_t *sh = (ps_shared_t*)data;
+	bgtm_set_start(sh->bm[tid], beg);
+	bgtm_set_end(sh->bm[tid], end);
+	ps_read(sh->bm[tid], &sh->p[tid]);
+}
+
+static bgtm_t *ps_reader_init(int n_files, bgt_file_t **files, const char *reg, const char *site_flt, int n_groups, char *const*gexpr)
+{
+	int i;
+	bgtm_t *bm;
+	bm = bgtm_reader_init(n_files, files);
+	bgtm_set_flag(bm, BGT_F_SET_AC|BGT_F_NO_GT);
+	if (site_flt && bgtm_set_flt_site(bm, site_flt) != 0) {
+		fprintf(stderr, "[E::%s] failed to set frequency filters. Syntax error?\n", __func__);
+		goto ps_err;
+	}
+	if (reg && bgtm_set_region(bm, reg) < 0) {
+		fprintf(stderr, "[E::%s] failed to set region. Region format error?\n", __func__);
+		goto ps_err;
+	}
+	for (i = 0; i < n_groups; ++i) {
+		if (bgtm_add_group(bm, gexpr[i]) < 0) {
+			fprintf(stderr, "[E::%s] failed to add sample group '%s'.\n", __func__, gexpr[i]);
+			goto ps_err;
+		}
+	}
+	bgtm_prepare(bm);
+	return bm;
+
+ps_err:
+	bgtm_reader_destroy(bm);
+	return 0;
+}
+
+int main_popstats(int argc, char *argv[])
+{
+	int i, c, n_files = 0, n_groups = 0, n_dim, n_threads = 1, win = 50000, step = 0;
+	int N[BGT_MAX_GROUPS];
+	char *reg = 0, *site_flt = 0, *gexpr[BGT_MAX_GROUPS];
+	bgt_file_t **files;
+	bgtm_t *bm;
+	ps_t p;
+
+	while ((c = getopt(argc, argv, "r:f:s:w:S:@:")) >= 0) {
+		if (c == 'r') reg = optarg;
+		else if (c == 'f') site_flt = optarg;
+		else if (c == 'w') win = atoi(optarg);
+		else if (c == 'S') step = atoi(optarg);
+		else if (c == '@') n_threads = atoi(optarg);
+		else if (c == 's' && n_groups < BGT_MAX_GROUPS) gexpr[n_groups++] = optarg;
+	}
+	if (step <= 0) step = win;
+	if (argc - optind < 1 || win <= 0 || win % step != 0) {
+		fprintf(stderr, "Usage: bgt popstats [options] <bgt-prefix> [...]\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -s EXPR      samples list (see 'bgt view'); Fst is computed between groups [all]\n");
+		fprintf(stderr, "  -w INT       window size [%d]\n", win);
+		fprintf(stderr, "  -S INT       step size, dividing the window size [window size]\n");
+		fprintf(stderr, "  -r STR       region [all]\n");
+		fprintf(stderr, "  -f STR       frequency filters []\n");
+		fprintf(stderr, "  -@ INT       number of threads; ignored with -r or multiple BGTs [1]\n");
+		fprintf(stderr, "Output: chr, start, end and #sites of each non-empty window, followed by pi and\n");
+		fprintf(stderr, "  theta_W per bp and Tajima's D for each group, and Hudson's Fst for each pair\n");
+		fprintf(stderr, "  of groups. Windows are clipped at the contig length in the header, if given,\n");
+		fprintf(stderr, "  and per-bp values are computed over the clipped length.\n");
+		return 1;
+	}
+
+	n_files = argc - optind;
+	files = (bgt_file_t**)calloc(n_files, sizeof(bgt_file_t*));
+	for (i = 0; i < n_files; ++i) {
+		files[i] = bgt_open(argv[optind+i]);
+		if (files[i] == 0) {
+			fprintf(stderr, "[E::%s] failed to open BGT with prefix '%s'\n", __func__, argv[optind+i]);
+			return 1;
+		}
+	}
+	if ((bm = ps_reader_init(n_files, files, reg, site_flt, n_groups, gexpr)) == 0)
+		return 1;
+	n_dim = n_groups > 0? n_groups : 1;
+	for (i = 0; i < n_dim; ++i) N[i] = 0;
+	for (i = 0; i < bm->n_out; ++i)
+		N[n_dim > 1? bm->group[i] - 1 : 0] += 2;
+	ps_init(&p, bm->h_out->n[BCF_DT_CTG], n_dim, N, step);
+
+	if (n_threads > 1 && n_files == 1 && reg == 0) {
+		ps_shared_t sh;
+		sh.bm = (bgtm_t**)calloc(n_threads, sizeof(bgtm_t*));
+		sh.p = (ps_t*)calloc(n_threads, sizeof(ps_t));
+		sh.bm[0] = bm;
+		for (i = 1; i < n_threads; ++i)
+			sh.bm[i] = ps_reader_init(n_files, files, reg, site_flt, n_groups, gexpr);
+		for (i = 0; i < n_threads; ++i)
+			ps_init(&sh.p[i], p.n_ctg, n_dim, N, step);
+		bgt_chunks(bgt_get_n(bm->bgt[0]), pbf_get_shift(bm->bgt[0]->pb), n_threads, ps_chunk, &sh);
+		for (i = 0; i < n_threads; ++i) {
+			ps_merge(&p, &sh.p[i]);
+			ps_destroy(&sh.p[i]);
+			if (i > 0) bgtm_reader_destroy(sh.bm[i]);
+		}
+		free(sh.p); free(sh.bm);
+	} else ps_read(bm, &p);
+
+	ps_print(&p, bm->h_out, win);
+
+	ps_destroy(&p);
+	bgtm_reader_destroy(bm);
+	for (i = 0; i < n_files; ++i) bgt_close(files[i]);
+	free(files);
+	return 0;
+}
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "readahead.h"
+
+/*
+ * Ranges passed to ra_willneed() are read into the page cache by one
+ * background thread, so that prefetching also works where the kernel ignores
+ * read-ahead hints (e.g. network file systems) or has none. Requests are put
+ * in a bounded queue; a request is dropped when the queue is full, as the
+ * reader will read the range itself anyway. Each queued request holds a dup()
+ * of the descriptor because the caller may close it before the range is read.
+ */
+
+#define RA_MAX_JOBS 32
+#define RA_MAX_LEN  (8<<20) // a larger range is truncated
+#define RA_BUF_SIZE 0x10000
+
+typedef struct {
+	int fd, fd0; // dup()ed and original descriptors
+	int64_t off, len;
+} ra_job_t;
+
+static struct {
+	int started, quit, n, i; // #queued jobs; index of the first one
+	ra_job_t job[RA_MAX_JOBS];
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cv;
+} ra_q = { 0, 0, 0, 0, {{0,0,0,0}}, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static void *ra_worker(void *data)
+{
+	uint8_t *buf;
+	buf = (uint8_t*)malloc(RA_BUF_SIZE);
+	for (;;) {
+		ra_job_t j;
+		int64_t l;
+		pthread_mutex_lock(&ra_q.lock);
+		while (!ra_q.quit && ra_q.n == 0)
+			pthread_cond_wait(&ra_q.cv, &ra_q.lock);
+		if (ra_q.quit) { // the remaining jobs are closed by ra_stop()
+			pthread_mutex_unlock(&ra_q.lock);
+			break;
+		}
+		j = ra_q.job[ra_q.i];
+		ra_q.i = (ra_q.i + 1) % RA_MAX_JOBS, --ra_q.n;
+		pthread_mutex_unlock(&ra_q.lock);
+		for (l = 0; l < j.len; l += RA_BUF_SIZE)
+			if (pread(j.fd, buf, j.len - l < RA_BUF_SIZE? j.len - l : RA_BUF_SIZE, j.off + l) <= 0)
+				break;
+		close(j.fd);
+	}
+	free(buf);
+	return 0;
+}
+
+static void ra_stop(void)
+{
+	pthread_mutex_lock(&ra_q.lock);
+	ra_q.quit = 1;
+	pthread_cond_signal(&ra_q.cv);
+	pthread_mutex_unlock(&ra_q.lock);
+	pthread_join(ra_q.tid, 0);
+	for (; ra_q.n > 0; --ra_q.n, ra_q.i = (ra_q.i + 1) % RA_MAX_JOBS)
+		close(ra_q.job[ra_q.i].fd);
+}
+
+void ra_willneed(int fd, int64_t off, int64_t len)
+{
+	ra_job_t *last;
+	if (fd < 0 || len <= 0) return;
+	if (len > RA_MAX_LEN) len = RA_MAX_LEN;
+#ifdef POSIX_FADV_WILLNEED
+	posix_fadvise(fd, off, len, POSIX_FADV_WILLNEED);
+#endif
+	pthread_mutex_lock(&ra_q.lock);
+	if (ra_q.quit) goto ra_end;
+	if (!ra_q.started) {
+		if (pthread_create(&ra_q.tid, 0, ra_worker, 0) != 0) {
+			ra_q.quit = 1; // no prefetching from now on
+			goto ra_end;
+		}
+		ra_q.started = 1;
+		atexit(ra_stop);
+	}
+	last = ra_q.n? &ra_q.job[(ra_q.i + ra_q.n - 1) % RA_MAX_JOBS] : 0;
+	if (last && last->fd0 == fd && off >= last->off && off <= last->off + last->len) { // extend the last request
+		if (off + len > last->off + last->len && off + len - last->off <= RA_MAX_LEN)
+			last->len = off + len - last->off;
+	} else if (ra_q.n < RA_MAX_JOBS) {
+		ra_job_t *j = &ra_q.job[(ra_q.i + ra_q.n) % RA_MAX_JOBS];
+		if ((j->fd = dup(fd)) >= 0) {
+			j->fd0 = fd, j->off = off, j->len = len;
+			++ra_q.n;
+			pthread_cond_signal(&ra_q.cv);
+		}
+	}
+ra_end:
+	pthread_mutex_unlock(&ra_q.lock);
+}
+
+#ifdef POSIX_FADV_SEQUENTIAL
+void ra_sequential(int fd)
+{
+	if (fd >= 0) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+#else
+void ra_sequential(int fd) {}
+#endif
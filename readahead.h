@@ -0,0 +1,34 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Read a byte range of a file into the page cache in the background
+ *
+ * The range is hinted to the kernel with posix_fadvise() where available and
+ * queued for a prefetch thread, started on the first call. Requests are
+ * dropped when the queue is full and truncated at 8MB.
+ *
+ * @param fd     file descriptor
+ * @param off    start of the range
+ * @param len    length of the range
+ */
+void ra_willneed(int fd, int64_t off, int64_t len);
+
+/**
+ * Hint that a file will be read sequentially
+ *
+ * @param fd     file descriptor
+ */
+void ra_sequential(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
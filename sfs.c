@@ -0,0 +1,278 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "bgt.h"
+#include "kstring.h"
+
+#define SFS_MAX_DIM 3
+
+typedef struct {
+	int n_dim, N[SFS_MAX_DIM];
+	int64_t n_sites, size;
+	double *a; // joint spectrum, with the first group varying slowest
+} sfs_t;
+
+typedef struct {
+	double *p[SFS_MAX_DIM]; // per-group projection; reused across sites
+} sfs_buf_t;
+
+static void sfs_init(sfs_t *s, int n_dim, const int *N)
+{
+	int i;
+	s->n_dim = n_dim, s->size = 1, s->n_sites = 0;
+	for (i = 0; i < n_dim; ++i)
+		s->N[i] = N[i], s->size *= N[i] + 1;
+	s->a = (double*)calloc(s->size, sizeof(double));
+}
+
+static inline double sfs_lbinom(int n, int k) { return lgamma(n + 1) - lgamma(k + 1) - lgamma(n - k + 1); }
+
+// hypergeometric projection of $k alleles out of $an haplotypes down to $N haplotypes; return -1 if $an < $N
+static int sfs_project(int an, int k, int N, double *p)
+{
+	int j;
+	double l;
+	if (an < N) return -1;
+	memset(p, 0, (N + 1) * sizeof(double));
+	if (an == N) {
+		p[k] = 1.;
+		return 0;
+	}
+	l = sfs_lbinom(an, N);
+	for (j = k - (an - N) > 0? k - (an - N) : 0; j <= k && j <= N; ++j)
+		p[j] = exp(sfs_lbinom(k, j) + sfs_lbinom(an - k, N - j) - l);
+	return 0;
+}
+
+static void sfs_add(sfs_t *s, sfs_buf_t *b, const bgt_info_t *ss)
+{
+	int i, j, k;
+	for (i = 0; i < s->n_dim; ++i) {
+		int an = s->n_dim > 1? ss->gan[i] : ss->an;
+		int ac = s->n_dim > 1? ss->gac[i][0] : ss->ac[0];
+		if (sfs_project(an, ac, s->N[i], b->p[i]) < 0) return;
+	}
+	++s->n_sites;
+	if (s->n_dim == 1) {
+		for (j = 0; j <= s->N[0]; ++j) s->a[j] += b->p[0][j];
+	} else if (s->n_dim == 2) {
+		for (j = 0; j <= s->N[0]; ++j) {
+			double *a = &s->a[j * (s->N[1] + 1)];
+			if (b->p[0][j] == 0.) continue;
+			for (k = 0; k <= s->N[1]; ++k)
+				a[k] += b->p[0][j] * b->p[1][k];
+		}
+	} else {
+		int l, n12 = (s->N[1] + 1) * (s->N[2] + 1);
+		for (j = 0; j <= s->N[0]; ++j) {
+			if (b->p[0][j] == 0.) continue;
+			for (k = 0; k <= s->N[1]; ++k) {
+				double *a = &s->a[j * n12 + k * (s->N[2] + 1)], x = b->p[0][j] * b->p[1][k];
+				if (x == 0.) continue;
+				for (l = 0; l <= s->N[2]; ++l)
+					a[l] += x * b->p[2][l];
+			}
+		}
+	}
+}
+
+static void sfs_merge(sfs_t *s, const sfs_t *t)
+{
+	int64_t i;
+	s->n_sites += t->n_sites;
+	for (i = 0; i < s->size; ++i) s->a[i] += t->a[i];
+}
+
+// decompose a linear index into per-group allele counts
+static inline int sfs_idx2cnt(const sfs_t *s, int64_t x, int *j)
+{
+	int i, sum = 0;
+	for (i = s->n_dim - 1; i >= 0; --i)
+		j[i] = x % (s->N[i] + 1), x /= s->N[i] + 1, sum += j[i];
+	return sum;
+}
+
+// fold the spectrum onto the minor allele, by adding each entry to its reflection
+static void sfs_fold(sfs_t *s)
+{
+	int i, j[SFS_MAX_DIM], tot = 0;
+	int64_t x, y;
+	for (i = 0; i < s->n_dim; ++i) tot += s->N[i];
+	for (x = 0; x < s->size; ++x) {
+		if (sfs_idx2cnt(s, x, j) * 2 <= tot) continue;
+		for (i = 0, y = 0; i < s->n_dim; ++i)
+			y = y * (s->N[i] + 1) + (s->N[i] - j[i]);
+		s->a[y] += s->a[x], s->a[x] = 0.;
+	}
+}
+
+static void sfs_print(const sfs_t *s)
+{
+	int i, j[SFS_MAX_DIM];
+	int64_t x;
+	kstring_t str = {0,0,0};
+	printf("#sites\t%lld\n", (long long)s->n_sites);
+	for (x = 0; x < s->size; ++x) {
+		str.l = 0;
+		sfs_idx2cnt(s, x, j);
+		for (i = 0; i < s->n_dim; ++i) {
+			kputw(j[i], &str);
+			kputc('\t', &str);
+		}
+		printf("%s%g\n", str.s, s->a[x]);
+	}
+	free(str.s);
+}
+
+/*** multi-threading over checkpoint chunks ***/
+
+typedef struct {
+	bgtm_t **bm;
+	sfs_t *s;
+} sfs_shared_t;
+
+static void sfs_read(bgtm_t *bm, sfs_t *s)
+{
+	int i;
+	bcf1_t *b;
+	sfs_buf_t buf;
+	for (i = 0; i < s->n_dim; ++i)
+		buf.p[i] = (double*)malloc((s->N[i] + 1) * sizeof(double));
+	b = bcf_init1();
+	while (bgtm_read(bm, b) >= 0)
+		sfs_add(s, &buf, &bm->ss);
+	bcf_destroy1(b);
+	for (i = 0; i < s->n_dim; ++i) free(buf.p[i]);
+}
+
+static void sfs_chunk(void *data, int tid, int chunk, int64_t beg, int64_t end)
+{
+	sfs_shared_t *sh = (sfs_shared_t*)data;
+	bgtm_set_start(sh->bm[tid], beg);
+	bgtm_set_end(sh->bm[tid], end);
+	sfs_read(sh->bm[tid], &sh->s[tid]);
+}
+
+static bgtm_t *sfs_reader_init(int n_files, bgt_file_t **files, const char *reg, const char *site_flt, int n_groups, char *const*gexpr)
+{
+	int i;
+	bgtm_t *bm;
+	bm = bgtm_reader_init(n_files, files);
+	bgtm_set_flag(bm, BGT_F_SET_AC|BGT_F_NO_GT);
+	if (site_flt && bgtm_set_flt_site(bm, site_flt) != 0) {
+		fprintf(stderr, "[E::%s] failed to set frequency filters. Syntax error?\n", __func__);
+		goto sfs_err;
+	}
+	if (reg && bgtm_set_region(bm, reg) < 0) {
+		fprintf(stderr, "[E::%s] failed to set region. Region format error?\n", __func__);
+		goto sfs_err;
+	}
+	for (i = 0; i < n_groups; ++i) {
+		if (bgtm_add_group(bm, gexpr[i]) < 0) {
+			fprintf(stderr, "[E::%s] failed to add sample group '%s'.\n", __func__, gexpr[i]);
+			goto sfs_err;
+		}
+	}
+	bgtm_prepare(bm);
+	return bm;
+
+sfs_err:
+	bgtm_reader_destroy(bm);
+	return 0;
+}
+
+int main_sfs(int argc, char *argv[])
+{
+	int i, c, n_files = 0, n_groups = 0, n_dim, n_proj = 0, n_threads = 1, fold = 0;
+	int N[SFS_MAX_DIM], proj[SFS_MAX_DIM];
+	char *reg = 0, *site_flt = 0, *gexpr[SFS_MAX_DIM];
+	bgt_file_t **files;
+	bgtm_t *bm;
+	sfs_t s;
+
+	while ((c = getopt(argc, argv, "r:f:s:Fp:@:")) >= 0) {
+		if (c == 'r') reg = optarg;
+		else if (c == 'f') site_flt = optarg;
+		else if (c == 'F') fold = 1;
+		else if (c == '@') n_threads = atoi(optarg);
+		else if (c == 's') {
+			if (n_groups == SFS_MAX_DIM) {
+				fprintf(stderr, "[E::%s] at most %d sample groups are supported\n", __func__, SFS_MAX_DIM);
+				return 1;
+			}
+			gexpr[n_groups++] = optarg;
+		} else if (c == 'p') {
+			char *p = optarg;
+			for (n_proj = 0; n_proj < SFS_MAX_DIM && *p; ) {
+				proj[n_proj++] = strtol(p, &p, 10);
+				if (*p == ',') ++p;
+			}
+		}
+	}
+	if (argc - optind < 1) {
+		fprintf(stderr, "Usage: bgt sfs [options] <bgt-prefix> [...]\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -s EXPR      samples list (see 'bgt view'); up to %d groups for a joint SFS [all]\n", SFS_MAX_DIM);
+		fprintf(stderr, "  -r STR       region [all]\n");
+		fprintf(stderr, "  -f STR       frequency filters []\n");
+		fprintf(stderr, "  -p INT[,...] project each group down to INT haplotypes; sites with fewer\n");
+		fprintf(stderr, "               called haplotypes are skipped [#haplotypes in the group]\n");
+		fprintf(stderr, "  -F           fold the spectrum\n");
+		fprintf(stderr, "  -@ INT       number of threads; ignored with -r or multiple BGTs [1]\n");
+		fprintf(stderr, "Output: a '#sites' line, followed by allele counts in each group and the\n");
+		fprintf(stderr, "  expected number of sites, one line per cell of the spectrum.\n");
+		return 1;
+	}
+
+	n_files = argc - optind;
+	files = (bgt_file_t**)calloc(n_files, sizeof(bgt_file_t*));
+	for (i = 0; i < n_files; ++i) {
+		files[i] = bgt_open(argv[optind+i]);
+		if (files[i] == 0) {
+			fprintf(stderr, "[E::%s] failed to open BGT with prefix '%s'\n", __func__, argv[optind+i]);
+			return 1;
+		}
+	}
+	if ((bm = sfs_reader_init(n_files, files, reg, site_flt, n_groups, gexpr)) == 0)
+		return 1;
+	n_dim = n_groups > 0? n_groups : 1;
+	for (i = 0; i < n_dim; ++i) N[i] = 0;
+	for (i = 0; i < bm->n_out; ++i)
+		N[n_dim > 1? bm->group[i] - 1 : 0] += 2;
+	for (i = 0; i < n_dim && n_proj > 0; ++i) {
+		int p = proj[i < n_proj? i : n_proj - 1];
+		if (p > N[i]) {
+			fprintf(stderr, "[W::%s] group %d has %d haplotypes; unable to project to %d\n", __func__, i + 1, N[i], p);
+		} else if (p > 0) N[i] = p;
+	}
+	sfs_init(&s, n_dim, N);
+
+	if (n_threads > 1 && n_files == 1 && reg == 0) {
+		sfs_shared_t sh;
+		sh.bm = (bgtm_t**)calloc(n_threads, sizeof(bgtm_t*));
+		sh.s = (sfs_t*)calloc(n_threads, sizeof(sfs_t));
+		sh.bm[0] = bm;
+		for (i = 1; i < n_threads; ++i)
+			sh.bm[i] = sfs_reader_init(n_files, files, reg, site_flt, n_groups, gexpr);
+		for (i = 0; i < n_threads; ++i)
+			sfs_init(&sh.s[i], n_dim, N);
+		bgt_chunks(bgt_get_n(bm->bgt[0]), pbf_get_shift(bm->bgt[0]->pb), n_threads, sfs_chunk, &sh);
+		for (i = 0; i < n_threads; ++i) {
+			sfs_merge(&s, &sh.s[i]);
+			free(sh.s[i].a);
+			if (i > 0) bgtm_reader_destroy(sh.bm[i]);
+		}
+		free(sh.s); free(sh.bm);
+	} else sfs_read(bm, &s);
+
+	if (fold) sfs_fold(&s);
+	sfs_print(&s);
+
+	free(s.a);
+	bgtm_reader_destroy(bm);
+	for (i = 0; i < n_files; ++i) bgt_close(files[i]);
+	free(files);
+	return 0;
+}
@@ -0,0 +1,344 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include "bgt.h"
+#include "kstring.h"
+#include "ksort.h"
+
+/* A sketch is a one-permutation MinHash of the set of sites at which a sample
+ * (or haplotype) carries the ALT allele. The 64-bit hash of an allele picks one
+ * of k bins by its high bits, and each bin keeps the minimum hash falling into
+ * it. Unlike a bottom-k sketch, bins are aligned across samples, so the Jaccard
+ * index is estimated bin by bin and bands of bins can be used as LSH keys. */
+
+#define SKT_EMPTY UINT64_MAX
+
+typedef struct {
+	int k, n; // k: #bins per sketch; n: #sketches
+	char **name;
+	int64_t *n_sites; // size of each site set
+	uint64_t *min; // min[i*k+j]: minimum hash in bin j of sketch i, or SKT_EMPTY
+} skt_t;
+
+typedef struct {
+	uint64_t key;
+	int32_t i;
+} skt_band1_t;
+
+#define band_lt(a, b) ((a).key < (b).key || ((a).key == (b).key && (a).i < (b).i))
+KSORT_INIT(skt_band, skt_band1_t, band_lt)
+KSORT_INIT(skt_pair, uint64_t, ks_lt_generic)
+
+static inline uint64_t skt_hash(const char *s) // FNV-1a followed by the splitmix64 finalizer to mix the high bits
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (; *s; ++s) h = (h ^ (uint8_t)*s) * 0x100000001b3ULL;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+static inline int skt_bin(uint64_t h, int k) { return (h >> 32) * (uint64_t)k >> 32; }
+
+static skt_t *skt_init(int k, int n)
+{
+	int64_t i;
+	skt_t *s;
+	s = (skt_t*)calloc(1, sizeof(skt_t));
+	s->k = k, s->n = n;
+	s->name = (char**)calloc(n, sizeof(char*));
+	s->n_sites = (int64_t*)calloc(n, 8);
+	s->min = (uint64_t*)malloc((size_t)n * k * 8);
+	for (i = 0; i < (int64_t)n * k; ++i) s->min[i] = SKT_EMPTY;
+	return s;
+}
+
+static void skt_destroy(skt_t *s)
+{
+	int i;
+	if (s == 0) return;
+	for (i = 0; i < s->n; ++i) free(s->name[i]);
+	free(s->name); free(s->n_sites); free(s->min);
+	free(s);
+}
+
+static int skt_write(const char *fn, const skt_t *s)
+{
+	int i;
+	FILE *fp;
+	if ((fp = fopen(fn, "wb")) == 0) return -1;
+	fwrite("SKT\1", 1, 4, fp);
+	fwrite(&s->k, 4, 1, fp);
+	fwrite(&s->n, 4, 1, fp);
+	for (i = 0; i < s->n; ++i) {
+		int32_t l = strlen(s->name[i]);
+		fwrite(&l, 4, 1, fp);
+		fwrite(s->name[i], 1, l, fp);
+		fwrite(&s->n_sites[i], 8, 1, fp);
+		fwrite(&s->min[(size_t)i * s->k], 8, s->k, fp);
+	}
+	if (fclose(fp) != 0) {
+		remove(fn);
+		return -1;
+	}
+	return 0;
+}
+
+static skt_t *skt_read(const char *fn)
+{
+	int i;
+	int32_t hdr[2];
+	char magic[4];
+	FILE *fp;
+	skt_t *s;
+	if ((fp = fopen(fn, "rb")) == 0) return 0;
+	if (fread(magic, 1, 4, fp) != 4 || strncmp(magic, "SKT\1", 4) != 0 || fread(hdr, 4, 2, fp) != 2 || hdr[0] <= 0 || hdr[1] < 0) {
+		fclose(fp);
+		return 0;
+	}
+	s = skt_init(hdr[0], hdr[1]);
+	for (i = 0; i < s->n; ++i) {
+		int32_t l;
+		if (fread(&l, 4, 1, fp) != 1 || l < 0) break;
+		s->name[i] = (char*)calloc(l + 1, 1);
+		if (fread(s->name[i], 1, l, fp) != l || fread(&s->n_sites[i], 8, 1, fp) != 1) break;
+		if (fread(&s->min[(size_t)i * s->k], 8, s->k, fp) != s->k) break;
+	}
+	fclose(fp);
+	if (i < s->n) {
+		skt_destroy(s);
+		return 0;
+	}
+	return s;
+}
+
+static inline void skt_add(skt_t *s, int i, int j, uint64_t h)
+{
+	uint64_t *p = &s->min[(size_t)i * s->k + j];
+	++s->n_sites[i];
+	if (h < *p) *p = h;
+}
+
+// estimated Jaccard index; *n_bins is set to the number of bins non-empty in either sketch
+static double skt_jaccard(const skt_t *s, int i, const skt_t *t, int j, int *n_bins)
+{
+	int l, n = 0, same = 0;
+	const uint64_t *p = &s->min[(size_t)i * s->k], *q = &t->min[(size_t)j * t->k];
+	for (l = 0; l < s->k; ++l) {
+		if (p[l] == SKT_EMPTY && q[l] == SKT_EMPTY) continue;
+		++n, same += (p[l] == q[l]);
+	}
+	*n_bins = n;
+	return n? (double)same / n : 0.;
+}
+
+// LSH key of band $b, or 0 if any bin in the band is empty
+static inline uint64_t skt_band_key(const skt_t *s, int i, int b, int r)
+{
+	int l;
+	uint64_t key = 0xcbf29ce484222325ULL;
+	const uint64_t *p = &s->min[(size_t)i * s->k + b * r];
+	for (l = 0; l < r; ++l) {
+		if (p[l] == SKT_EMPTY) return 0;
+		key = (key ^ p[l]) * 0x100000001b3ULL;
+	}
+	return key? key : 1;
+}
+
+int main_sketch(int argc, char *argv[])
+{
+	int i, c, k = 256, per_hap = 0;
+	char *reg = 0, *site_flt = 0, *gexpr = 0, *fn_out = 0;
+	int64_t n_sites = 0;
+	bgt_file_t *f;
+	bgtm_t *bm;
+	bcf1_t *b;
+	skt_t *s;
+	bgt_allele_t a, r;
+	kstring_t str = {0,0,0};
+
+	while ((c = getopt(argc, argv, "r:f:s:k:Ho:")) >= 0) {
+		if (c == 'r') reg = optarg;
+		else if (c == 'f') site_flt = optarg;
+		else if (c == 's') gexpr = optarg;
+		else if (c == 'k') k = atoi(optarg);
+		else if (c == 'H') per_hap = 1;
+		else if (c == 'o') fn_out = optarg;
+	}
+	if (argc - optind < 1) {
+		fprintf(stderr, "Usage: bgt sketch [options] <bgt-prefix>\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -s EXPR      samples list (see 'bgt view') [all]\n");
+		fprintf(stderr, "  -r STR       region [all]\n");
+		fprintf(stderr, "  -f STR       frequency filters, e.g. 'AC/AN<.05' []\n");
+		fprintf(stderr, "  -k INT       number of MinHash bins per sketch [%d]\n", k);
+		fprintf(stderr, "  -H           sketch each haplotype instead of each sample\n");
+		fprintf(stderr, "  -o FILE      output file [<bgt-prefix>.skt]\n");
+		return 1;
+	}
+	if (k <= 0) {
+		fprintf(stderr, "[E::%s] option -k must be positive\n", __func__);
+		return 1;
+	}
+
+	if ((f = bgt_open(argv[optind])) == 0) {
+		fprintf(stderr, "[E::%s] failed to open BGT with prefix '%s'\n", __func__, argv[optind]);
+		return 1;
+	}
+	bm = bgtm_reader_init(1, &f);
+	bgtm_set_flag(bm, BGT_F_NO_GT);
+	if (site_flt && bgtm_set_flt_site(bm, site_flt) != 0) {
+		fprintf(stderr, "[E::%s] failed to set frequency filters. Syntax error?\n", __func__);
+		return 1;
+	}
+	if (reg && bgtm_set_region(bm, reg) < 0) {
+		fprintf(stderr, "[E::%s] failed to set region. Region format error?\n", __func__);
+		return 1;
+	}
+	if (gexpr && bgtm_add_group(bm, gexpr) < 0) {
+		fprintf(stderr, "[E::%s] failed to add sample group '%s'.\n", __func__, gexpr);
+		return 1;
+	}
+	bgtm_prepare(bm);
+
+	s = skt_init(k, bm->n_out << per_hap);
+	for (i = 0; i < bm->n_out; ++i) {
+		const char *name = f->f->rows[(uint32_t)bm->sample_idx[i]].name;
+		if (per_hap) {
+			str.l = 0, ksprintf(&str, "%s/1", name), s->name[i<<1|0] = strdup(str.s);
+			str.l = 0, ksprintf(&str, "%s/2", name), s->name[i<<1|1] = strdup(str.s);
+		} else s->name[i] = strdup(name);
+	}
+	memset(&a, 0, sizeof(bgt_allele_t));
+	memset(&r, 0, sizeof(bgt_allele_t));
+	b = bcf_init1();
+	while (bgtm_read(bm, b) >= 0) {
+		uint64_t h;
+		int j;
+		bgt_al_from_bcf(bm->h_out, b, &a, &r);
+		bgt_al_format(&a, &str); // hashing the allele string makes sketches comparable across BGTs
+		h = skt_hash(str.s), j = skt_bin(h, k);
+		for (i = 0; i < bm->n_out; ++i) {
+			int c1 = bm->a[1][i<<1|0]<<1 | bm->a[0][i<<1|0], c2 = bm->a[1][i<<1|1]<<1 | bm->a[0][i<<1|1];
+			if (per_hap) {
+				if (c1 == 1) skt_add(s, i<<1|0, j, h);
+				if (c2 == 1) skt_add(s, i<<1|1, j, h);
+			} else if (c1 == 1 || c2 == 1) skt_add(s, i, j, h);
+		}
+		++n_sites;
+	}
+	bcf_destroy1(b);
+	free(a.chr.s); free(r.chr.s);
+
+	str.l = 0;
+	if (fn_out) kputs(fn_out, &str);
+	else ksprintf(&str, "%s.skt", argv[optind]);
+	if (skt_write(str.s, s) < 0) {
+		fprintf(stderr, "[E::%s] failed to write sketches to '%s'\n", __func__, str.s);
+		return 1;
+	}
+	if (hts_verbose >= 3)
+		fprintf(stderr, "[M::%s] wrote %d sketches of %lld sites to '%s'\n", __func__, s->n, (long long)n_sites, str.s);
+
+	free(str.s);
+	skt_destroy(s);
+	bgtm_reader_destroy(bm);
+	bgt_close(f);
+	return 0;
+}
+
+int main_sketch_query(int argc, char *argv[])
+{
+	int i, c, r = 16, n_bands, self;
+	double min_j = .9;
+	int64_t n_pairs = 0, m_pairs = 0, j, l;
+	uint64_t *pairs = 0;
+	skt_t *s, *q;
+	skt_band1_t *band;
+	kstring_t str = {0,0,0};
+
+	while ((c = getopt(argc, argv, "j:r:")) >= 0) {
+		if (c == 'j') min_j = atof(optarg);
+		else if (c == 'r') r = atoi(optarg);
+	}
+	if (argc - optind < 1) {
+		fprintf(stderr, "Usage: bgt sketch-query [options] <db.skt> [query.skt]\n");
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -j FLOAT     min estimated Jaccard index [%g]\n", min_j);
+		fprintf(stderr, "  -r INT       bins per LSH band; smaller for higher recall at lower -j [%d]\n", r);
+		fprintf(stderr, "Output: TAB-delimited pair of names, the estimated Jaccard index and the\n");
+		fprintf(stderr, "  number of bins compared. Without query.skt, pairs within db.skt are reported.\n");
+		return 1;
+	}
+	if ((s = skt_read(argv[optind])) == 0) {
+		fprintf(stderr, "[E::%s] failed to read sketches from '%s'\n", __func__, argv[optind]);
+		return 1;
+	}
+	self = (argc - optind < 2);
+	if (self) q = s;
+	else if ((q = skt_read(argv[optind+1])) == 0) {
+		fprintf(stderr, "[E::%s] failed to read sketches from '%s'\n", __func__, argv[optind+1]);
+		return 1;
+	}
+	if (q->k != s->k) {
+		fprintf(stderr, "[E::%s] sketches have different numbers of bins (%d vs %d)\n", __func__, s->k, q->k);
+		return 1;
+	}
+	if (r <= 0 || r > s->k) r = s->k;
+	n_bands = s->k / r;
+
+	// collect candidate pairs sharing all bins in at least one band
+	band = (skt_band1_t*)malloc((s->n > 0? s->n : 1) * sizeof(skt_band1_t));
+	for (c = 0; c < n_bands; ++c) {
+		int n = 0;
+		for (i = 0; i < s->n; ++i) {
+			band[n].key = skt_band_key(s, i, c, r), band[n].i = i;
+			if (band[n].key) ++n;
+		}
+		ks_introsort(skt_band, n, band);
+		for (i = 0; i < q->n; ++i) {
+			uint64_t key;
+			int lo, hi;
+			if ((key = skt_band_key(q, i, c, r)) == 0) continue;
+			for (lo = 0, hi = n; lo < hi;) {
+				int mid = (lo + hi) >> 1;
+				if (band[mid].key < key) lo = mid + 1;
+				else hi = mid;
+			}
+			for (; lo < n && band[lo].key == key; ++lo) {
+				if (self && band[lo].i <= i) continue;
+				if (n_pairs == m_pairs) {
+					m_pairs = m_pairs? m_pairs<<1 : 1024;
+					pairs = (uint64_t*)realloc(pairs, m_pairs * 8);
+				}
+				pairs[n_pairs++] = (uint64_t)i << 32 | band[lo].i;
+			}
+		}
+	}
+	free(band);
+	ks_introsort(skt_pair, n_pairs, pairs);
+
+	// verify candidates with the full sketches
+	for (j = l = 0; j < n_pairs; ++j) {
+		int qi = pairs[j] >> 32, si = (uint32_t)pairs[j], n_bins;
+		double x;
+		if (j > 0 && pairs[j] == pairs[j-1]) continue;
+		++l;
+		x = skt_jaccard(q, qi, s, si, &n_bins);
+		if (x < min_j) continue;
+		str.l = 0;
+		kputs(q->name[qi], &str); kputc('\t', &str);
+		kputs(s->name[si], &str); kputc('\t', &str);
+		ksprintf(&str, "%.4f", x); kputc('\t', &str);
+		kputw(n_bins, &str);
+		puts(str.s);
+	}
+	if (hts_verbose >= 3)
+		fprintf(stderr, "[M::%s] verified %lld candidate pairs\n", __func__, (long long)l);
+
+	free(str.s); free(pairs);
+	if (!self) skt_destroy(q);
+	skt_destroy(s);
+	return 0;
+}
@@ -5,6 +5,377 @@ if [ ! -x $EXE ]; then
 	exit 1
 fi
 
+echo "MESSAGE: running regression tests on small inputs..."
+T=test.tmp
+rm -rf $T; mkdir $T || exit 1
+n_fail=0
+
+check() { # check <test-name> <expected> <observed>
+	if cmp -s "$2" "$3"; then
+		echo "PASS: $1"
+	else
+		echo "FAIL: $1 ($2 and $3 differ)"
+		n_fail=$((n_fail+1))
+	fi
+}
+
+# two contigs of 300 sites and 12 phased samples with some missing genotypes
+awk 'BEGIN {
+	srand(11); ns = 12;
+	print "##fileformat=VCFv4.1";
+	print "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">";
+	print "##contig=<ID=1,length=1000000>";
+	print "##contig=<ID=2,length=1000000>";
+	printf "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT";
+	for (j = 1; j <= ns; ++j) printf "\tS%d", j;
+	printf "\n";
+	for (c = 1; c <= 2; ++c)
+		for (i = 1; i <= 300; ++i) {
+			printf "%d\t%d\t.\tA\tC\t.\tPASS\t.\tGT", c, i * 997;
+			f = rand() * rand();
+			for (j = 1; j <= ns; ++j)
+				printf "\t%s|%s", rand() < .02? "." : (rand() < f? 1 : 0), rand() < f? 1 : 0;
+			printf "\n";
+		}
+}' > $T/syn.vcf
+$EXE import -S $T/syn $T/syn.vcf 2> /dev/null
+$EXE view $T/syn > $T/syn.out
+$EXE import -S $T/ex2 ex2.vcf 2> /dev/null
+$EXE view $T/ex2 > $T/ex2.out
+
+# concat: import each contig separately and join them
+for c in 1 2; do
+	awk -v c=$c '/^#/ || $1 == c' $T/syn.vcf > $T/syn$c.vcf
+	$EXE import -S $T/syn$c $T/syn$c.vcf 2> /dev/null
+done
+$EXE concat $T/cat $T/syn1 $T/syn2
+$EXE view $T/cat > $T/cat.out
+check "concat vs whole import" $T/syn.out $T/cat.out
+$EXE concat $T/cat2 $T/syn2 $T/syn1 2> /dev/null
+ls $T/cat2.* > $T/cat2.ls 2> /dev/null
+check "concat leaves no output on error" /dev/null $T/cat2.ls
+
+# materialized views: routed queries must match those on the full BGT
+mkdir $T/rt && cp $T/syn.bcf $T/syn.bcf.csi $T/syn.pbf $T/syn.spl $T/rt/
+set -- "-s,S1,S2,S3 -f AC>0" "-s,S2,S3 -f AC>=1&&AN>4 -r 1:100000-200000" "-s,S1,S2 -f AC>0 -r 2" "-s,S1,S2" "-s,S5,S6 -f AC>0"
+i=0
+for q in "$@"; do
+	i=$((i+1)); $EXE view $q $T/rt/syn > $T/rt/q$i.exp
+done
+$EXE materialize -s,S1,S2,S3,S4 -r 1 $T/rt/syn $T/rt/v1 2> /dev/null
+$EXE materialize -k -s,S5,S6,S7 $T/rt/syn $T/rt/v2 2> /dev/null
+i=0
+for q in "$@"; do
+	i=$((i+1)); $EXE view $q $T/rt/syn > $T/rt/q$i.out 2> /dev/null
+	check "routed view '$q'" $T/rt/q$i.exp $T/rt/q$i.out
+done
+$EXE view -s,S1,S2,S3 -f 'AC>0' -r 1 $T/rt/syn 2>&1 > /dev/null | grep -c "view '.*/v1' instead" > $T/rt/nr.out
+echo 1 > $T/rt/nr.exp
+check "routed view is used" $T/rt/nr.exp $T/rt/nr.out
+# a source rewritten behind the views' back: the fingerprint no longer matches
+cp $T/syn2.bcf $T/rt/syn.bcf; cp $T/syn2.bcf.csi $T/rt/syn.bcf.csi; cp $T/syn2.pbf $T/rt/syn.pbf
+$EXE view -s,S1,S2,S3 -f 'AC>0' -r 1 $T/syn2 > $T/rt/st.exp
+$EXE view -s,S1,S2,S3 -f 'AC>0' -r 1 $T/rt/syn > $T/rt/st.out 2> $T/rt/st.err
+check "out-of-date view is skipped" $T/rt/st.exp $T/rt/st.out
+grep -c "view '.*/v1' is out of date" $T/rt/st.err > $T/rt/nr.out
+check "out-of-date view is reported" $T/rt/nr.exp $T/rt/nr.out
+$EXE import -S $T/rt/syn $T/syn.vcf 2> /dev/null
+ls $T/rt/syn.views > $T/rt/ls.out 2> /dev/null
+check "import drops the views of the old data" /dev/null $T/rt/ls.out
+
+# reindex: different checkpoint intervals and column blocks must not change queries
+$EXE view -s,S2,S7 -r 2:150000-250000 $T/syn > $T/sub.out
+for opt in "-s 3" "-s 0" "-b 5" "-s 4 -b 0"; do
+	cp $T/syn.pbf $T/ri.pbf; cp $T/syn.bcf $T/ri.bcf; cp $T/syn.bcf.csi $T/ri.bcf.csi; cp $T/syn.spl $T/ri.spl
+	$EXE reindex $opt $T/ri 2> /dev/null
+	$EXE view $T/ri > $T/ri.out
+	check "reindex $opt" $T/syn.out $T/ri.out
+	$EXE view -s,S2,S7 -r 2:150000-250000 $T/ri > $T/ri.out
+	check "reindex $opt with -s/-r" $T/sub.out $T/ri.out
+done
+
+# column blocks: block-partitioned import, decoded serially or in parallel; -P 0
+# decodes in parallel however few haplotypes are selected
+$EXE import -S -b 5 $T/blk $T/syn.vcf 2> /dev/null
+$EXE import -S -b 2 $T/blk2 $T/syn.vcf 2> /dev/null
+$EXE view -s,S2,S7,S9 -r 2:150000-250000 $T/syn > $T/blk.exp
+for t in "-@1" "-@3" "-@3 -P 0" "-@8 -P 0"; do
+	for f in blk blk2; do
+		$EXE view $t $T/$f > $T/blk.out
+		check "$f, view $t" $T/syn.out $T/blk.out
+		$EXE view $t -s,S2,S7,S9 -r 2:150000-250000 $T/$f > $T/blk.out
+		check "$f, view $t with -s/-r" $T/blk.exp $T/blk.out
+	done
+done
+
+# sorted import: shuffled or concatenated input, in memory or spilled to disk
+(grep '^#' $T/syn.vcf; grep -v '^#' $T/syn.vcf | awk 'BEGIN{srand(7)}{print rand()"\t"$0}' | sort -k1,1 | cut -f2-) > $T/shuf.vcf
+(cat $T/syn2.vcf; grep -v '^#' $T/syn1.vcf) > $T/cat.vcf
+for in in shuf cat; do
+	for opt in "-s" "-s -m 0"; do
+		$EXE import -S $opt $T/srt $T/$in.vcf 2> /dev/null
+		$EXE view $T/srt > $T/srt.out
+		check "import $opt of $in.vcf" $T/syn.out $T/srt.out
+	done
+done
+# 600 runs of one record exceed the number of runs merged at a time; too few
+# file descriptors for one merge must fail without leaving temporary files
+(ulimit -n 100; $EXE import -S -s -m 0 $T/srt $T/shuf.vcf 2> /dev/null)
+$EXE view $T/srt > $T/srt.out
+check "import -s -m 0 with 100 open files" $T/syn.out $T/srt.out
+(ulimit -n 30; $EXE import -S -s -m 0 $T/srt2 $T/shuf.vcf 2> /dev/null)
+ls $T/srt*.tmp > $T/srt.ls 2> /dev/null
+check "import -s leaves no temporary files" /dev/null $T/srt.ls
+
+# compare: B drops every 7th site of A and sets S1 to 1|1 at every 11th
+awk '/^#/ {print; next} ++i % 7 != 0 {if (i % 11 == 0) $10 = "1|1"; print}' OFS="\t" $T/syn.vcf > $T/cmp.vcf
+$EXE import -S $T/cmp $T/cmp.vcf 2> /dev/null
+n_a=`grep -vc '^#' $T/syn.vcf`; n_b=`grep -vc '^#' $T/cmp.vcf`
+printf "#sites\t%d\t%d\t0\n" $n_b $((n_a-n_b)) > $T/cmp.exp
+$EXE compare $T/syn $T/cmp | head -1 > $T/cmp.out
+check "compare #sites" $T/cmp.exp $T/cmp.out
+$EXE view -s,S2 $T/cmp | grep -v '^#' | awk '{sub("/", "|", $10); ++c[$10]}END{printf "%d\t%d\n", c["0|0"]+c["0|1"]+c["1|0"]+c["1|1"], c["0|0"]+c["0|1"]+c["1|0"]+c["1|1"]}' > $T/cmp.exp
+$EXE compare -s,S2 $T/syn $T/cmp | awk 'NR>1{print $3"\t"$4}' > $T/cmp.out
+check "compare concordance of an unchanged sample" $T/cmp.exp $T/cmp.out
+
+# multi-threaded commands must match their single-threaded output
+for f in syn ex2; do
+	[ $f = ex2 ] && vcf=ex2.vcf || vcf=$T/$f.vcf
+	$EXE import -S -@3 $T/mt $vcf 2> /dev/null
+	$EXE view $T/mt > $T/mt.out
+	check "import -@3 of $f.vcf" $T/$f.out $T/mt.out
+done
+for cmd in "sfs" "sfs -s,S1,S2,S3 -s,S4,S5 -F" "popstats -w 20000" "popstats -s,S1,S2,S3,S4 -s,S5,S6,S7 -w 20000 -S 5000" \
+		"kinship" "pca -k 3" "compare $T/cmp" "compare -s,S1,S3 $T/cmp"; do
+	$EXE $cmd -@1 $T/syn > $T/mt.exp 2> /dev/null
+	$EXE $cmd -@3 $T/syn > $T/mt.out 2> /dev/null
+	check "$cmd -@3" $T/mt.exp $T/mt.out
+done
+
+# shards: three shards with checkpoints every 8 rows, so that the row chunks of
+# -@ straddle shard boundaries; queries must match the monolithic import
+awk '/^#/ || $1 == 2 && $2 <= 150000' $T/syn2.vcf > $T/shb.vcf
+awk '/^#/ || $1 == 2 && $2 > 150000' $T/syn2.vcf > $T/shc.vcf
+cp $T/syn1.vcf $T/sha.vcf
+for s in a b c; do
+	$EXE import -S $T/sh$s $T/sh$s.vcf 2> /dev/null
+	$EXE reindex -s 3 $T/sh$s 2> /dev/null
+done
+printf "sha\t1\nshb\t2:1-150000\nshc\t2:150001-1000000\n" > $T/shd.shards
+for q in "" "-r 2:100000-200000" "-r 1" "-i 250 -n 100" "-s,S1,S2 -f AC>0" "-G -n 77" "-t CHROM,POS,AC,nHet"; do
+	$EXE view $q $T/syn > $T/sh.exp
+	for t in 1 3; do
+		$EXE view $q -@$t $T/shd > $T/sh.out
+		check "shards view '$q' -@$t" $T/sh.exp $T/sh.out
+	done
+done
+$EXE view -b -s,S3,S4 $T/syn > $T/sh.exp
+$EXE view -b -s,S3,S4 -@3 $T/shd > $T/sh.out
+check "shards view -b -@3" $T/sh.exp $T/sh.out
+for cmd in "sfs -s,S1,S2,S3 -s,S4,S5" "popstats -w 20000" "pca -k 3"; do
+	$EXE $cmd $T/syn > $T/sh.exp 2> /dev/null
+	$EXE $cmd -@3 $T/shd > $T/sh.out 2> /dev/null
+	check "shards $cmd -@3" $T/sh.exp $T/sh.out
+done
+
+# sketch and export must not depend on the PBF encoding
+$EXE sketch -o $T/syn.skt $T/syn 2> /dev/null
+$EXE sketch -o $T/blk.skt $T/blk 2> /dev/null
+check "sketch of a block-partitioned BGT" $T/syn.skt $T/blk.skt
+$EXE export $T/syn > $T/syn.m3vcf 2> /dev/null
+$EXE export $T/blk > $T/blk.m3vcf 2> /dev/null
+check "export of a block-partitioned BGT" $T/syn.m3vcf $T/blk.m3vcf
+# ... and decoding the exported blocks gives back the genotypes from 'bgt view'; adjacent
+# blocks on a contig share a marker, which is skipped in the second block
+awk -F"\t" '/^#/ {next} $3 ~ /^<BLOCK/ {split($2, p, "-"); ov = ($1 == pc && p[1] == pe); pc = $1; pe = p[2]; n = NF; for (j = 9; j <= NF; ++j) {split($j, r, "|"); h1[j] = r[1]; h2[j] = r[2]} next}
+	ov && $8 ~ /\.M0$/ {next}
+	{s = $1"\t"$2; for (j = 9; j <= n; ++j) s = s"\t"substr($9, h1[j] + 1, 1)"|"substr($9, h2[j] + 1, 1); print s}' $T/syn.m3vcf > $T/m3.out
+awk -F"\t" '/^#/ {next} {s = $1"\t"$2; for (j = 10; j <= NF; ++j) s = s"\t"$j; gsub("/", "|", s); print s}' $T/syn.out > $T/m3.exp
+check "export decoded vs view" $T/m3.exp $T/m3.out
+
+# per-sample genotype counts (-c) against counts from 'bgt view'
+$EXE view -s,S1,S3,S5 -r 1 $T/syn | awk -F"\t" '/^#CHROM/ {for (j = 10; j <= NF; ++j) name[j] = $j; n = NF} /^#/ {next}
+	{for (j = 10; j <= NF; ++j) {
+		split($j, g, /[|\/]/); a = (g[1] == "1") + (g[2] == "1");
+		if (g[1] == "." || g[2] == ".") ++m[j]; else if (a == 2) ++ha[j]; else if (a == 1) ++het[j];
+		alt[j] += a;
+	}}
+	END {for (j = 10; j <= n; ++j) printf "SP\t%s\t1\t%d\t%d\t%d\t%d\n", name[j], het[j], ha[j], m[j], alt[j]}' > $T/gtcnt.exp
+$EXE view -c1 -s,S1,S3,S5 -r 1 $T/syn > $T/gtcnt.out
+check "view -c1" $T/gtcnt.exp $T/gtcnt.out
+awk '$4 >= 75 && $6 < 3' $T/gtcnt.exp > $T/gtcnt.exp2
+$EXE view -c'n_het>=75&&n_missing<3' -s,S1,S3,S5 -r 1 $T/syn > $T/gtcnt.out
+check "view -c with a filter" $T/gtcnt.exp2 $T/gtcnt.out
+$EXE view -c G $T/syn > $T/gtcnt.out 2> /dev/null && echo "unknown variable accepted" >> $T/gtcnt.out
+check "view -c rejects unknown variables" /dev/null $T/gtcnt.out
+$EXE view -a,1:997:1:C -S -G $T/syn > $T/gtcnt.exp
+$EXE view -a,1:997:1:C -SG $T/syn > $T/gtcnt.out
+check "view -SG is -S -G" $T/gtcnt.exp $T/gtcnt.out
+
+# popstats: tiled windows equal the sliding windows starting at the same
+# positions, also when the last window is clipped at the contig length
+sed 's/length=1000000/length=299500/' $T/syn.vcf > $T/ps.vcf
+$EXE import -S $T/ps $T/ps.vcf 2> /dev/null
+for f in syn ps; do
+	$EXE popstats -s,S1,S2,S3,S4,S5,S6 -s,S7,S8,S9,S10,S11,S12 -w 20000 $T/$f > $T/ps.exp
+	$EXE popstats -s,S1,S2,S3,S4,S5,S6 -s,S7,S8,S9,S10,S11,S12 -w 20000 -S 5000 $T/$f | awk '/^#/ || $2 % 20000 == 0' > $T/ps.out
+	check "popstats tiled vs sliding windows on $f" $T/ps.exp $T/ps.out
+done
+awk '!/^#/ && $3 > 299500' $T/ps.out > $T/ps.out2
+check "popstats windows end at the contig length" /dev/null $T/ps.out2
+
+# site annotations: every third site is annotated, with a padding field so that
+# the file is large enough for the binary search on -r; rows for another ALT
+# allele at the same position must not match
+awk -v pad=$(printf "%0300d" 0) '!/^#/ {++i; if (i % 3 == 0) printf "%s:%s:1:G\tgene:Z:X\tscore:i:9\tpad:Z:%s\n%s:%s:1:C\tgene:Z:G%d\tscore:i:%d\tpad:Z:%s\n", $1, $2, pad, $1, $2, i, i % 7, pad}' $T/syn.vcf > $T/ann.fmf
+awk '!/^#/ {++i; print $1 "\t" $2 "\t" (i % 3 == 0? "G" i "\t" i % 7 : "*\t*")}' $T/syn.vcf > $T/ann.exp
+$EXE view -d $T/ann.fmf -t CHROM,POS,gene,score $T/syn > $T/ann.out
+check "annotation join" $T/ann.exp $T/ann.out
+awk '$4 != "*" && $4 >= 3 {print $2}' $T/ann.exp > $T/ann.exp2
+$EXE view -d $T/ann.fmf -f 'score>=3' -t POS $T/syn > $T/ann.out
+check "annotation in -f" $T/ann.exp2 $T/ann.out
+awk '$1 == 2 && $2 >= 100000 && $2 <= 200000' $T/ann.exp > $T/ann.exp2
+$EXE view -d $T/ann.fmf -r 2:100000-200000 -t CHROM,POS,gene,score $T/syn > $T/ann.out
+check "annotation join with -r" $T/ann.exp2 $T/ann.out
+$EXE view -f 'AC>0' -t POS,AC $T/syn > $T/ann.exp2
+$EXE view -d $T/none.fmf -f 'AC>0' -t POS,AC $T/syn > $T/ann.out 2> /dev/null
+check "annotations are only read for annotation variables" $T/ann.exp2 $T/ann.out
+
+# allele index: -a through prefix.aix must match the scan without it, and an
+# out-of-date index must be ignored
+mkdir $T/ax && cp $T/syn.bcf $T/syn.bcf.csi $T/syn.pbf $T/syn.spl $T/ax/
+al=",1:997:1:C,1:149550:1:C,1:997:1:G,2:2991:1:C,2:299100:1:C"
+for q in "" "-S" "-H" "-s,S2,S5,S9 -G"; do
+	$EXE view $q -a$al $T/ax/syn > $T/ax/q.exp 2> /dev/null
+	$EXE alidx $T/ax/syn 2> /dev/null
+	$EXE view $q -a$al $T/ax/syn > $T/ax/q.out 2> /dev/null
+	rm -f $T/ax/syn.aix
+	check "view '$q -a' with .aix" $T/ax/q.exp $T/ax/q.out
+done
+$EXE alidx $T/ax/syn 2> /dev/null
+cp $T/syn2.bcf $T/ax/syn.bcf; cp $T/syn2.bcf.csi $T/ax/syn.bcf.csi; cp $T/syn2.pbf $T/ax/syn.pbf
+$EXE view -a$al $T/syn2 > $T/ax/q.exp
+$EXE view -a$al $T/ax/syn > $T/ax/q.out 2> $T/ax/q.err
+check "view -a with an out-of-date .aix" $T/ax/q.exp $T/ax/q.out
+grep -q "out of date" $T/ax/q.err && echo 1 > $T/ax/q.out
+echo 1 > $T/ax/q.exp
+check "out-of-date .aix is reported" $T/ax/q.exp $T/ax/q.out
+
+# HWE exact test: one site per row of #hom-ref, #het, #hom-alt, #missing and the
+# p-value computed by enumerating all het counts of 12 samples
+cat > $T/hwe.tbl <<EOF
+5 0 5 2 0.00136396
+3 4 3 2 0.563532
+9 1 0 2 1
+0 10 0 2 0.00690641
+4 2 2 4 0.216783
+12 0 0 0 1
+2 7 3 0 1
+EOF
+awk 'BEGIN {
+	print "##fileformat=VCFv4.1";
+	print "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">";
+	print "##contig=<ID=1,length=1000000>";
+	printf "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT";
+	for (j = 1; j <= 12; ++j) printf "\tS%d", j;
+	printf "\n";
+} {
+	printf "1\t%d\t.\tA\tC\t.\tPASS\t.\tGT", NR * 100;
+	for (j = 0; j < $1; ++j) printf "\t0|0";
+	for (j = 0; j < $2; ++j) printf "\t%s", j % 2? "1|0" : "0|1";
+	for (j = 0; j < $3; ++j) printf "\t1|1";
+	for (j = 0; j < $4; ++j) printf "\t.|.";
+	printf "\n";
+}' $T/hwe.tbl > $T/hwe.vcf
+$EXE import -S $T/hwe $T/hwe.vcf 2> /dev/null
+awk '{n = $1 + $2 + $3; printf "%d\t%d\t%.6g\t%s\n", NR * 100, $2, n / (n + $4), $5}' $T/hwe.tbl > $T/hwe.exp
+$EXE view -t POS,nHet,callRate,HWE $T/hwe > $T/hwe.out
+check "HWE, nHet and callRate" $T/hwe.exp $T/hwe.out
+
+# -A: with +/-0.2, 7 of the 12 samples are drawn by selection sampling from the
+# fixed xorshift64 sequence seeded with 11; counts of the drawn samples are
+# scaled by 24/14
+x=11; rest=12; need=7; spl=
+for j in 1 2 3 4 5 6 7 8 9 10 11 12; do
+	x=$(( x ^ (x << 13) )); x=$(( x ^ ((x >> 7) & 0x01FFFFFFFFFFFFFF) )); x=$(( x ^ (x << 17) ))
+	if [ $(( ((x >> 11) & 0x1FFFFFFFFFFFFF) * rest )) -lt $(( need << 53 )) ]; then spl=$spl,S$j; need=$((need-1)); fi
+	rest=$((rest-1))
+done
+$EXE view -s$spl -t POS,AC,AN,nHet,nMissing $T/syn | awk -v OFS="\t" '{f = 24 / 14; print $1, int($2 * f + .499), int($3 * f + .499), int($4 * f + .499), int($5 * f + .499)}' > $T/apx.exp
+$EXE view -A 0.2 -t POS,AC,AN,nHet,nMissing $T/syn > $T/apx.out
+check "-A with the fixed seed" $T/apx.exp $T/apx.out
+
+# burden: alleles of even sites with q>=2 qualify, grouped by 25 sites; the
+# per-sample counts must equal the ALT alleles counted in the 'bgt view' output
+awk '!/^#/ {++i; if (i % 2 == 0) printf "%s:%s:1:C\tgene:Z:B%d\tq:i:%d\n", $1, $2, int(i / 25), i % 5}' $T/syn.vcf > $T/bd.fmf
+for f in "" "-f AC>=3"; do
+	$EXE view $f $T/syn | awk -F"\t" '!/^#/ {i = ($1 - 1) * 300 + $2 / 997; if (i % 2 || i % 5 < 2) next;
+		for (j = 10; j <= NF; ++j) n["B" int(i / 25) "\tS" j - 9] += ($j ~ /^1/) + ($j ~ /1$/)}
+		END {for (k in n) if (n[k]) print k "\t" n[k]}' | sort > $T/bd.exp
+	$EXE burden -d $T/bd.fmf -a 'q>=2' -k gene $f $T/syn 2> /dev/null | sort > $T/bd.out
+	check "burden carrier counts '$f'" $T/bd.exp $T/bd.out
+done
+
+# carriers: sample:GT of the selected samples with an ALT allele, from the VCF output;
+# five samples fill one 8-haplotype word and part of the next
+$EXE view -s,S2,S5,S9,S11,S12 $T/syn | awk -F"\t" '/^#CHROM/ {for (j = 10; j <= NF; ++j) name[j] = $j; next} /^#/ {next}
+	{s = ""; for (j = 10; j <= NF; ++j) if ($j ~ /1/) {gt = $j; gsub(/\|/, "/", gt); s = s (s == ""? "" : ",") name[j] ":" gt}
+	print $2 "\t" (s == ""? "." : s)}' > $T/car.exp
+$EXE view -s,S2,S5,S9,S11,S12 -t POS,carriers $T/syn > $T/car.out
+check "carriers" $T/car.exp $T/car.out
+
+# index-on-write: the .csi written during import and concat must be the one
+# 'bgt bcfidx' builds from the finished BCF
+for f in syn ex2 blk cat hwe; do
+	cp $T/$f.bcf $T/idx.bcf; rm -f $T/idx.bcf.csi
+	$EXE bcfidx $T/idx.bcf
+	check "import index of $f" $T/idx.bcf.csi $T/$f.bcf.csi
+done
+
+# kinship with more samples than a tile: 150 samples and 4500 sites, i.e. two
+# tiles and two blocks; counts of the first 200 sites are checked by brute force
+awk 'BEGIN {
+	srand(7); ns = 150;
+	print "##fileformat=VCFv4.1";
+	print "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">";
+	print "##contig=<ID=1,length=1000000>";
+	printf "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT";
+	for (j = 1; j <= ns; ++j) printf "\tS%d", j;
+	printf "\n";
+	for (i = 1; i <= 4500; ++i) {
+		printf "1\t%d\t.\tA\tC\t.\tPASS\t.\tGT", i * 10;
+		f = rand();
+		for (j = 1; j <= ns; ++j)
+			printf "\t%s|%s", rand() < .03? "." : (rand() < f? 1 : 0), rand() < f? 1 : 0;
+		printf "\n";
+	}
+}' > $T/kin.vcf
+$EXE import -S $T/kin $T/kin.vcf 2> /dev/null
+awk -F"\t" '/^#CHROM/ {n = NF - 9; for (j = 10; j <= NF; ++j) name[j-9] = $j; next} /^#/ || $2 > 2000 {next}
+	{++m; for (j = 1; j <= n; ++j) {split($(j+9), a, "|"); g[j] = a[1] == "." || a[2] == "."? -1 : a[1] + a[2] == 1? 0 : a[1] + a[2] == 0? 1 : 2}
+	for (i = 1; i < n; ++i) for (j = i + 1; j <= n; ++j) {
+		if (g[i] < 0 || g[j] < 0) continue;
+		if (g[i] == 0 && g[j] == 0) ++c0[i,j];
+		if (g[i] + g[j] == 3) ++c1[i,j];
+		if (g[i] == 0) ++c2[i,j];
+		if (g[j] == 0) ++c2[i,j];
+	}}
+	END {print "#sites\t" m; for (i = 1; i < n; ++i) for (j = i + 1; j <= n; ++j)
+		printf "%s\t%s\t%d\t%d\t%s\n", name[i], name[j], c0[i,j], c1[i,j], c2[i,j]? sprintf("%.4f", (c0[i,j] - 2 * c1[i,j]) / c2[i,j]) : "NA"}' $T/kin.vcf > $T/kin.exp
+$EXE kinship -r 1:1-2000 $T/kin > $T/kin.out
+check "kinship of 150 samples" $T/kin.exp $T/kin.out
+$EXE kinship $T/kin > $T/kin.exp
+for t in 3 4; do
+	$EXE kinship -@$t $T/kin > $T/kin.out
+	check "kinship of 150 samples -@$t" $T/kin.exp $T/kin.out
+done
+
+if [ $n_fail -ne 0 ]; then
+	echo "ERROR: $n_fail regression test(s) failed; outputs kept in '$T'."
+	exit 1
+fi
+rm -rf $T
+
 if [ ! -f 1kg11-1M.raw.bcf ] || [ ! -f 1kg11-1M.raw.samples.gz ] || [ ! -f anno11-1M.fmf.gz ]; then
 	echo "MESSAGE: downloading example data..."
 	wget -qO- http://bit.ly/BGTdemo | tar xf -
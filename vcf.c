@@ -796,6 +796,145 @@ int vcf_parse1(kstring_t *s, const bcf_hdr_t *h, bcf1_t *v)
 	return 0;
 }
 
+// find the end of a FORMAT subfield
+static inline char *vcf_skip_subfield(char *p, char *end)
+{
+	for (; p < end && *p != '\t' && *p != ':'; ++p);
+	return p;
+}
+
+int vcf_parse1_gt(kstring_t *s, const bcf_hdr_t *h, bcf1_t *v)
+{
+	int i, j, n_fmt, i_gt = -1;
+	char *p, *q, *end = s->s + s->l;
+	kstring_t *str = &v->shared;
+	vdict_t *d = (vdict_t*)h->dict[BCF_DT_ID];
+	khint_t k;
+
+	v->shared.l = v->indiv.l = 0;
+	v->n_info = v->n_fmt = v->n_sample = 0;
+	v->unpacked = 0;
+	v->unpack_ptr = NULL;
+	for (p = s->s, i = 0; i < 9 && p < end; ++i, p = q + 1) {
+		if ((q = (char*)memchr(p, '\t', end - p)) == 0) q = end;
+		*q = 0;
+		if (i == 0) { // CHROM
+			vdict_t *dc = (vdict_t*)h->dict[BCF_DT_CTG];
+			k = kh_get(vdict, dc, p);
+			if (k == kh_end(dc)) {
+				if (hts_verbose >= 2)
+					fprintf(stderr, "[W::%s] can't find '%s' in the sequence dictionary\n", __func__, p);
+				return -1;
+			} else v->rid = kh_val(dc, k).id;
+		} else if (i == 1) { // POS
+			v->pos = atoi(p) - 1;
+		} else if (i == 2) { // ID
+			if (strcmp(p, ".")) bcf_enc_vchar(str, q - p, p);
+			else bcf_enc_size(str, 0, BCF_BT_CHAR);
+		} else if (i == 3) { // REF
+			bcf_enc_vchar(str, q - p, p);
+			v->n_allele = 1, v->rlen = q - p;
+		} else if (i == 4) { // ALT
+			if (strcmp(p, ".")) {
+				char *r, *t;
+				for (r = t = p;; ++r) {
+					if (*r == ',' || *r == 0) {
+						bcf_enc_vchar(str, r - t, t);
+						t = r + 1;
+						++v->n_allele;
+					}
+					if (r == q) break;
+				}
+			}
+		} else if (i == 5) { // QUAL
+			if (strcmp(p, ".")) v->qual = atof(p);
+			else memcpy(&v->qual, &bcf_float_missing, 4);
+		} else if (i == 6) { // FILTER
+			if (strcmp(p, ".")) {
+				int32_t *a;
+				int n_flt = 1;
+				char *r, *t;
+				if (*(q-1) == ';') *(q-1) = 0;
+				for (r = p; *r; ++r)
+					if (*r == ';') ++n_flt;
+				a = (int32_t*)alloca(n_flt * 4);
+				for (t = p, n_flt = 0;; t = r + 1) {
+					int c;
+					for (r = t; *r && *r != ';'; ++r);
+					c = *r, *r = 0;
+					k = kh_get(vdict, d, t);
+					if (k == kh_end(d)) {
+						if (hts_verbose >= 2) fprintf(stderr, "[W::%s] undefined FILTER '%s'\n", __func__, t);
+					} else a[n_flt++] = kh_val(d, k).id;
+					if (c == 0) break;
+				}
+				bcf_enc_vint(str, n_flt, a, -1);
+			} else bcf_enc_vint(str, 0, 0, -1);
+		} else if (i == 7) { // INFO: only END and CIGAR are kept, as they affect atomization
+			char *r, *key, *val;
+			for (key = p; key < q; key = r + 1) {
+				if ((r = (char*)memchr(key, ';', q - key)) == 0) r = q;
+				for (val = key; val < r && *val != '='; ++val);
+				if (val == r || val - key > 5) continue;
+				if (val - key == 3 && strncmp(key, "END", 3) == 0) {
+					int32_t x = strtol(val + 1, 0, 10);
+					k = kh_get(vdict, d, "END");
+					if (k == kh_end(d) || kh_val(d, k).info[BCF_HL_INFO] == 15) continue;
+					bcf_enc_int1(str, kh_val(d, k).id);
+					bcf_enc_vint(str, 1, &x, -1);
+					v->rlen = x - v->pos;
+					++v->n_info;
+				} else if (val - key == 5 && strncmp(key, "CIGAR", 5) == 0) {
+					k = kh_get(vdict, d, "CIGAR");
+					if (k == kh_end(d) || kh_val(d, k).info[BCF_HL_INFO] == 15) continue;
+					bcf_enc_int1(str, kh_val(d, k).id);
+					bcf_enc_vchar(str, r - val - 1, val + 1);
+					++v->n_info;
+				}
+			}
+		} else if (i == 8) { // FORMAT: locate GT
+			char *r, *t;
+			for (t = p, n_fmt = 0;; t = r + 1, ++n_fmt) {
+				for (r = t; *r && *r != ':'; ++r);
+				if (r - t == 2 && t[0] == 'G' && t[1] == 'T') i_gt = n_fmt;
+				if (*r == 0) break;
+			}
+		}
+	}
+	if (i < 9 || i_gt < 0 || p >= end) return 0; // no genotypes
+	k = kh_get(vdict, d, "GT");
+	if (k == kh_end(d) || kh_val(d, k).info[BCF_HL_FMT] == 15) return 0;
+	str = &v->indiv;
+	bcf_enc_int1(str, kh_val(d, k).id);
+	bcf_enc_size(str, 2, BCF_BT_INT8);
+	for (;;) { // p points to the start of a sample field
+		int8_t x[2];
+		int is_phased = 0, l;
+		for (j = 0; j < i_gt; ++j) // skip subfields before GT
+			if ((p = vcf_skip_subfield(p, end)) < end && *p == ':') ++p;
+		x[0] = x[1] = bcf_int8_end;
+		for (l = 0; p < end && *p != ':' && *p != '\t';) {
+			int32_t a = -1;
+			if (*p == '.') ++p;
+			else for (a = 0; p < end && *p >= '0' && *p <= '9'; ++p)
+				a = a * 10 + (*p - '0');
+			if (a > 62) {
+				if (hts_verbose >= 2) fprintf(stderr, "[W::%s] allele index %d is too large; set to missing\n", __func__, a);
+				a = -1;
+			}
+			if (l < 2) x[l++] = (a + 1) << 1 | is_phased;
+			if (p < end && (*p == '|' || *p == '/')) is_phased = (*p++ == '|');
+			else if (p < end && *p != ':' && *p != '\t') ++p; // malformatted GT; skip the character
+		}
+		kputsn((char*)x, 2, str);
+		++v->n_sample;
+		if ((p = (char*)memchr(p, '\t', end - p)) == 0) break; // memchr() is vectorized by libc
+		++p;
+	}
+	v->n_fmt = 1;
+	return 0;
+}
+
 int vcf_read1(htsFile *fp, const bcf_hdr_t *h, bcf1_t *v)
 {
 	if (!fp->is_bin) {
@@ -974,7 +1113,14 @@ int vcf_write1(htsFile *fp, const bcf_hdr_t *h, const bcf1_t *v)
 		vcf_format1(h, v, &fp->line);
 		fwrite(fp->line.s, 1, fp->line.l, (FILE*)fp->fp);
 		fputc('\n', (FILE*)fp->fp);
-	} else return bcf_write1((BGZF*)fp->fp, v);
+	} else {
+		int ret;
+		ret = bcf_write1((BGZF*)fp->fp, v);
+		if (ret >= 0 && fp->idx) // the virtual offset of the end of this record
+			if (hts_idx_push(fp->idx, v->rid, v->pos, v->pos + v->rlen, bgzf_tell((BGZF*)fp->fp), 1) < 0)
+				return -1;
+		return ret;
+	}
 	return 0;
 }
 
@@ -999,28 +1145,36 @@ int bcf_name2id(const bcf_hdr_t *h, const char *id)
  *** BCF indexing ***
  ********************/
 
-hts_idx_t *bcf_index(BGZF *fp, int min_shift)
+static int bcf_idx_n_lvls(const bcf_hdr_t *h, int min_shift)
 {
 	int n_lvls, i;
-	bcf1_t *b;
-	hts_idx_t *idx;
-	bcf_hdr_t *h;
 	int64_t max_len = 0, s;
-	h = bcf_hdr_read(fp);
 	for (i = 0; i < h->n[BCF_DT_CTG]; ++i)
 		if (max_len < h->id[BCF_DT_CTG][i].val->info[0])
 			max_len = h->id[BCF_DT_CTG][i].val->info[0];
 	max_len += 256;
 	for (n_lvls = 0, s = 1<<min_shift; max_len > s; ++n_lvls, s <<= 3);
-	idx = hts_idx_init(h->n[BCF_DT_CTG], HTS_FMT_CSI, bgzf_tell(fp), min_shift, n_lvls);
+	return n_lvls;
+}
+
+hts_idx_t *bcf_index(BGZF *fp, int min_shift)
+{
+	bcf1_t *b;
+	hts_idx_t *idx;
+	bcf_hdr_t *h;
+	uint64_t off;
+	h = bcf_hdr_read(fp);
+	idx = hts_idx_init(h->n[BCF_DT_CTG], HTS_FMT_CSI, bgzf_tell(fp), min_shift, bcf_idx_n_lvls(h, min_shift));
 	bcf_hdr_destroy(h);
 	b = bcf_init1();
+	off = bgzf_tell(fp);
 	while (bcf_read1(fp, b) >= 0) {
 		int ret;
-		ret = hts_idx_push(idx, b->rid, b->pos, b->pos + b->rlen, bgzf_tell(fp), 1);
+		off = bgzf_tell(fp);
+		ret = hts_idx_push(idx, b->rid, b->pos, b->pos + b->rlen, off, 1);
 		if (ret < 0) break;
 	}
-	hts_idx_finish(idx, bgzf_tell(fp));
+	hts_idx_finish(idx, off); // the end of the last record, not of the EOF marker; the same as bcf_idx_save()
 	bcf_destroy1(b);
 	return idx;
 }
@@ -1037,6 +1191,24 @@ int bcf_index_build(const char *fn, int min_shift)
 	return 0;
 }
 
+int bcf_idx_init(htsFile *fp, const bcf_hdr_t *h, int min_shift)
+{
+	if (!fp->is_bin || !fp->is_write || fp->idx) return -1;
+	fp->idx = hts_idx_init(h->n[BCF_DT_CTG], HTS_FMT_CSI, bgzf_tell((BGZF*)fp->fp), min_shift, bcf_idx_n_lvls(h, min_shift));
+	return 0;
+}
+
+int bcf_idx_save(htsFile *fp)
+{
+	if (fp->idx == 0) return -1;
+	if (bgzf_flush((BGZF*)fp->fp) != 0) return -1;
+	hts_idx_finish(fp->idx, bgzf_tell((BGZF*)fp->fp));
+	hts_idx_save(fp->idx, fp->fn, HTS_FMT_CSI);
+	hts_idx_destroy(fp->idx);
+	fp->idx = 0;
+	return 0;
+}
+
 /*****************
  *** Utilities ***
  *****************/
@@ -216,6 +216,19 @@ extern "C" {
 	#define bcf_index_load(fn) hts_idx_load(fn, HTS_FMT_CSI)
 
 	int bcf_index_build(const char *fn, int min_shift);
+
+	/**
+	 * Build the CSI index while writing BCF
+	 *
+	 * Call bcf_idx_init() after vcf_hdr_write(); each vcf_write1() then adds
+	 * the record to the index. Call bcf_idx_save() before hts_close() to
+	 * write "$fp->fn.csi". Records must be written in the coordinate order.
+	 *
+	 * @return 0 on success; -1 if $fp is not BCF opened for writing
+	 */
+	int bcf_idx_init(htsFile *fp, const bcf_hdr_t *h, int min_shift);
+	int bcf_idx_save(htsFile *fp);
+
 	int bcf_seekn(BGZF *fp, const hts_idx_t *idx, int64_t n);
 
 	/***************
@@ -230,6 +243,18 @@ extern "C" {
 	void vcf_hdr_write(htsFile *fp, const bcf_hdr_t *h);
 
 	int vcf_parse1(kstring_t *s, const bcf_hdr_t *h, bcf1_t *v);
+
+	/**
+	 * Parse a VCF line, keeping GT only
+	 *
+	 * INFO fields other than END and CIGAR and FORMAT fields other than GT
+	 * are skipped. GT is encoded as a diploid int8 array. Unlike
+	 * vcf_parse1(), this function does not touch $h and can be called from
+	 * multiple threads. $s is modified in place.
+	 *
+	 * @return 0 on success; -1 if the line can't be parsed
+	 */
+	int vcf_parse1_gt(kstring_t *s, const bcf_hdr_t *h, bcf1_t *v);
 	int vcf_format1(const bcf_hdr_t *h, const bcf1_t *v, kstring_t *s);
 	int vcf_read1(htsFile *fp, const bcf_hdr_t *h, bcf1_t *v);
 	int vcf_write1(htsFile *fp, const bcf_hdr_t *h, const bcf1_t *v);
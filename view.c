@@ -3,6 +3,7 @@
 #include <string.h>
 #include <limits.h>
 #include <stdio.h>
+#include <pthread.h>
 #include "bgt.h"
 #include "kexpr.h"
 #include "fmf.h"
@@ -11,21 +12,192 @@ void *bed_read(const char *fn);
 void bed_destroy(void *_h);
 char **hts_readlines(const char *fn, int *_n);
 
+/*
+ * Ordered parallel reading of a sharded BGT: worker threads read row chunks,
+ * aligned to PBF checkpoints, into memory buffers and the calling thread
+ * writes the buffers in the chunk order. Only a window of 2*n_threads chunks
+ * may be read ahead of the writer, which bounds the memory.
+ */
+
+#define VIEW_CHUNK 8192 // max #rows per chunk, rounded up to a PBF checkpoint
+
+typedef struct {
+	int done, n, m;
+	kstring_t s; // VCF lines, table lines or BCF records
+	size_t *end; // end[i]: end of the i-th record in s
+} view_buf_t;
+
+typedef struct {
+	int n_threads, out_bcf, tbl, n_chunks, next, n_written, quit;
+	int64_t n, step;
+	bgtm_t **bm;
+	view_buf_t *buf; // ring buffer of 2*n_threads chunks
+	pthread_mutex_t lock;
+	pthread_cond_t cv;
+} view_par_t;
+
+typedef struct {
+	view_par_t *par;
+	int tid;
+} view_worker_t;
+
+// the binary encoding written by bcf_write1()
+static void view_bcf_enc1(const bcf1_t *v, kstring_t *s)
+{
+	uint32_t x[8];
+	x[0] = v->shared.l + 24;
+	x[1] = v->indiv.l;
+	memcpy(x + 2, v, 16);
+	x[6] = (uint32_t)v->n_allele<<16 | v->n_info;
+	x[7] = (uint32_t)v->n_fmt<<24 | v->n_sample;
+	kputsn((char*)x, 32, s);
+	kputsn(v->shared.s, v->shared.l, s);
+	kputsn(v->indiv.s, v->indiv.l, s);
+}
+
+static void view_read_chunk(view_par_t *par, bgtm_t *bm, int64_t beg, int64_t end, view_buf_t *buf)
+{
+	bcf1_t *b;
+	kstring_t line = {0,0,0};
+	b = bcf_init1();
+	buf->s.l = 0, buf->n = 0;
+	bgtm_set_start(bm, beg);
+	bgtm_set_end(bm, end);
+	while (bgtm_read(bm, b) >= 0) {
+		if (par->tbl) {
+			if (bm->n_fields > 0) kputs(bm->tbl_line.s, &buf->s), kputc('\n', &buf->s);
+		} else if (par->out_bcf) {
+			view_bcf_enc1(b, &buf->s);
+		} else {
+			vcf_format1(bm->h_out, b, &line);
+			kputsn(line.s, line.l, &buf->s); kputc('\n', &buf->s);
+		}
+		if (buf->n == buf->m) {
+			buf->m = buf->m? buf->m<<1 : 256;
+			buf->end = (size_t*)realloc(buf->end, buf->m * sizeof(size_t));
+		}
+		buf->end[buf->n++] = buf->s.l;
+	}
+	bcf_destroy1(b);
+	free(line.s);
+}
+
+static void *view_worker(void *data)
+{
+	view_worker_t *w = (view_worker_t*)data;
+	view_par_t *par = w->par;
+	int n_buf = par->n_threads * 2;
+	for (;;) {
+		int c;
+		int64_t end;
+		view_buf_t *buf;
+		pthread_mutex_lock(&par->lock);
+		while (!par->quit && par->next < par->n_chunks && par->next >= par->n_written + n_buf)
+			pthread_cond_wait(&par->cv, &par->lock);
+		c = par->quit? par->n_chunks : par->next++;
+		pthread_mutex_unlock(&par->lock);
+		if (c >= par->n_chunks) break;
+		end = (int64_t)(c + 1) * par->step;
+		buf = &par->buf[c % n_buf];
+		view_read_chunk(par, par->bm[w->tid], (int64_t)c * par->step, end < par->n? end : par->n, buf);
+		pthread_mutex_lock(&par->lock);
+		buf->done = 1;
+		pthread_cond_broadcast(&par->cv);
+		pthread_mutex_unlock(&par->lock);
+	}
+	return 0;
+}
+
+// read bm[0..n_threads-1], prepared identically, and write at most n_rec records in order; return #records
+static long view_par_write(int n_threads, bgtm_t **bm, htsFile *out, int tbl, long n_rec)
+{
+	view_par_t par;
+	view_worker_t *w;
+	pthread_t *tid;
+	int i, c, n_buf = n_threads * 2, shift;
+	long n_read = 0;
+
+	memset(&par, 0, sizeof(view_par_t));
+	par.n_threads = n_threads, par.bm = bm, par.tbl = tbl;
+	par.out_bcf = (out && out->is_bin);
+	par.n = bgt_get_n(bm[0]->bgt[0]);
+	shift = pbf_get_shift(bm[0]->bgt[0]->pb);
+	par.step = bgt_chunk_size(par.n, shift, n_threads);
+	if (par.step > VIEW_CHUNK) par.step = (VIEW_CHUNK + (1<<shift) - 1) >> shift << shift;
+	par.n_chunks = (par.n + par.step - 1) / par.step;
+	par.buf = (view_buf_t*)calloc(n_buf, sizeof(view_buf_t));
+	pthread_mutex_init(&par.lock, 0);
+	pthread_cond_init(&par.cv, 0);
+	tid = (pthread_t*)calloc(n_threads, sizeof(pthread_t));
+	w = (view_worker_t*)calloc(n_threads, sizeof(view_worker_t));
+	for (i = 0; i < n_threads; ++i) {
+		w[i].par = &par, w[i].tid = i;
+		pthread_create(&tid[i], 0, view_worker, &w[i]);
+	}
+	for (c = 0; c < par.n_chunks && n_read < n_rec; ++c) {
+		view_buf_t *buf = &par.buf[c % n_buf];
+		size_t l;
+		pthread_mutex_lock(&par.lock);
+		while (!buf->done) pthread_cond_wait(&par.cv, &par.lock);
+		pthread_mutex_unlock(&par.lock);
+		if (buf->n > n_rec - n_read) {
+			l = buf->end[n_rec - n_read - 1];
+			n_read = n_rec;
+		} else l = buf->s.l, n_read += buf->n;
+		if (par.out_bcf) bgzf_write((BGZF*)out->fp, buf->s.s, l);
+		else fwrite(buf->s.s, 1, l, stdout);
+		pthread_mutex_lock(&par.lock);
+		buf->done = 0;
+		par.n_written = c + 1;
+		pthread_cond_broadcast(&par.cv);
+		pthread_mutex_unlock(&par.lock);
+	}
+	pthread_mutex_lock(&par.lock);
+	par.quit = 1;
+	pthread_cond_broadcast(&par.cv);
+	pthread_mutex_unlock(&par.lock);
+	for (i = 0; i < n_threads; ++i) pthread_join(tid[i], 0);
+	for (i = 0; i < n_buf; ++i) {
+		free(par.buf[i].s.s); free(par.buf[i].end);
+	}
+	free(par.buf); free(tid); free(w);
+	pthread_cond_destroy(&par.cv);
+	pthread_mutex_destroy(&par.lock);
+	return n_read;
+}
+
+// a reader for view_par_write(); only the settings allowed with parallel reading
+static bgtm_t *view_par_reader_init(int n_files, bgt_file_t **files, int flag, const char *site_flt, void *bed, int excl, const char *fmt, int n_groups, char *const*gexpr)
+{
+	int i;
+	bgtm_t *bm;
+	bm = bgtm_reader_init(n_files, files);
+	bgtm_set_flag(bm, flag);
+	if (site_flt) bgtm_set_flt_site(bm, site_flt);
+	if (bed) bgtm_set_bed(bm, bed, excl);
+	if (fmt) bgtm_set_table(bm, fmt);
+	for (i = 0; i < n_groups; ++i)
+		bgtm_add_group(bm, gexpr[i]);
+	bgtm_prepare(bm);
+	return bm;
+}
+
 int main_view(int argc, char *argv[])
 {
-	int i, c, n_files = 0, out_bcf = 0, clevel = -1, multi_flag = 0, excl = 0, not_vcf = 0, in_mem = 0, u_set = 0;
+	int i, c, n_files = 0, out_bcf = 0, clevel = -1, multi_flag = 0, excl = 0, not_vcf = 0, in_mem = 0, u_set = 0, n_threads = 1, n_par = 0;
 	long seekn = -1, n_rec = LONG_MAX, n_read = 0;
 	bgtm_t *bm = 0;
 	bcf1_t *b;
 	htsFile *out = 0;
-	char modew[8], *reg = 0, *site_flt = 0;
+	char modew[8], *reg = 0, *site_flt = 0, *spl_flt = 0;
+	double approx = 0.;
 	void *bed = 0;
 	int n_groups = 0;
-	char *gexpr[BGT_MAX_GROUPS], *aexpr = 0, *dbfn = 0, *fmt = 0;
+	char *gexpr[BGT_MAX_GROUPS], *aexpr = 0, *dbfn = 0, *annfn = 0, *fmt = 0;
 	bgt_file_t **files = 0;
 	fmf_t *vardb = 0;
 
-	while ((c = getopt(argc, argv, "ubs:r:l:CMGB:ef:g:a:i:n:SHt:d:")) >= 0) {
+	while ((c = getopt(argc, argv, "ubs:r:l:CMGB:ef:g:a:i:n:SHt:d:A:@:c:P:")) >= 0) {
 		if (c == 'b') out_bcf = 1;
 		else if (c == 'r') reg = optarg;
 		else if (c == 'l') clevel = atoi(optarg);
@@ -35,15 +207,19 @@ int main_view(int argc, char *argv[])
 		else if (c == 'C') multi_flag |= BGT_F_SET_AC;
 		else if (c == 'G') multi_flag |= BGT_F_NO_GT;
 		else if (c == 'S') multi_flag |= BGT_F_NO_GT | BGT_F_CNT_AL, not_vcf = 1;
+		else if (c == 'c') multi_flag |= BGT_F_NO_GT | BGT_F_CNT_GT, spl_flt = optarg, not_vcf = 1;
 		else if (c == 'H') multi_flag |= BGT_F_NO_GT | BGT_F_CNT_HAP, not_vcf = 1;
 		else if (c == 'M') in_mem = 1;
 		else if (c == 'i') seekn = atol(optarg) - 1;
 		else if (c == 'n') n_rec = atol(optarg);
 		else if (c == 'f') site_flt = optarg;
-		else if (c == 't') fmt = optarg, not_vcf = 1;
+		else if (c == 't') fmt = optarg, not_vcf = 1, multi_flag |= BGT_F_NO_GT;
 		else if (c == 'd') dbfn = optarg;
 		else if (c == 's' && n_groups < BGT_MAX_GROUPS) gexpr[n_groups++] = optarg;
 		else if (c == 'a') aexpr = optarg;
+		else if (c == 'A') approx = atof(optarg);
+		else if (c == '@') n_threads = atoi(optarg);
+		else if (c == 'P') pbf_min_par = atoi(optarg);
 	}
 	if (n_rec < 0) {
 		fprintf(stderr, "[E::%s] option -n must be at least 0.\n", __func__);
@@ -64,10 +240,14 @@ int main_view(int argc, char *argv[])
 		fprintf(stderr, "    -e           exclude variants overlapping BED FILE (effective with -B)\n");
 		fprintf(stderr, "    -i INT       process from the INT-th record (1-based) []\n");
 		fprintf(stderr, "    -n INT       process at most INT records []\n");
-		fprintf(stderr, "    -d FILE      variant annotations in FMF (to work with -a) []\n");
+		fprintf(stderr, "    -d FILE      variant annotations in FMF, for -a, or as variables in -f/-t if sorted\n");
+		fprintf(stderr, "                 by position []\n");
 		fprintf(stderr, "    -M           load variant annotations in RAM (only with -d)\n");
 		fprintf(stderr, "    -a EXPR      alleles list chr:1basedPos:refLen:seq (,allele1,allele2 or a file or expr) []\n");
 		fprintf(stderr, "    -f STR       frequency filters []\n");
+		fprintf(stderr, "    -A FLOAT     approximate AC/AN from a random subset of samples in each group, such\n");
+		fprintf(stderr, "                 that 95%% CIs of allele frequencies are within +/-FLOAT (implies -G; genotype\n");
+		fprintf(stderr, "                 counts are scaled likewise; not with HWE) []\n");
 		fprintf(stderr, "  VCF output:\n");
 		fprintf(stderr, "    -b           BCF output (effective without -S/-H)\n");
 		fprintf(stderr, "    -l INT       compression level for BCF [default]\n");
@@ -76,9 +256,20 @@ int main_view(int argc, char *argv[])
 		fprintf(stderr, "    -C           write AC/AN to the INFO field (auto applied with -f or multipl -s)\n");
 		fprintf(stderr, "  Non-VCF output:\n");
 		fprintf(stderr, "    -S           show samples with a set of alleles (with -a)\n");
+		fprintf(stderr, "    -c EXPR      show per-sample genotype counts across selected sites, filtered by EXPR\n");
+		fprintf(stderr, "                 (1 for all samples). Accepted variables: n_het, n_homalt, n_missing,\n");
+		fprintf(stderr, "                 n_alt, n_sites\n");
 		fprintf(stderr, "    -H           count of haplotypes with a set of alleles (with -a)\n");
 		fprintf(stderr, "    -t STR       comma-delimited list of fields to output. Accepted variables:\n");
 		fprintf(stderr, "                 AC, AN, AC#, AN#, CHROM, POS, END, REF, ALT (# for a group number)\n");
+		fprintf(stderr, "                 nHomRef, nHet, nHomAlt, nMissing, het, callRate, HWE (also with #; computed\n");
+		fprintf(stderr, "                 only if used, also in -f), AFlo, AFhi (95%% CI of AC/AN; also with #),\n");
+		fprintf(stderr, "                 carriers (sample:GT of samples with an ALT allele; not in -f)\n");
+		fprintf(stderr, "  Performance:\n");
+		fprintf(stderr, "    -@ INT       threads for reading the shards of a sharded BGT in parallel (without\n");
+		fprintf(stderr, "                 -r/-i/-a/-A/-S/-H/-c or annotations in -f/-t), or otherwise for\n");
+		fprintf(stderr, "                 decoding PBF column blocks (see 'bgt reindex -b') [1]\n");
+		fprintf(stderr, "    -P INT       decode blocks in parallel only if INT or more haplotypes are selected [%d]\n", pbf_min_par);
 		fprintf(stderr, "Notes:\n");
 		fprintf(stderr, "  For option -s/-a, EXPR can be one of:\n");
 		fprintf(stderr, "    1) comma-delimited list following a colon/comma. e.g. -s,NA12878,NA12044\n");
@@ -89,6 +280,7 @@ int main_view(int argc, char *argv[])
 		return 1;
 	}
 
+	annfn = dbfn;
 	if (dbfn && in_mem) vardb = fmf_read(dbfn), dbfn = 0;
 
 	if ((multi_flag&(BGT_F_CNT_AL|BGT_F_CNT_HAP)) && aexpr == 0) {
@@ -106,12 +298,29 @@ int main_view(int argc, char *argv[])
 		}
 	}
 
+	// full scans of a sharded BGT are split into row chunks read in parallel
+	if (n_threads > 1 && n_files == 1 && files[0]->n_shards > 0 && reg == 0 && seekn < 0 && aexpr == 0 && approx == 0.
+		&& !(annfn && (site_flt || fmt)) && !(multi_flag & (BGT_F_CNT_AL|BGT_F_CNT_HAP|BGT_F_CNT_GT)))
+		n_par = n_threads;
+	else bgt_dec_threads = n_threads;
+
 	bm = bgtm_reader_init(n_files, files);
 	bgtm_set_flag(bm, multi_flag);
+	if (approx > 0.) {
+		if (multi_flag & (BGT_F_CNT_AL|BGT_F_CNT_HAP|BGT_F_CNT_GT)) {
+			fprintf(stderr, "[E::%s] -A can't be used with -S/-H/-c.\n", __func__);
+			return 1;
+		}
+		bgtm_set_approx(bm, approx);
+	}
 	if (site_flt && bgtm_set_flt_site(bm, site_flt) != 0) {
 		fprintf(stderr, "[E::%s] failed to set frequency filters. Syntax error?\n", __func__);
 		return 1;
 	}
+	if (spl_flt && bgtm_set_flt_sample(bm, spl_flt) != 0) {
+		fprintf(stderr, "[E::%s] failed to set sample filters. Syntax error or unknown variable?\n", __func__);
+		return 1;
+	}
 	if (reg && bgtm_set_region(bm, reg) < 0) {
 		fprintf(stderr, "[E::%s] failed to set region. Region format error?\n", __func__);
 		return 1;
@@ -121,6 +330,14 @@ int main_view(int argc, char *argv[])
 		fprintf(stderr, "[E::%s] failed to set tabular output.\n", __func__);
 		return 1;
 	}
+	if (approx > 0. && (bm->site_vars & BGT_V_HWE)) {
+		fprintf(stderr, "[E::%s] -A can't be used with HWE.\n", __func__);
+		return 1;
+	}
+	if (annfn && bgtm_has_annot_var(bm) && bgtm_set_annot(bm, annfn) < 0) {
+		fprintf(stderr, "[E::%s] failed to open site annotations '%s'\n", __func__, annfn);
+		return 1;
+	}
 	if (seekn > 0) bgtm_set_start(bm, seekn);
 	if (aexpr) {
 		int n_al;
@@ -147,14 +364,31 @@ int main_view(int argc, char *argv[])
 		vcf_hdr_write(out, bm->h_out);
 	}
 
-	b = bcf_init1();
-	while (bgtm_read(bm, b) >= 0 && n_read < n_rec) {
-		if (out) vcf_write1(out, bm->h_out, b);
-		if (fmt && bm->n_fields > 0) puts(bm->tbl_line.s);
-		++n_read;
+	if (n_par > 1) {
+		bgtm_t **bms;
+		bms = (bgtm_t**)calloc(n_par, sizeof(bgtm_t*));
+		bms[0] = bm;
+		for (i = 1; i < n_par; ++i)
+			bms[i] = view_par_reader_init(n_files, files, multi_flag, site_flt, bed, excl, fmt, n_groups, gexpr);
+		n_read = view_par_write(n_par, bms, out, fmt != 0, n_rec);
+		for (i = 1; i < n_par; ++i) bgtm_reader_destroy(bms[i]);
+		free(bms);
+	} else {
+		b = bcf_init1();
+		while (bgtm_read(bm, b) >= 0 && n_read < n_rec) {
+			if (out) vcf_write1(out, bm->h_out, b);
+			if (fmt && bm->n_fields > 0) puts(bm->tbl_line.s);
+			++n_read;
+		}
+		bcf_destroy1(b);
 	}
-	bcf_destroy1(b);
 
+	if (bm->flag & BGT_F_CNT_GT) {
+		char *s;
+		if ((s = bgtm_gtcnt_print(bm)) != 0)
+			fputs(s, stdout);
+		free(s);
+	}
 	if (not_vcf && bm->n_aal > 0) {
 		if (bm->flag & BGT_F_CNT_HAP) {
 			bgt_hapcnt_t *hc;